@@ -1,7 +1,11 @@
 #include <cstdlib>
+#include <unistd.h>
 
 #include "common.hh"
 
+/** The size of the blocks used in the chunked file I/O routines. */
+const size_t chunk_size=1<<22;
+
 /** \brief Opens a file and checks the operation was successful.
  *
  * Opens a file, and checks the return value to ensure that the operation
@@ -24,3 +28,30 @@ void fatal_error(const char *p,int code) {
     fprintf(stderr,"Error: %s\n",p);
     exit(code);
 }
+
+/** \brief Reads or writes a block of memory using a file in parallel.
+ *
+ * Reads or writes a block of memory at a given offset in a file, splitting it
+ * into chunks that are transferred concurrently by different threads. Exits
+ * with an error if any of the transfers fail.
+ * \param[in] fd the file descriptor to use.
+ * \param[in] p a pointer to the memory.
+ * \param[in] len the number of bytes to transfer.
+ * \param[in] off the file offset.
+ * \param[in] wr true if the memory should be written to the file, false if
+ *               it should be read from it. */
+void chunked_io(int fd,void *p,size_t len,off_t off,bool wr) {
+    char *cp=static_cast<char*>(p);
+    int chunks=static_cast<int>((len+chunk_size-1)/chunk_size);
+    bool ok=true;
+#pragma omp parallel for schedule(dynamic) reduction(&&:ok)
+    for(int k=0;k<chunks;k++) {
+        size_t s=k*chunk_size,e=s+chunk_size<len?s+chunk_size:len;
+        while(s<e) {
+            ssize_t r=wr?pwrite(fd,cp+s,e-s,off+s):pread(fd,cp+s,e-s,off+s);
+            if(r<=0) {ok=false;break;}
+            s+=r;
+        }
+    }
+    if(!ok) fatal_error(wr?"Error writing to file":"Error reading from file",1);
+}
@@ -3,8 +3,10 @@
 
 #include <cstdio>
 #include <cmath>
+#include <sys/types.h>
 
 FILE* safe_fopen(const char* filename,const char* mode);
 void fatal_error(const char *p,int code);
+void chunked_io(int fd,void *p,size_t len,off_t off,bool wr);
 
 #endif
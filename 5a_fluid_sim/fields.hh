@@ -3,22 +3,24 @@
 
 #include <cmath>
 
-/** Data structure for storing the fields at grid points. */
-struct field {
+/** Data structure for storing the fields at grid points, using a given
+ * floating point type. */
+template<class T>
+struct field_t {
     /** The horizontal velocity. */
-    double u;
+    T u;
     /** The vertical velocity. */
-    double v;
+    T v;
     /** The pressure. */
-    double p;
+    T p;
     /** The intermediate horizontal velocity. */
-    double us;
+    T us;
     /** The intermediate vertical velocity. */
-    double vs;
-    inline void prd_bc(field &f) {
+    T vs;
+    inline void prd_bc(field_t &f) {
         u=f.u;v=f.v;
     }
-    inline void no_slip(field &f) {
+    inline void no_slip(field_t &f) {
         u=-f.u;v=-f.v;
     }
     /** Computes the maximum allowable timestep based on the CFL restriction
@@ -31,4 +33,42 @@ struct field {
     }
 };
 
+/** Data structure for storing the fields at grid points in double
+ * precision. */
+typedef field_t<double> field;
+
+/** Data structure for storing the fields at grid points in the 3D
+ * simulation. */
+struct field_3d {
+    /** The x component of the velocity. */
+    double u;
+    /** The y component of the velocity. */
+    double v;
+    /** The z component of the velocity. */
+    double w;
+    /** The pressure. */
+    double p;
+    /** The intermediate x component of the velocity. */
+    double us;
+    /** The intermediate y component of the velocity. */
+    double vs;
+    /** The intermediate z component of the velocity. */
+    double ws;
+    inline void prd_bc(field_3d &f) {
+        u=f.u;v=f.v;w=f.w;
+    }
+    inline void no_slip(field_3d &f) {
+        u=-f.u;v=-f.v;w=-f.w;
+    }
+    /** Computes the maximum allowable timestep based on the CFL restriction
+     * from the velocity stored in this class.
+     * \param[in] (xsp,ysp,zsp) the inverse grid spacings.
+     * \return The reciprocal of the maximum allowable timestep. */
+    inline double cfl(double xsp,double ysp,double zsp) {
+        double uc=fabs(u)*xsp,vc=fabs(v)*ysp,wc=fabs(w)*zsp;
+        uc=uc>vc?uc:vc;
+        return uc>wc?uc:wc;
+    }
+};
+
 #endif
@@ -1,8 +1,25 @@
 #include <cstring>
 #include <limits>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "common.hh"
 #include "fluid_2d.hh"
+#include "mgs_fem_vr.hh"
+#include "write_png.hh"
+#include "weno.hh"
+
+/** The identifier at the start of checkpoint files. */
+const char chk_magic[8]={'F','2','D','C','H','K','0','2'};
+
+/** The names of the timed phases of a simulation step. The predictor phase
+ * includes the ghost values of the intermediate velocity, the solve phase
+ * includes the density update in the variable density mode, and the pressure
+ * phase computes the mean of the solution. The update phase includes copying
+ * the pressure and the left and right ghost values, which are done as each
+ * row is completed. */
+const char* const f2d_phase_names[f2d_phases]={"tracers","predictor",
+    "source","solve","pressure","update","boundaries"};
 
 /** The class constructor sets up constants the control the geometry and the
  * simulation, dynamically allocates memory for the fields, and calls the
@@ -15,21 +32,39 @@
  * \param[in] visc_ the fluid viscosity.
  * \param[in] rho_ the fluid density.
  * \param[in] filename_ the filename of the output directory. */
-fluid_2d::fluid_2d(const int m_,const int n_,const bool x_prd_,
+template<class T>
+fluid_2d_t<T>::fluid_2d_t(const int m_,const int n_,const bool x_prd_,
         const bool y_prd_,const double ax_,const double bx_,
         const double ay_,const double by_,const double visc_,
         const double rho_,unsigned int fflags_,const char *filename_)
     : m(m_), n(n_), mn(m_*n_), m_fem(x_prd_?m:m+1), n_fem(y_prd_?n:n+1),
-    ml(m+4), ntrace(0), x_prd(x_prd_), y_prd(y_prd_), ax(ax_), ay(ay_),
+    ml(m+6), ntrace(0), x_prd(x_prd_), y_prd(y_prd_), ax(ax_), ay(ay_),
     bx(bx_), by(by_), dx((bx_-ax_)/m_), dy((by_-ay_)/n_), xsp(1/dx), ysp(1/dy),
     xxsp(xsp*xsp), yysp(ysp*ysp), visc(visc_), rho(rho_), rhoinv(1/rho),
-    filename(filename_), fbase(new field[ml*(n+4)]), fm(fbase+2*ml+2),
-    src(new double[m_fem*n_fem]), tm(NULL), time(0.), f_num(0),
-    fflags(fflags_), ms_fem(*this), buf(new float[m>123?m+5:128]) {}
+    filename(filename_), fbase(new field[ml*(n+6)]), fm(fbase+3*ml+3),
+    src(new double[m_fem*n_fem]), tm(NULL), rbase(NULL), rm(NULL),
+    vr_ratio(1.), vr_setup_k(1), pad_fac(1.), adapt_k(0),
+    dt_lo(0.), dt_hi(std::numeric_limits<double>::max()), dt_grow(1.1),
+    rk_order(1), use_weno(false), time(0.), f_num(0), fflags(fflags_),
+    chk_freq(0), diag_freq(0), png_mode(-1), png_ds(1), png_lo(-1), png_hi(1),
+    phase_print(false), phase_csv(false),
+    ms_fem(*this), ms_vr(NULL), zs(ms_fem.z), tpp(&ms_fem.tp), rsbase(NULL),
+    rsm(NULL), vr_steps(0), vr_setups(0), vr_setup_time(0.), cfl_check(false),
+    cfl_max(0.), dts_steps(0), diag_steps(0), diag_fp(NULL), rk0(NULL),
+    ph_t(0.), buf(new float[ml+1>128?ml+1:128]) {
+    reset_phases();
+}
 
 /** The class destructor frees the dynamically allocated memory. */
-fluid_2d::~fluid_2d() {
+template<class T>
+fluid_2d_t<T>::~fluid_2d_t() {
+    if(ms_vr!=NULL) {
+        delete ms_vr;
+        delete [] rsbase;
+        delete [] rbase;
+    }
     if(ntrace>0) delete [] tm;
+    if(rk0!=NULL) delete [] rk0;
     delete [] buf;
     delete [] src;
     delete [] fbase;
@@ -43,8 +78,10 @@ fluid_2d::~fluid_2d() {
  * \param[in] max_spd a maximum fluid speed from which to estimate the
  *                    advection timestep restriction. If a negative value is
  *                    supplied, then the advection CFL condition is explicitly
- *                    calculated. */
-void fluid_2d::initialize(int ntrace_,double dt_pad,double max_spd) {
+ *                    calculated.
+ * \param[in] verbose whether to print out the timestep information. */
+template<class T>
+void fluid_2d_t<T>::initialize(int ntrace_,double dt_pad,double max_spd,bool verbose) {
 
     // Set up the tracers (if any) and initialize the simulation fields
     if((ntrace=ntrace_)>0) init_tracers();
@@ -52,13 +89,15 @@ void fluid_2d::initialize(int ntrace_,double dt_pad,double max_spd) {
 
     // Compute the timestep, based on the restrictions from the advection
     // and velocity, plus a padding factor
-    choose_dt(dt_pad,max_spd<=0?advection_dt():(dx>dy?dx:dy)/max_spd);
+    pad_fac=dt_pad;
+    choose_dt(dt_pad,max_spd<=0?advection_dt():(dx>dy?dx:dy)/max_spd,verbose);
 }
 
 /** Computes the maximum timestep that can resolve the fluid advection, based
  * on the CFL condition.
  * \return The maximum timestep. */
-double fluid_2d::advection_dt() {
+template<class T>
+double fluid_2d_t<T>::advection_dt() {
     double adv_dt=0;
 #pragma omp parallel for reduction(max:adv_dt)
     for(int j=0;j<n;j++) {
@@ -76,12 +115,20 @@ double fluid_2d::advection_dt() {
  *                   terms, which should be smaller than 1.
  * \param[in] adv_dt the maximum timestep to resolve the fluid advection.
  * \param[in] verbose whether to print out messages to the screen. */
-void fluid_2d::choose_dt(double dt_pad,double adv_dt,bool verbose) {
+template<class T>
+void fluid_2d_t<T>::choose_dt(double dt_pad,double adv_dt,bool verbose) {
 
-    // Calculate the viscous timestep restriction
-    double vis_dt=0.5*rho/(visc*(xxsp+yysp));
+    // Calculate the viscous timestep restriction, using the smallest density
+    // in the variable density mode
+    double vis_dt=0.5*rho*(rm!=NULL&&vr_ratio<1?vr_ratio:1)/(visc*(xxsp+yysp));
     int ca;
 
+    // Scale the restrictions according to the stability region of the time
+    // integrator. The SSP-RK3 region contains part of the imaginary axis and
+    // extends to -2.51 on the real axis, compared to -2 for forward Euler and
+    // SSP-RK2.
+    if(rk_order==3) {adv_dt*=1.5;vis_dt*=1.25;}
+
     // Choose the minimum of the two timestep restrictions
     if(adv_dt<vis_dt) {ca=0;dt_reg=adv_dt;}
     else {ca=1;dt_reg=vis_dt;}
@@ -98,8 +145,62 @@ void fluid_2d::choose_dt(double dt_pad,double adv_dt,bool verbose) {
     }
 }
 
+/** Switches on the adaptive timestepping mode, where the advection CFL
+ * condition is re-evaluated periodically during the simulation and the
+ * timestep is adjusted accordingly. The timestep chosen by the initialize
+ * routine is used until the first re-evaluation.
+ * \param[in] k the number of steps between re-evaluations. If zero is
+ *              supplied, then the fixed timestep mode is restored.
+ * \param[in] (dt_lo_,dt_hi_) the lower and upper bounds on the timestep.
+ * \param[in] dt_grow_ the maximum factor by which the timestep can grow at
+ *                     each re-evaluation, to prevent abrupt changes. */
+template<class T>
+void fluid_2d_t<T>::adaptive_dt(int k,double dt_lo_,double dt_hi_,double dt_grow_) {
+    adapt_k=k;
+    dt_lo=dt_lo_;dt_hi=dt_hi_;
+    dt_grow=dt_grow_;
+}
+
+/** Selects the time integrator for the velocity. The Runge-Kutta schemes
+ * carry out a projection at every stage, so each step requires rk_order
+ * pressure solves. This should be called before the initialize routine, so
+ * that the timestep is chosen accordingly.
+ * \param[in] order the integrator to use. (1: forward Euler, 2: SSP-RK2, 3:
+ *                  SSP-RK3) */
+template<class T>
+void fluid_2d_t<T>::time_integrator(int order) {
+    if(order<1||order>3) fatal_error("Integrator order must be between 1 and 3",1);
+    if(order>1&&rm!=NULL)
+        fatal_error("Runge-Kutta integrators are not available in the variable density mode",1);
+    if((rk_order=order)>1&&rk0==NULL) rk0=new T[2*mn];
+}
+
+/** Switches on the variable density mode, where a density field is advected
+ * with the flow and the pressure projection is carried out with the variable
+ * coefficient finite-element operator. This must be called before the
+ * initialize routine.
+ * \param[in] vr_ratio_ the ratio of the density inside the initial drop to
+ *                      the ambient density.
+ * \param[in] vr_setup_k_ the number of steps between rebuilding the coarse
+ *                        levels of the multigrid hierarchy. The finest level
+ *                        always uses the current density, so larger values
+ *                        only affect the multigrid convergence rate. */
+template<class T>
+void fluid_2d_t<T>::varying_density(double vr_ratio_,int vr_setup_k_) {
+    if(rk_order>1)
+        fatal_error("Runge-Kutta integrators are not available in the variable density mode",1);
+    vr_ratio=vr_ratio_;
+    vr_setup_k=vr_setup_k_;
+    if(ms_vr!=NULL) return;
+    rbase=new double[ml*(n+6)];rm=rbase+3*ml+3;
+    rsbase=new double[ml*(n+6)];rsm=rsbase+3*ml+3;
+    ms_vr=new mgs_fem_varying_rho(*this);
+    zs=ms_vr->z;tpp=&ms_vr->tp;
+}
+
 /** Initializes the simulation fields. */
-void fluid_2d::init_fields() {
+template<class T>
+void fluid_2d_t<T>::init_fields() {
 
     // Loop over the primary grid and set the velocity and pressure
 #pragma omp parallel for
@@ -122,137 +223,647 @@ void fluid_2d::init_fields() {
     // Now that the primary grid points are set up, initialize the ghost
     // points according to the boundary conditions
     set_boundaries();
+
+    // In the variable density mode, set up a drop of different density and
+    // the corresponding multigrid hierarchy
+    if(rm!=NULL) {
+#pragma omp parallel for
+        for(int j=0;j<n;j++) {
+            double y=ay+dy*(j+0.5)-0.4,*rp=rm+ml*j;
+            for(int i=0;i<m;i++) {
+                double x=ax+dx*(i+0.5);
+                rp[i]=rho*(x*x+y*y<0.04?vr_ratio:1);
+            }
+        }
+        set_density_boundaries(rm);
+        vr_steps=-1;
+        vr_update();
+    }
 }
 
 /** Carries out the simulation for a specified time interval using the direct
  * simulation method, periodically saving the output.
  * \param[in] duration the simulation duration.
  * \param[in] frames the number of frames to save. */
-void fluid_2d::solve(double duration,int frames) {
-    double t0,t1,t2,adt;
-    int l=timestep_select(duration/frames,adt);
+template<class T>
+void fluid_2d_t<T>::solve(double duration,int frames) {
+    double t0,t1,t2,adt,interval=duration/frames;
+    int l=timestep_select(interval,adt),l_fix=l,s_start=dts_steps;
 
     // Save header file, output the initial fields and record the initial wall
     // clock time
     save_header(duration,frames);
     if(f_num==0) write_files(0), puts("# Output frame 0");
+
+    // In the adaptive mode, open a file to log the timesteps used in each
+    // frame
+    FILE *dtf=NULL;
+    if(adapt_k>0) {
+        char *bufc=reinterpret_cast<char*>(buf);
+        sprintf(bufc,"%s/dt_stats",filename);
+        dtf=safe_fopen(bufc,f_num==0?"w":"a");
+    }
+
+    // If requested, open a file for the time series of in-situ diagnostics
+    if(diag_freq>0) {
+        char *bufc=reinterpret_cast<char*>(buf);
+        sprintf(bufc,"%s/diag",filename);
+        diag_fp=safe_fopen(bufc,f_num==0?"w":"a");
+        if(f_num==0) fputs("# time kinetic_energy enstrophy div_max div_rms "
+                           "u_max p_min p_max p_mean p_std\n",diag_fp);
+    }
+
+    // If requested, open a CSV file for the per-frame phase timings. The
+    // phase counters for the frame are reset, so that they only include
+    // the steps taken within this routine.
+    FILE *phf=NULL;
+    if(phase_csv) {
+        char *bufc=reinterpret_cast<char*>(buf);
+        sprintf(bufc,"%s/phases.csv",filename);
+        phf=safe_fopen(bufc,f_num==0?"w":"a");
+        if(f_num==0) {
+            fputs("frame,steps",phf);
+            for(int p=0;p<f2d_phases;p++) fprintf(phf,",%s_s",f2d_phase_names[p]);
+            for(int p=0;p<f2d_phases;p++) fprintf(phf,",%s_gbs",f2d_phase_names[p]);
+            fputc('\n',phf);
+        }
+    }
+    for(int p=0;p<f2d_phases;p++) ph_ftime[p]=ph_fbytes[p]=0;
     t0=wtime();
 
     // Loop over the output frames
     for(int k=1;k<=frames;k++) {
 
         // Perform the simulation steps
-        for(int j=0;j<l;j++) step_forward(adt);
+        if(adapt_k>0) l=adaptive_frame(time+interval);
+        else for(int j=0;j<l;j++) step_forward(adt);
 
         // Output the fields
         t1=wtime();
-        write_files(k+f_num);
+        write_files(++f_num);
 
         // Print diagnostic information
         t2=wtime();
-        printf("# Output frame %d [%d, %.8g s, %.8g s] {FEM %.2f}\n",
-               k,l,t1-t0,t2-t1,ms_fem.tp.avg_iters());
+        printf("# Output frame %d [%d, %.8g s, %.8g s] {FEM %.2f}",
+               k,l,t1-t0,t2-t1,fem_iters());
+        if(rm!=NULL) {
+            printf(" {setup %d, %.4g ms}",vr_setups,
+                   vr_setups>0?1e3*vr_setup_time/vr_setups:0);
+            vr_setups=0;vr_setup_time=0;
+        }
+        if(adapt_k>0) {
+            printf(" {dt %.4g %.4g %.4g}\n",dts_min,dts_sum/l,dts_max);
+            fprintf(dtf,"%d %d %.10g %.10g %.10g\n",f_num,l,dts_min,
+                    dts_sum/l,dts_max);
+        } else puts("");
+        phase_frame(phf,l);
+
+        // Write a checkpoint if requested. This is done after the diagnostic
+        // information is printed, so that the stored iteration counters
+        // correspond to the start of the next frame.
+        if(chk_freq>0&&f_num%chk_freq==0) {
+            char *bufc=reinterpret_cast<char*>(buf);
+            sprintf(bufc,"%s/chk",filename);
+            write_checkpoint(bufc);
+            t2=wtime();
+        }
         t0=t2;
     }
-    f_num+=frames;
+
+    if(diag_fp!=NULL) {fclose(diag_fp);diag_fp=NULL;}
+    if(phf!=NULL) fclose(phf);
+
+    // Print a summary of the adaptive timestepping, comparing to the number
+    // of steps that the initial timestep would have required
+    if(adapt_k>0) {
+        fclose(dtf);
+        s_start=dts_steps-s_start;
+        printf("# Adaptive dt: %d steps, mean dt %g (fixed dt: %d steps)\n",
+               s_start,duration/s_start,l_fix*frames);
+    }
+    if(phase_print) phase_summary();
 }
 
-/** Steps the simulation fields forward.
- * \param[in] dt the time step to use. */
-void fluid_2d::step_forward(double dt) {
-    int j;
-    double hx=0.5*dt*xsp,hy=0.5*dt*ysp,hxx=rhoinv*visc*xxsp*dt,
-           hyy=rhoinv*visc*yysp*dt;
+/** Resets the cumulative and per-frame phase timing counters. */
+template<class T>
+void fluid_2d_t<T>::reset_phases() {
+    for(int p=0;p<f2d_phases;p++) ph_time[p]=ph_bytes[p]=ph_ftime[p]=ph_fbytes[p]=0;
+}
 
-    // Perform an explicit Euler step of the tracer positions using the
-    // bilinear interpolation of the velocity field
-    update_tracers(dt);
+/** Reports the phase timings of the current frame, printing them if requested
+ * and writing them to a CSV file, and then resets the per-frame counters.
+ * \param[in] fp the handle of the CSV file, or NULL if it is not written.
+ * \param[in] l the number of steps taken in the frame. */
+template<class T>
+void fluid_2d_t<T>::phase_frame(FILE *fp,int l) {
+    int p;
+    if(phase_print) {
+        fputs("#   Phases [ms]:",stdout);
+        for(p=0;p<f2d_phases;p++) printf(" %s %.4g",f2d_phase_names[p],1e3*ph_ftime[p]);
+        puts("");
+    }
+    if(fp!=NULL) {
+        fprintf(fp,"%d,%d",f_num,l);
+        for(p=0;p<f2d_phases;p++) fprintf(fp,",%.6g",ph_ftime[p]);
+        for(p=0;p<f2d_phases;p++)
+            fprintf(fp,",%.6g",ph_ftime[p]>0?1e-9*ph_fbytes[p]/ph_ftime[p]:0);
+        fputc('\n',fp);
+    }
+    for(p=0;p<f2d_phases;p++) ph_ftime[p]=ph_fbytes[p]=0;
+}
 
-#pragma omp parallel for
-    for(j=0;j<n;j++) for(int i=0;i<m;i++) {
-        field *fp=fm+(ml*j+i),&f=*fp;
-
-        // Compute the second derivatives that are needed to evaluate the
-        // viscous stresses
-        double ux,vx,uy,vy,&uc=f.u,&vc=f.v,
-               uyy=hyy*(fp[-ml].u-2*uc+fp[ml].u),
-               vyy=hyy*(fp[-ml].v-2*vc+fp[ml].v),
-               uxx=hxx*(fp[-1].u-2*uc+fp[1].u),
-               vxx=hxx*(fp[-1].v-2*vc+fp[1].v);
-
-        // Compute advective terms using the second-order ENO scheme
-        uc>0?vel_eno2(ux,vx,hx,fp[1],f,fp[-1],fp[-2])
-            :vel_eno2(ux,vx,-hx,fp[-1],f,fp[1],fp[2]);
-        vc>0?vel_eno2(uy,vy,hy,fp[ml],f,fp[-ml],fp[-2*ml])
-            :vel_eno2(uy,vy,-hy,fp[-ml],f,fp[ml],fp[2*ml]);
-
-        // Compute the intermediate velocity using advection and viscosity.
-        // Note that the terms ux, uyy, etc. are already scaled by the correct
-        // constants.
-        f.us=f.u-uc*ux-vc*uy+uxx+uyy;
-        f.vs=f.v-uc*vx-vc*vy+vxx+vyy;
-    }
-
-    // Calculate the source term for the finite-element projection, doing
-    // some preliminary copying to simplify periodicity calculations
-    fem_source_term_conditions();
-    double sx=0.5*dx/dt,sy=0.5*dy/dt;
-#pragma omp parallel for
-    for(j=0;j<n_fem;j++) {
-        double *srp=src+j*m_fem;
-        for(field *fp=fm+j*ml,*fe=fp+m_fem;fp<fe;fp++)
-            *(srp++)=sx*(fp[-ml-1].us+fp[-1].us-fp[-ml].us-fp->us)
-                    +sy*(fp[-ml-1].vs-fp[-1].vs+fp[-ml].vs-fp->vs);
+/** Prints a summary of the cumulative time spent in each phase of the steps,
+ * its fraction of the total, and the memory bandwidth achieved according to
+ * the estimated traffic of each phase.
+ * \param[in] fp the file handle to write to. */
+template<class T>
+void fluid_2d_t<T>::phase_summary(FILE *fp) {
+    double tot=0;
+    for(int p=0;p<f2d_phases;p++) tot+=ph_time[p];
+    fputs("# Phase       time (s)   fraction   GB/s\n",fp);
+    for(int p=0;p<f2d_phases;p++)
+        fprintf(fp,"# %-10s %10.4g %9.2f%% %8.3g\n",f2d_phase_names[p],ph_time[p],
+                tot>0?100*ph_time[p]/tot:0,ph_time[p]>0?1e-9*ph_bytes[p]/ph_time[p]:0);
+    fprintf(fp,"# %-10s %10.4g\n","total",tot);
+}
+
+/** Writes a binary checkpoint file containing the complete simulation state,
+ * including the ghost regions, the tracers, the pressure solution that is
+ * used as the initial guess for the next solve, and the state of the
+ * multigrid iteration predictor, so that the simulation can be resumed
+ * exactly. The data is first written to a temporary file that is renamed once
+ * complete, so that an interrupted write never corrupts an existing
+ * checkpoint. The large arrays are written in parallel chunks.
+ * \param[in] fn the filename to write to. */
+template<class T>
+void fluid_2d_t<T>::write_checkpoint(const char *fn) {
+
+    // Open the temporary file
+    char *tfn=new char[strlen(fn)+5];
+    sprintf(tfn,"%s.tmp",fn);
+    int fd=open(tfn,O_WRONLY|O_CREAT|O_TRUNC,0644);
+    if(fd==-1) fatal_error("Can't open checkpoint file",1);
+
+    // Write the header, followed by the arrays
+    int ih[chk_ints];double dh[chk_doubles];
+    chk_header(ih,dh);
+    off_t off=chk_io(fd,true,ih,dh);
+
+    // Ensure that the data is on disk before renaming the file over any
+    // previous checkpoint
+    if(fsync(fd)!=0||close(fd)!=0) fatal_error("Error closing checkpoint file",1);
+    if(rename(tfn,fn)!=0) fatal_error("Error renaming checkpoint file",1);
+    delete [] tfn;
+    printf("# Checkpoint written to %s [%ld bytes]\n",fn,static_cast<long>(off));
+}
+
+/** Reads a binary checkpoint file created by the write_checkpoint routine,
+ * restoring the complete simulation state. This can be called in place of the
+ * initialize routine, after which the solve routine can be called to resume
+ * the simulation.
+ * \param[in] fn the filename to read from. */
+template<class T>
+void fluid_2d_t<T>::read_checkpoint(const char *fn) {
+    int fd=open(fn,O_RDONLY);
+    if(fd==-1) fatal_error("Can't open checkpoint file",1);
+
+    // Read the header and check that it matches the simulation setup
+    char magic[8];
+    int ih[chk_ints];double dh[chk_doubles];
+    chunked_io(fd,magic,8,0,false);
+    chunked_io(fd,ih,sizeof(int)*chk_ints,8,false);
+    if(memcmp(magic,chk_magic,8)!=0) fatal_error("Invalid checkpoint file",1);
+    if(ih[0]!=m||ih[1]!=n||ih[2]!=(x_prd?1:0)||ih[3]!=(y_prd?1:0)
+       ||ih[4]!=static_cast<int>(sizeof(field))||ih[14]!=(rm!=NULL?1:0))
+        fatal_error("Checkpoint file does not match the simulation setup",1);
+
+    // Set the tracer and extrapolation configuration, allocating memory if
+    // necessary, since this determines the remainder of the file layout
+    if(ih[5]!=ntrace) {
+        if(ntrace>0) delete [] tm;
+        tm=(ntrace=ih[5])>0?new double[ntrace<<1]:NULL;
     }
+    ms_fem.set_extrapolation(ih[10]);
+
+    // Read the arrays, and then set the scalar state from the header values
+    chk_io(fd,false,ih,dh);
+    close(fd);
+    f_num=ih[6];adapt_k=ih[7];dts_steps=ih[8];
+    tpp->lim=ih[9];ms_fem.nh=ih[11];
+    tpp->solves=ih[12];tpp->vcount=ih[13];
+    time=dh[0];dt_reg=dh[1];pad_fac=dh[2];dt_lo=dh[3];dt_hi=dh[4];
+    dt_grow=dh[5];cfl_max=dh[6];ms_fem.dth[0]=dh[7];ms_fem.dth[1]=dh[8];
+
+    // In the variable density mode, rebuild the multigrid hierarchy from the
+    // restored density. The resumed simulation is only bitwise identical if
+    // the hierarchy is rebuilt every step.
+    if(rm!=NULL) {
+        vr_steps=-1;
+        vr_update();
+        vr_steps=ih[15];
+    }
+}
 
-    // Solve the finite-element problem, and copy the pressure back into
-    // the main data structure, subtracting off the mean, and taking into
-    // account the boundary conditions
-    ms_fem.solve_v_cycle();
-    copy_pressure();
+/** Assembles the integer and floating point header values for a checkpoint
+ * file.
+ * \param[out] ih the integer values.
+ * \param[out] dh the floating point values. */
+template<class T>
+void fluid_2d_t<T>::chk_header(int *ih,double *dh) {
+    ih[0]=m;ih[1]=n;ih[2]=x_prd?1:0;ih[3]=y_prd?1:0;
+    ih[4]=sizeof(field);ih[5]=ntrace;ih[6]=f_num;ih[7]=adapt_k;
+    ih[8]=dts_steps;ih[9]=tpp->lim;ih[10]=ms_fem.ext_order;
+    ih[11]=ms_fem.nh;ih[12]=tpp->solves;ih[13]=tpp->vcount;
+    ih[14]=rm!=NULL?1:0;ih[15]=vr_steps;
+    dh[0]=time;dh[1]=dt_reg;dh[2]=pad_fac;dh[3]=dt_lo;dh[4]=dt_hi;
+    dh[5]=dt_grow;dh[6]=cfl_max;dh[7]=ms_fem.dth[0];dh[8]=ms_fem.dth[1];
+}
 
-    // Update u and v based on us, vs, and the computed pressure
-#pragma omp parallel for
-    for(j=0;j<n;j++) {
-        field *fp=fm+j*ml,*fe=fp+m;
-        while(fp<fe) {
-            fp->u=fp->us-0.5*dt*rhoinv*xsp*(fp[ml+1].p+fp[1].p-fp[ml].p-fp->p);
-            fp->v=fp->vs-0.5*dt*rhoinv*ysp*(fp[ml+1].p-fp[1].p+fp[ml].p-fp->p);
-            fp++;
-        }
+/** Reads or writes the contents of a checkpoint file after the magic number.
+ * \param[in] fd the file descriptor to use.
+ * \param[in] wr true if the file should be written, false if it should be
+ *               read.
+ * \param[in] (ih,dh) the integer and floating point header values.
+ * \return The total size of the file. */
+template<class T>
+off_t fluid_2d_t<T>::chk_io(int fd,bool wr,int *ih,double *dh) {
+    off_t off=8;
+    size_t l;
+    if(wr) {
+        char magic[8];
+        memcpy(magic,chk_magic,8);
+        chunked_io(fd,magic,8,0,true);
+    }
+    chunked_io(fd,ih,l=sizeof(int)*chk_ints,off,wr);off+=l;
+    chunked_io(fd,dh,l=sizeof(double)*chk_doubles,off,wr);off+=l;
+    chunked_io(fd,fbase,l=sizeof(field)*ml*(n+6),off,wr);off+=l;
+    if(ntrace>0) {chunked_io(fd,tm,l=sizeof(double)*(ntrace<<1),off,wr);off+=l;}
+    if(rm!=NULL) {chunked_io(fd,rbase,l=sizeof(double)*ml*(n+6),off,wr);off+=l;}
+    l=sizeof(double)*ms_fem.mn;
+    chunked_io(fd,zs,l,off,wr);off+=l;
+    if(ms_fem.ext_order>0) {
+        chunked_io(fd,ms_fem.zh[0],l,off,wr);off+=l;
+        chunked_io(fd,ms_fem.zh[1],l,off,wr);off+=l;
     }
+    return off;
+}
 
-    // Reset the ghost points according to the boundary conditions
-    set_boundaries();
+/** Performs the simulation steps for a single frame using the adaptive
+ * timestepping mode. At each step, the remaining interval to the end of the
+ * frame is subdivided into equal steps no larger than dt_reg, so that the end
+ * of the frame is hit exactly.
+ * \param[in] t_end the simulation time at the end of the frame.
+ * \return The number of steps taken. */
+template<class T>
+int fluid_2d_t<T>::adaptive_frame(double t_end) {
+    int l=0;
+    bool last;
+    double adt;
+    dts_min=std::numeric_limits<double>::max();dts_max=dts_sum=0;
+    do {
+
+        // Choose the timestep, and request a fused CFL evaluation if this
+        // step is due for a re-evaluation
+        last=timestep_select(t_end-time,adt)==1;
+        cfl_check=++dts_steps%adapt_k==0;
+        step_forward(adt);
+        if(cfl_check) {adapt_timestep();cfl_check=false;}
+
+        // Record timestep statistics
+        l++;
+        if(adt<dts_min) dts_min=adt;
+        if(adt>dts_max) dts_max=adt;
+        dts_sum+=adt;
+    } while(!last);
+
+    // Set the time to exactly match the end of the frame
+    time=t_end;
+    return l;
+}
+
+/** Updates the regular timestep using the advection CFL condition that was
+ * computed during the last step, limiting its growth and clamping it to the
+ * specified bounds. */
+template<class T>
+void fluid_2d_t<T>::adapt_timestep() {
+    double odt=dt_reg;
+    choose_dt(pad_fac,cfl_max==0?std::numeric_limits<double>::max():1./cfl_max,false);
+    if(dt_reg>odt*dt_grow) dt_reg=odt*dt_grow;
+    if(dt_reg>dt_hi) dt_reg=dt_hi;
+    else if(dt_reg<dt_lo) dt_reg=dt_lo;
+}
+
+/** Steps the simulation fields forward.
+ * \param[in] dt the time step to use. */
+template<class T>
+void fluid_2d_t<T>::step_forward(double dt) {
+
+    // Perform an explicit Euler step of the tracer positions using the
+    // bilinear interpolation of the velocity field
+    ph_t=wtime();
+    update_tracers(dt);
+    phase_mark(0,ntrace*(32.+4*sizeof(field)));
+
+    // Advance the velocity with the selected integrator. The SSP Runge-Kutta
+    // schemes are written in Shu-Osher form, as convex combinations of the
+    // velocity at the start of the step and forward Euler stages.
+    switch(rk_order) {
+        case 1: euler_stage(dt,0,1,true);break;
+        case 2: euler_stage(dt,0,1,false);
+                euler_stage(dt,0.5,0.5,true);break;
+        case 3: euler_stage(dt,0,1,false);
+                euler_stage(dt,0.75,0.25,false);
+                euler_stage(dt,1/3.,2/3.,true);
+    }
 
     // Increment time at end of step
     time+=dt;
 }
 
-/** Copies the pressure back into the main data structure, subtracting off the
- * mean, and taking into account the boundary conditions. */
-void fluid_2d::copy_pressure() {
-    double pavg=average_pressure(),*sfem=ms_fem.z;
-
-#pragma omp parallel for
-    for(int j=0;j<n+1;j++) {
+/** Carries out a forward Euler stage of the velocity, computing an
+ * intermediate velocity a*u0+b*(u+dt*L(u)), where u0 is the velocity at the
+ * start of the step and L contains the advection and viscous terms, and then
+ * projecting it. The pressure is scaled so that it is independent of b.
+ * \param[in] dt the time step to use.
+ * \param[in] (a,b) the Shu-Osher coefficients of the stage. If a is zero in
+ *                  the Runge-Kutta modes, then the current velocity is stored
+ *                  as u0.
+ * \param[in] last whether this is the final stage of the step, in which the
+ *                 diagnostics and the CFL condition are computed if
+ *                 requested. */
+template<class T>
+void fluid_2d_t<T>::euler_stage(double dt,double a,double b,bool last) {
+    int j;
+    double db=dt*b,hx=0.5*db*xsp,hy=0.5*db*ysp,hxx=rhoinv*visc*xxsp*db,
+           hyy=rhoinv*visc*yysp*db;
+
+    // Estimate the memory traffic of the phases, assuming that each sweep
+    // reads and writes every cache line of the field array once
+    const double sf=sizeof(field),nf=m_fem*n_fem;
+    double pr_bytes=mn*(2*sf+(rk0!=NULL?2*sizeof(T):0)+(rm!=NULL?16:0));
+
+    // Compute the intermediate velocity and the source term for the
+    // finite-element projection within a single parallel region. The ghost
+    // values of the intermediate velocity that are needed for the source term
+    // are filled in as soon as each row is complete, with the remaining ghost
+    // values filled in after all rows are done.
+    double sx=0.5*dx/db,sy=0.5*dy/db;
+#pragma omp parallel
+    {
+#pragma omp for
+        for(j=0;j<n;j++) {
+            for(int i=0;i<m;i++) {
+                field *fp=fm+(ml*j+i),&f=*fp;
+
+                // Compute the second derivatives that are needed to evaluate
+                // the viscous stresses. In the variable density mode, these
+                // are scaled by the local density.
+                double ux,vx,uy,vy,uc=f.u,vc=f.v,vf=rm==NULL?1:rho/rm[ml*j+i],
+                       uyy=vf*hyy*(fp[-ml].u-2*uc+fp[ml].u),
+                       vyy=vf*hyy*(fp[-ml].v-2*vc+fp[ml].v),
+                       uxx=vf*hxx*(fp[-1].u-2*uc+fp[1].u),
+                       vxx=vf*hxx*(fp[-1].v-2*vc+fp[1].v);
+
+                // Compute advective terms using the fifth-order WENO scheme
+                // or the second-order ENO scheme
+                if(use_weno) {
+                    vel_weno5(ux,vx,2*hx,uc,fp,1);
+                    vel_weno5(uy,vy,2*hy,vc,fp,ml);
+                } else {
+                    uc>0?vel_eno2(ux,vx,hx,fp[1],f,fp[-1],fp[-2])
+                        :vel_eno2(ux,vx,-hx,fp[-1],f,fp[1],fp[2]);
+                    vc>0?vel_eno2(uy,vy,hy,fp[ml],f,fp[-ml],fp[-2*ml])
+                        :vel_eno2(uy,vy,-hy,fp[-ml],f,fp[ml],fp[2*ml]);
+                }
+                if(rm!=NULL) den_advect(ml*j+i,hx,hy,uc,vc);
+
+                // Compute the intermediate velocity using advection and
+                // viscosity, combined with the velocity at the start of the
+                // step if needed. Note that the terms ux, uyy, etc. are
+                // already scaled by the correct constants.
+                if(a==0) {
+                    if(rk0!=NULL) {
+                        T *r0=rk0+2*(m*j+i);
+                        *r0=f.u;r0[1]=f.v;
+                    }
+                    f.us=b*f.u-uc*ux-vc*uy+uxx+uyy;
+                    f.vs=b*f.v-uc*vx-vc*vy+vxx+vyy;
+                } else {
+                    T *r0=rk0+2*(m*j+i);
+                    f.us=a*(*r0)+b*f.u-uc*ux-vc*uy+uxx+uyy;
+                    f.vs=a*r0[1]+b*f.v-uc*vx-vc*vy+vxx+vyy;
+                }
+            }
+            fem_x_ghosts(fm+ml*j);
+        }
+        fem_y_ghosts();
+
+        // Record the end of the predictor phase. No extra synchronization is
+        // needed, since the ghost value loop ends with a barrier.
+#pragma omp master
+        phase_mark(1,pr_bytes);
+
+        // Calculate the source term for the finite-element projection. The
+        // sums are carried out in double precision, so that the source term
+        // has zero mean for periodic domains when single precision fields
+        // are used.
+#pragma omp for
+        for(j=0;j<n_fem;j++) {
+            double *srp=src+j*m_fem;
+            for(field *fp=fm+j*ml,*fe=fp+m_fem;fp<fe;fp++)
+                *(srp++)=sx*(double(fp[-ml-1].us)+fp[-1].us-fp[-ml].us-fp->us)
+                        +sy*(double(fp[-ml-1].vs)-fp[-1].vs+fp[-ml].vs-fp->vs);
+        }
+    }
+    phase_mark(2,nf*(sf+8));
+
+    // In the variable density mode, switch to the advected density and
+    // update the variable coefficient linear system
+    if(rm!=NULL) vr_update();
+    int vc=tpp->vcount;
+
+    // Solve the finite-element problem, starting from an extrapolation of
+    // the previous pressure solutions if requested. In the Runge-Kutta modes,
+    // the previous stage's solution is used instead, since the stages are not
+    // evenly spaced in time. Compute the mean of the solution, which is
+    // subtracted when it is copied into the main data structure.
+    if(ms_vr!=NULL) ms_vr->solve_v_cycle();
+    else {
+        if(rk_order==1) ms_fem.extrapolate(dt);
+        ms_fem.solve_v_cycle();
+    }
+    phase_mark(3,(tpp->vcount-vc+tpp->extra_iters)*nf*f2d_vcycle_bytes);
+    double pavg=average_pressure();
+    phase_mark(4,nf*8);
+
+    // Update u and v based on us, vs, and the gradient of the solution, and
+    // copy the solution into the pressure field, subtracting off the mean,
+    // in a single pass. The thread handling the last row also copies the
+    // row of pressure values above it. If requested, compute the advection
+    // CFL condition of the new velocity at the same time. The ghost points
+    // are reset according to the boundary conditions within the same
+    // parallel region, with the left and right ghost values of each row set
+    // as soon as it is complete.
+    double cx=0.5*db*rhoinv*xsp,cy=0.5*db*rhoinv*ysp,cmax=0;
+    if(last&&diag_fp!=NULL&&++diag_steps%diag_freq==0) diag_update(cx,cy,pavg,time+dt);
+    else {
+#pragma omp parallel
+        {
+            if(rm!=NULL) {
+#pragma omp for reduction(max:cmax)
+                for(j=0;j<n;j++) {
+                    field *fp=fm+j*ml;
+                    double *rp=rm+j*ml,*zd=z_row(j),*zu=z_row(j+1);
+                    copy_pressure(fp,zd,pavg);
+                    if(j==n-1) copy_pressure(fp+ml,zu,pavg);
+                    for(int i=0;i<m;i++) {
+                        vel_correct(fp,zd,zu,i,cx*rho/rp[i],cy*rho/rp[i]);
+                        double t=fp[i].cfl(xsp,ysp);
+                        if(t>cmax) cmax=t;
+                    }
+                    set_x_ghosts(fp);
+                }
+            } else if(cfl_check&&last) {
+#pragma omp for reduction(max:cmax)
+                for(j=0;j<n;j++) {
+                    field *fp=fm+j*ml;
+                    double *zd=z_row(j),*zu=z_row(j+1);
+                    copy_pressure(fp,zd,pavg);
+                    if(j==n-1) copy_pressure(fp+ml,zu,pavg);
+                    for(int i=0;i<m;i++) {
+                        vel_correct(fp,zd,zu,i,cx,cy);
+                        double t=fp[i].cfl(xsp,ysp);
+                        if(t>cmax) cmax=t;
+                    }
+                    set_x_ghosts(fp);
+                }
+            } else {
+#pragma omp for
+                for(j=0;j<n;j++) {
+                    field *fp=fm+j*ml;
+                    double *zd=z_row(j),*zu=z_row(j+1);
+                    copy_pressure(fp,zd,pavg);
+                    if(j==n-1) copy_pressure(fp+ml,zu,pavg);
+                    for(int i=0;i<m;i++) vel_correct(fp,zd,zu,i,cx,cy);
+                    set_x_ghosts(fp);
+                }
+            }
+#pragma omp master
+            phase_mark(5,mn*(2*sf+(rm!=NULL?8:0))+nf*8);
+            set_y_ghosts();
+        }
+        if(rm!=NULL||(cfl_check&&last)) cfl_max=cmax;
+    }
+    phase_mark(6,12*ml*sf);
+}
 
-        // Set a pointer to the row to copy. If the domain is
-        // y-periodic and this is the last line, then
-        double *sop=y_prd&&j==n?sfem:sfem+j*m_fem,*soe=sop+m;
-        field *fp=fm+j*ml;
-        while(sop<soe) (fp++)->p=*(sop++)-pavg;
-        fp->p=x_prd?fp[-m].p:*sop-pavg;
+/** Updates the velocity using the computed pressure, and at the same time
+ * evaluates a set of diagnostics of the new velocity and pressure using
+ * parallel reductions, writing them to the diagnostics file. The vorticity and
+ * divergence are evaluated at the cell corners using the four surrounding
+ * cells; since the neighboring cells may be updated by other threads, their
+ * new velocities are recomputed locally from the intermediate velocity and
+ * the finite-element solution, which are not modified by the loop. For
+ * non-periodic boundaries, the corners on the walls are excluded. The
+ * pressure is copied from the finite-element solution, and the ghost points
+ * are reset according to the boundary conditions as part of the update.
+ * \param[in] (cx,cy) the prefactors to apply to the pressure differences.
+ * \param[in] pavg the mean of the finite-element solution.
+ * \param[in] t the simulation time at the end of the step. */
+template<class T>
+void fluid_2d_t<T>::diag_update(double cx,double cy,double pavg,double t) {
+    const double big=std::numeric_limits<double>::max();
+    const int il=x_prd?0:1;
+    double ke=0,ens=0,dsq=0,dmax=0,usq=0,cmax=0,psum=0,psq=0,pmin=big,pmax=-big,
+           hx=0.5*xsp,hy=0.5*ysp;
+
+#pragma omp parallel
+    {
+#pragma omp for reduction(+:ke,ens,dsq,psum,psq) \
+        reduction(max:dmax,usq,cmax,pmax) reduction(min:pmin)
+        for(int j=0;j<n;j++) {
+
+            // Set pointers to this row and the row below. For the first row,
+            // the row below is only available if the domain is y-periodic.
+            field *fp=fm+j*ml,*fd=j>0?fp-ml:(y_prd?fp+(n-1)*ml:NULL);
+            double *rp=rm==NULL?NULL:rm+j*ml,*rd=rp==NULL||fd==NULL?NULL:rp+(fd-fp),
+                   *zd=z_row(j),*zu=z_row(j+1),*zdd=z_row(j>0?j-1:n-1);
+            double uc,vc,ud,vd,ul=0,vl=0,udl=0,vdl=0,f;
+
+            // Copy the pressure of this row, and of the row above if this is
+            // the last row
+            copy_pressure(fp,zd,pavg);
+            if(j==n-1) copy_pressure(fp+ml,zu,pavg);
+
+            // For x-periodic domains, compute the new velocities to the left of
+            // the first column
+            if(x_prd) {
+                f=rp==NULL?1:rho/rp[m-1];
+                vel_new(fp,zd,zu,m-1,cx*f,cy*f,ul,vl);
+                if(fd!=NULL) {
+                    f=rd==NULL?1:rho/rd[m-1];
+                    vel_new(fd,zdd,zd,m-1,cx*f,cy*f,udl,vdl);
+                }
+            }
+            for(int i=0;i<m;i++) {
+
+                // Update the velocity of this cell and accumulate the
+                // cell-centered diagnostics
+                double r=rp==NULL?rho:rp[i],sq;
+                f=rho/r;
+                vel_new(fp,zd,zu,i,cx*f,cy*f,uc,vc);
+                fp[i].u=uc;fp[i].v=vc;
+                sq=uc*uc+vc*vc;
+                ke+=r*sq;
+                if(sq>usq) usq=sq;
+                if((f=fp[i].cfl(xsp,ysp))>cmax) cmax=f;
+                f=fp[i].p;
+                psum+=f;psq+=f*f;
+                if(f<pmin) pmin=f;
+                if(f>pmax) pmax=f;
+
+                // Compute the vorticity and divergence at the lower left corner
+                // of this cell
+                if(fd!=NULL) {
+                    f=rd==NULL?1:rho/rd[i];
+                    vel_new(fd,zdd,zd,i,cx*f,cy*f,ud,vd);
+                    if(i>=il) {
+                        double om=hx*(vc+vd-vl-vdl)-hy*(uc+ul-ud-udl),
+                               dv=hx*(uc+ud-ul-udl)+hy*(vc+vl-vd-vdl);
+                        ens+=om*om;dsq+=dv*dv;
+                        if(fabs(dv)>dmax) dmax=fabs(dv);
+                    }
+                    udl=ud;vdl=vd;
+                }
+                ul=uc;vl=vc;
+            }
+            set_x_ghosts(fp);
+        }
+#pragma omp master
+        phase_mark(5,mn*(2*sizeof(field)+(rm!=NULL?8:0))+m_fem*n_fem*8);
+        set_y_ghosts();
     }
+    cfl_max=cmax;
+
+    // Write the diagnostics, normalizing the corner sums by the number of
+    // corners that were considered. The pressure variance is computed in one
+    // pass, so it is clamped at zero in case rounding takes it below.
+    int nc=(x_prd?m:m-1)*(y_prd?n:n-1);
+    psum/=mn;
+    psq=psq/mn-psum*psum;
+    fprintf(diag_fp,"%.10g %.10g %.10g %.10g %.10g %.10g %.10g %.10g %.10g %.10g\n",
+            t,0.5*ke*dx*dy,0.5*ens*dx*dy,dmax,sqrt(dsq/nc),sqrt(usq),pmin,pmax,
+            psum,psq>0?sqrt(psq):0);
 }
 
 /** Computes the average pressure that has been computed using the
  * finite-element method.
  * \return The pressure. */
-double fluid_2d::average_pressure() {
-    double pavg=0,*sfem=ms_fem.z;
+template<class T>
+double fluid_2d_t<T>::average_pressure() {
+    double pavg=0,*sfem=zs;
 
-#pragma omp parallel for reduction(*:pavg)
+#pragma omp parallel for reduction(+:pavg)
     for(int j=0;j<n_fem;j++) {
         double *sop=sfem+j*m_fem,*soe=sop+(m_fem-1);
         double prow=*(sop++)*(x_prd?1:0.5);
@@ -269,86 +880,220 @@ double fluid_2d::average_pressure() {
  * \param[out] (ud,vd) the computed ENO2 derivatives.
  * \param[in] hs a multiplier to apply to the computed fields.
  * \param[in] (f0,f1,f2,f3) the fields to compute the derivative with. */
-inline void fluid_2d::vel_eno2(double &ud,double &vd,double hs,field &f0,field &f1,field &f2,field &f3) {
+template<class T>
+inline void fluid_2d_t<T>::vel_eno2(double &ud,double &vd,double hs,field &f0,field &f1,field &f2,field &f3) {
     ud=hs*eno2(f0.u,f1.u,f2.u,f3.u);
     vd=hs*eno2(f0.v,f1.v,f2.v,f3.v);
 }
 
+/** Calculates upwinded derivatives of the velocity field using the
+ * fifth-order WENO scheme.
+ * \param[out] (ud,vd) the computed WENO derivatives.
+ * \param[in] hs a multiplier to apply to the computed fields.
+ * \param[in] c the velocity component in the direction of the derivatives.
+ * \param[in] fp a pointer to the grid point.
+ * \param[in] d the memory step in the direction of the derivatives. */
+template<class T>
+inline void fluid_2d_t<T>::vel_weno5(double &ud,double &vd,double hs,double c,field *fp,int d) {
+    ud=hs*weno5_upwind(c,fp[-3*d].u,fp[-2*d].u,fp[-d].u,fp->u,fp[d].u,fp[2*d].u,fp[3*d].u);
+    vd=hs*weno5_upwind(c,fp[-3*d].v,fp[-2*d].v,fp[-d].v,fp->v,fp[d].v,fp[2*d].v,fp[3*d].v);
+}
+
+/** Advects the density at a grid point using the second-order ENO scheme,
+ * storing the result in the intermediate density array.
+ * \param[in] ij the memory index of the grid point.
+ * \param[in] (hx,hy) multipliers to apply to the computed derivatives.
+ * \param[in] (uc,vc) the velocity at the grid point. */
+template<class T>
+inline void fluid_2d_t<T>::den_advect(int ij,double hx,double hy,double uc,double vc) {
+    double *rp=rm+ij,rx,ry;
+    rx=uc>0?hx*eno2(rp[1],*rp,rp[-1],rp[-2]):-hx*eno2(rp[-1],*rp,rp[1],rp[2]);
+    ry=vc>0?hy*eno2(rp[ml],*rp,rp[-ml],rp[-2*ml])
+           :-hy*eno2(rp[-ml],*rp,rp[ml],rp[2*ml]);
+    rsm[ij]=*rp-uc*rx-vc*ry;
+}
+
 /** Calculates the ENO derivative using a sequence of values at four
  * gridpoints.
  * \param[in] (p0,p1,p2,p3) the sequence of values to use.
  * \return The computed derivative. */
-inline double fluid_2d::eno2(double p0,double p1,double p2,double p3) {
+template<class T>
+inline double fluid_2d_t<T>::eno2(double p0,double p1,double p2,double p3) {
     return fabs(p0-2*p1+p2)>fabs(p1-2*p2+p3)?3*p1-4*p2+p3:p0-p2;
 }
 
 /** Sets the fields in the ghost regions according to the boundary conditions.
  */
-void fluid_2d::set_boundaries() {
+template<class T>
+void fluid_2d_t<T>::set_boundaries() {
+#pragma omp parallel
+    {
+#pragma omp for
+        for(int j=0;j<n;j++) set_x_ghosts(fm+j*ml);
+        set_y_ghosts();
+    }
+}
 
-    // Set left and right ghost values
+/** Sets the left and right ghost values of a single row according to the
+ * boundary conditions.
+ * \param[in] fp a pointer to the first grid cell in the row. */
+template<class T>
+inline void fluid_2d_t<T>::set_x_ghosts(field *fp) {
     if(x_prd) {
-        for(field *fp=fm,*fe=fm+n*ml;fp<fe;fp+=ml) {
-            fp[-2].prd_bc(fp[m-2]);
-            fp[-1].prd_bc(fp[m-1]);
-            fp[m].prd_bc(*fp);
-            fp[m+1].prd_bc(fp[1]);
-        }
+        fp[-3].prd_bc(fp[m-3]);
+        fp[-2].prd_bc(fp[m-2]);
+        fp[-1].prd_bc(fp[m-1]);
+        fp[m].prd_bc(*fp);
+        fp[m+1].prd_bc(fp[1]);
+        fp[m+2].prd_bc(fp[2]);
     } else {
-        for(field *fp=fm,*fe=fm+n*ml;fp<fe;fp+=ml) {
-            fp[-2].no_slip(fp[1]);
-            fp[-1].no_slip(*fp);
-            fp[m].no_slip(fp[m-1]);
-            fp[m+1].no_slip(fp[m-2]);
-        }
+        fp[-3].no_slip(fp[2]);
+        fp[-2].no_slip(fp[1]);
+        fp[-1].no_slip(*fp);
+        fp[m].no_slip(fp[m-1]);
+        fp[m+1].no_slip(fp[m-2]);
+        fp[m+2].no_slip(fp[m-3]);
     }
+}
 
-    // Set top and bottom ghost values
-    const int tl=2*ml,g=n*ml;
-    if(y_prd) {
-        for(field *fp=fm-2,*fe=fm+m+2;fp<fe;fp++) {
+/** Sets the top and bottom ghost values according to the boundary conditions,
+ * including the corners. This requires that the left and right ghost values
+ * of all rows have been set. The columns are divided among the threads if
+ * this is called within a parallel region. */
+template<class T>
+void fluid_2d_t<T>::set_y_ghosts() {
+    const int tl=2*ml,th=3*ml,g=n*ml;
+#pragma omp for
+    for(int i=-3;i<m+3;i++) {
+        field *fp=fm+i;
+        if(y_prd) {
+            fp[-th].prd_bc(fp[g-th]);
             fp[-tl].prd_bc(fp[g-tl]);
             fp[-ml].prd_bc(fp[g-ml]);
             fp[g].prd_bc(*fp);
             fp[g+ml].prd_bc(fp[ml]);
-        }
-    } else {
-        for(field *fp=fm-2,*fe=fm+m+2;fp<fe;fp++) {
+            fp[g+tl].prd_bc(fp[tl]);
+        } else {
+            fp[-th].no_slip(fp[tl]);
             fp[-tl].no_slip(fp[ml]);
             fp[-ml].no_slip(*fp);
             fp[g].no_slip(fp[g-ml]);
             fp[g+ml].no_slip(fp[g-tl]);
+            fp[g+tl].no_slip(fp[g-th]);
         }
     }
 }
 
-/** Sets boundary conditions for the FEM source term computation, taking into
- * account periodicity */
-void fluid_2d::fem_source_term_conditions() {
+/** Switches to the density computed during the current step, fills in its
+ * ghost regions, and passes the reciprocal density to the variable density
+ * linear system. The coarse levels of the multigrid hierarchy are rebuilt if
+ * they are due, and the time spent doing this is recorded. */
+template<class T>
+void fluid_2d_t<T>::vr_update() {
+
+    // Swap the density arrays, unless this is the initial setup
+    if(vr_steps>=0) {
+        double *t=rbase;rbase=rsbase;rsbase=t;
+        t=rm;rm=rsm;rsm=t;
+        set_density_boundaries(rm);
+    }
+
+    // Set the reciprocal density for each finite-element node. The value
+    // at node (i,j) corresponds to the cell to its lower left, which may be
+    // in the ghost region.
+    double *irho=ms_vr->irho;
+#pragma omp parallel for
+    for(int j=0;j<n_fem;j++) {
+        double *rp=rm+(j-1)*ml-1,*ip=irho+j*m_fem,*ie=ip+m_fem;
+        while(ip<ie) *(ip++)=1/(*(rp++));
+    }
+
+    // Rebuild the coarse levels of the multigrid hierarchy if required
+    if(vr_steps<0||++vr_steps%vr_setup_k==0) {
+        double t0=wtime();
+        ms_vr->setup();
+        vr_setup_time+=wtime()-t0;
+        vr_setups++;
+        if(vr_steps<0) vr_steps=0;
+    }
+}
+
+/** Sets the ghost regions of a density array, using periodic or Neumann
+ * boundary conditions.
+ * \param[in] rp a pointer to the (0,0) grid cell of the array. */
+template<class T>
+void fluid_2d_t<T>::set_density_boundaries(double *rp) {
+
+#pragma omp parallel
+    {
 
     // Set left and right ghost values
-    int xl;
-    if(x_prd) {
-        for(field *fp=fm,*fe=fm+n*ml;fp<fe;fp+=ml) {
-            fp[-1].us=fp[m-1].us;fp[-1].vs=fp[m-1].vs;
-        }
-        xl=m;
-    } else {
-        for(field *fp=fm,*fe=fm+n*ml;fp<fe;fp+=ml) {
-            fp[-1].us=fp[-1].vs=0;
-            fp[m].us=fp[m].vs=0;
+#pragma omp for
+    for(int j=0;j<n;j++) {
+        double *fp=rp+j*ml;
+        if(x_prd) {
+            fp[-3]=fp[m-3];fp[-2]=fp[m-2];fp[-1]=fp[m-1];
+            fp[m]=*fp;fp[m+1]=fp[1];fp[m+2]=fp[2];
+        } else {
+            fp[-3]=fp[2];fp[-2]=fp[1];fp[-1]=*fp;
+            fp[m]=fp[m-1];fp[m+1]=fp[m-2];fp[m+2]=fp[m-3];
         }
-        xl=m+1;
     }
 
     // Set top and bottom ghost values
-    const int g=n*ml;
-    if(y_prd) {
-        for(field *fp=fm-1,*fe=fm+xl;fp<fe;fp++) {
-            fp[-ml].us=fp[g-ml].us;fp[-ml].vs=fp[g-ml].vs;
+    const int tl=2*ml,th=3*ml,g=n*ml;
+#pragma omp for
+    for(int i=-3;i<m+3;i++) {
+        double *fp=rp+i;
+        if(y_prd) {
+            fp[-th]=fp[g-th];fp[-tl]=fp[g-tl];fp[-ml]=fp[g-ml];
+            fp[g]=*fp;fp[g+ml]=fp[ml];fp[g+tl]=fp[tl];
+        } else {
+            fp[-th]=fp[tl];fp[-tl]=fp[ml];fp[-ml]=*fp;
+            fp[g]=fp[g-ml];fp[g+ml]=fp[g-tl];fp[g+tl]=fp[g-th];
         }
+    }
+    }
+}
+
+/** Sets boundary conditions for the FEM source term computation, taking into
+ * account periodicity */
+template<class T>
+void fluid_2d_t<T>::fem_source_term_conditions() {
+#pragma omp parallel
+    {
+#pragma omp for
+        for(int j=0;j<n;j++) fem_x_ghosts(fm+j*ml);
+        fem_y_ghosts();
+    }
+}
+
+/** Sets the left and right ghost values of the intermediate velocity in a
+ * single row, for the FEM source term computation.
+ * \param[in] fp a pointer to the first grid cell in the row. */
+template<class T>
+inline void fluid_2d_t<T>::fem_x_ghosts(field *fp) {
+    if(x_prd) {
+        fp[-1].us=fp[m-1].us;fp[-1].vs=fp[m-1].vs;
     } else {
-        for(field *fp=fm-1,*fe=fm+xl;fp<fe;fp++) {
+        fp[-1].us=fp[-1].vs=0;
+        fp[m].us=fp[m].vs=0;
+    }
+}
+
+/** Sets the top and bottom ghost values of the intermediate velocity for the
+ * FEM source term computation. This requires that the left and right ghost
+ * values of all rows have been set. The columns are divided among the threads
+ * if this is called within a parallel region. */
+template<class T>
+void fluid_2d_t<T>::fem_y_ghosts() {
+    const int g=n*ml,xl=x_prd?m:m+1;
+#pragma omp for
+    for(int i=-1;i<xl;i++) {
+        field *fp=fm+i;
+        if(y_prd) {
+            fp[-ml].us=fp[g-ml].us;fp[-ml].vs=fp[g-ml].vs;
+        } else {
             fp[-ml].us=fp[-ml].vs=0;
             fp[g].us=fp[g].vs=0;
         }
@@ -356,7 +1101,8 @@ void fluid_2d::fem_source_term_conditions() {
 }
 
 /** Sets up the fluid tracers by initializing them at random positions. */
-void fluid_2d::init_tracers() {
+template<class T>
+void fluid_2d_t<T>::init_tracers() {
     tm=new double[ntrace<<1];
     for(double *tp=tm;tp<tm+(ntrace<<1);) {
 
@@ -369,7 +1115,8 @@ void fluid_2d::init_tracers() {
 /** Moves the tracers according to the bilinear interpolation of the fluid
 * velocity.
 * \param[in] dt the timestep to use. */
-void fluid_2d::update_tracers(double dt) {
+template<class T>
+void fluid_2d_t<T>::update_tracers(double dt) {
     int i,j;
     double x,y;
     for(double *tp=tm,*te=tm+(ntrace<<1);tp<te;tp+=2) {
@@ -395,7 +1142,8 @@ void fluid_2d::update_tracers(double dt) {
 /** Remap a tracer according to periodic boundary conditions, if they
  * are being used.
  * \param[in,out] (xx,yy) the tracer position, which is updated in situ. */
-inline void fluid_2d::remap_tracer(double &xx,double &yy) {
+template<class T>
+inline void fluid_2d_t<T>::remap_tracer(double &xx,double &yy) {
     const double xfac=1./(bx-ax),yfac=1./(by-ay);
     if(x_prd) xx-=(bx-ax)*floor((xx-ax)*xfac);
     if(y_prd) yy-=(by-ay)*floor((yy-ay)*yfac);
@@ -403,7 +1151,8 @@ inline void fluid_2d::remap_tracer(double &xx,double &yy) {
 
 /** Outputs the tracer positions in a binary format that can be read by
  * Gnuplot. */
-void fluid_2d::output_tracers(const char *prefix,const int sn) {
+template<class T>
+void fluid_2d_t<T>::output_tracers(const char *prefix,const int sn) {
     if(ntrace==0) return;
 
     // Assemble the output filename and open the output file
@@ -434,17 +1183,103 @@ void fluid_2d::output_tracers(const char *prefix,const int sn) {
 
 /** Writes a selection of simulation fields to the output directory.
  * \param[in] k the frame number to append to the output. */
-void fluid_2d::write_files(int k) {
+template<class T>
+void fluid_2d_t<T>::write_files(int k) {
     if(fflags&1) output("u",0,k);
     if(fflags&2) output("v",1,k);
     if(fflags&4) output("p",2,k);
     output_tracers("trace",k);
+    if(png_mode>=0) render_png("img",k);
+}
+
+/** Enables rendering of a field to PNG images whenever the simulation files
+ * are written, and precomputes the color map lookup table. The color map
+ * runs from dark blue through white to dark red, so that it is suited to
+ * signed fields such as the vorticity.
+ * \param[in] mode the code of the field to render. (0: horizontal velocity,
+ *                 1: vertical velocity, 2: pressure, 3: vorticity)
+ * \param[in] (zlo,zhi) the field values to map to the ends of the color map.
+ * \param[in] ds the downsampling factor, so that each pixel is the average of
+ *               a ds by ds block of gridpoints. */
+template<class T>
+void fluid_2d_t<T>::png_output(int mode,double zlo,double zhi,int ds) {
+    if(mode<0||mode>3||ds<1||zhi<=zlo)
+        fatal_error("Invalid PNG output parameters",1);
+    png_mode=mode;png_lo=zlo;png_hi=zhi;png_ds=ds;
+
+    // Interpolate linearly between five control colors
+    const double cc[15]={0.05,0.1,0.4, 0.2,0.45,0.9, 1,1,1, 0.9,0.3,0.2, 0.45,0.05,0.05};
+    for(int l=0;l<256;l++) {
+        double t=l*(4/255.);
+        int k=t>=4?3:int(t);
+        t-=k;
+        for(int c=0;c<3;c++)
+            png_lut[3*l+c]=static_cast<unsigned char>(255*((1-t)*cc[3*k+c]+t*cc[3*k+3+c])+0.5);
+    }
+}
+
+/** Returns the value of a field to render at a gridpoint.
+ * \param[in] mode the code of the field.
+ * \param[in] (i,j) the gridpoint indices.
+ * \return The field value. */
+template<class T>
+double fluid_2d_t<T>::png_value(int mode,int i,int j) {
+    field *fp=fm+i+j*ml;
+    switch(mode) {
+        case 0: return fp->u;
+        case 1: return fp->v;
+        case 2: return fp->p;
+        default: return 0.5*xsp*(fp[1].v-fp[-1].v)-0.5*ysp*(fp[ml].u-fp[-ml].u);
+    }
+}
+
+/** Renders a field directly to a PNG image, by mapping the field values through
+ * the color map lookup table. The image rows are filled in parallel. The
+ * vorticity is computed at the cell centers using centered differences, which
+ * makes use of the ghost cells.
+ * \param[in] prefix the filename prefix.
+ * \param[in] sn the current frame number to append to the filename. */
+template<class T>
+void fluid_2d_t<T>::render_png(const char *prefix,int sn) {
+    const int ds=png_ds,mi=(png_mode==2&&!x_prd?m+1:m)/ds,
+              ni=(png_mode==2&&!y_prd?n+1:n)/ds;
+    if(mi==0||ni==0) return;
+    const double fac=255.999/(png_hi-png_lo),
+                 bfac=1./(ds*ds);
+    unsigned char *rgb=new unsigned char[3*mi*ni];
+
+    // Loop over the image rows, which are stored from top to bottom
+#pragma omp parallel for
+    for(int r=0;r<ni;r++) {
+        int j0=(ni-1-r)*ds;
+        unsigned char *bp=rgb+3*mi*r;
+        for(int i0=0;i0<mi*ds;i0+=ds) {
+
+            // Average the field over the block of gridpoints, and convert it
+            // to a color map index
+            double z=0;
+            for(int j=j0;j<j0+ds;j++) for(int i=i0;i<i0+ds;i++)
+                z+=png_value(png_mode,i,j);
+            z=(z*bfac-png_lo)*fac;
+            int l=z<0?0:(z>255?255:int(z));
+            *(bp++)=png_lut[3*l];
+            *(bp++)=png_lut[3*l+1];
+            *(bp++)=png_lut[3*l+2];
+        }
+    }
+
+    // Assemble the output filename and write the image
+    char *bufc=reinterpret_cast<char*>(buf);
+    sprintf(bufc,"%s/%s.%d.png",filename,prefix,sn);
+    write_png(bufc,mi,ni,rgb);
+    delete [] rgb;
 }
 
 /** Saves the header file.
  * \param[in] duration the simulation duration.
  * \param[in] frames the number of frames to save. */
-void fluid_2d::save_header(double duration, int frames) {
+template<class T>
+void fluid_2d_t<T>::save_header(double duration, int frames) {
     char *bufc=reinterpret_cast<char*>(buf);
     sprintf(bufc,"%s/header",filename);
     FILE *outf=safe_fopen(bufc,f_num==0?"w":"a");
@@ -457,12 +1292,13 @@ void fluid_2d::save_header(double duration, int frames) {
  * \param[in] mode the code of the field to print.
  * \param[in] sn the current frame number to append to the filename.
  * \param[in] ghost whether to output the ghost regions or not. */
-void fluid_2d::output(const char *prefix,const int mode,const int sn,const bool ghost) {
+template<class T>
+void fluid_2d_t<T>::output(const char *prefix,const int mode,const int sn,const bool ghost) {
 
     // Determine whether to output a cell-centered field or not
     bool cen=mode>=0&&mode<=1;
     int l=ghost?ml:(cen?m:m+1);
-    double disp=(cen?0.5:0)-(ghost?2:0);
+    double disp=(cen?0.5:0)-(ghost?3:0);
 
     // Assemble the output filename and open the output file
     char *bufc=((char*) buf);
@@ -492,3 +1328,7 @@ void fluid_2d::output(const char *prefix,const int mode,const int sn,const bool
     // Close the file
     fclose(outf);
 }
+
+// Explicit instantiation
+template class fluid_2d_t<double>;
+template class fluid_2d_t<float>;
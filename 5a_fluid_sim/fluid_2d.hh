@@ -4,14 +4,39 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cmath>
+#include <sys/types.h>
 
 #include "fields.hh"
 #include "mgs_fem.hh"
 #include "tgmg.hh"
 
-/** A class to carry out a 2D incompressible fluid simulation. */
-class fluid_2d {
+struct mgs_fem_varying_rho;
+
+/** The number of integer values in the checkpoint file header. */
+const int chk_ints=16;
+/** The number of floating point values in the checkpoint file header. */
+const int chk_doubles=9;
+/** The number of phases of a simulation step that are timed separately. */
+const int f2d_phases=7;
+/** An estimate of the memory traffic of one multigrid V-cycle, in bytes per
+ * gridpoint of the finest level, which is used to estimate the bandwidth
+ * achieved by the pressure solve. It accounts for four Gauss-Seidel sweeps
+ * that read the source and solution and write the solution, the residual
+ * evaluation, the restriction, and the interpolation, with a factor of 4/3
+ * for the coarser levels. */
+const double f2d_vcycle_bytes=192.;
+/** The names of the timed phases of a simulation step. */
+extern const char* const f2d_phase_names[f2d_phases];
+
+/** A class to carry out a 2D incompressible fluid simulation. The template
+ * parameter sets the floating point type used to store the simulation fields,
+ * while the pressure projection is always carried out in double precision.
+ */
+template<class T>
+class fluid_2d_t {
     public:
+        /** The data structure for the fields at each grid point. */
+        typedef field_t<T> field;
         /** The number of grid cells in the horizontal direction. */
         const int m;
         /** The number of grid cells in the vertical direction. */
@@ -69,31 +94,115 @@ class fluid_2d {
         double* const src;
         /** An array containing the tracer positions. */
         double* tm;
+        /** An array containing the density field in the variable density
+         * mode, or NULL otherwise. */
+        double* rbase;
+        /** A pointer to the (0,0) grid cell in the density array. */
+        double* rm;
+        /** The ratio of the density inside the initial drop to the ambient
+         * density, in the variable density mode. */
+        double vr_ratio;
+        /** The number of steps between rebuilding the coarse levels of the
+         * variable density multigrid hierarchy. */
+        int vr_setup_k;
         /** The regular timestep to be used. */
         double dt_reg;
+        /** The padding factor applied to the timestep restrictions. */
+        double pad_fac;
+        /** The number of steps between re-evaluations of the advection CFL
+         * condition in the adaptive timestepping mode, or zero if the
+         * timestep is fixed. */
+        int adapt_k;
+        /** The lower bound on the timestep in the adaptive mode. */
+        double dt_lo;
+        /** The upper bound on the timestep in the adaptive mode. */
+        double dt_hi;
+        /** The maximum factor by which the timestep can grow at each
+         * re-evaluation in the adaptive mode. */
+        double dt_grow;
+        /** The order of the time integrator for the velocity. (1: forward
+         * Euler, 2: SSP-RK2, 3: SSP-RK3) */
+        int rk_order;
+        /** Whether to use the fifth-order WENO scheme for the advective
+         * terms, instead of the second-order ENO scheme. The WENO scheme
+         * should be combined with the SSP-RK3 integrator. */
+        bool use_weno;
         /** The current simulation time. */
         double time;
         /** The current frame number. */
         int f_num;
         /** The files to save to file. */
         unsigned int fflags;
-        fluid_2d(const int m_,const int n_,const bool x_prd_,const bool y_prd_,
+        /** The number of frames between checkpoints written during the
+         * solve routine, or zero if no checkpoints are written. */
+        int chk_freq;
+        /** The number of steps between evaluations of the in-situ
+         * diagnostics during the solve routine, or zero if they are not
+         * computed. */
+        int diag_freq;
+        /** The field to render to PNG images when writing files, using the
+         * same codes as the output routine plus 3 for vorticity, or -1 if no
+         * images are rendered. */
+        int png_mode;
+        /** The downsampling factor applied to the PNG images. */
+        int png_ds;
+        /** The field values that are mapped to the ends of the color
+         * map. */
+        double png_lo,png_hi;
+        /** Whether to print the wall clock time spent in each phase of the
+         * steps after each frame of the solve routine, and a summary of the
+         * cumulative timings at the end. */
+        bool phase_print;
+        /** Whether to write the per-frame phase timings and bandwidth
+         * estimates to a CSV file in the output directory during the solve
+         * routine. */
+        bool phase_csv;
+        /** The cumulative wall clock time spent in each phase of the steps,
+         * in the order given by f2d_phase_names. */
+        double ph_time[f2d_phases];
+        /** The cumulative estimated memory traffic of each phase of the
+         * steps, in bytes. */
+        double ph_bytes[f2d_phases];
+        fluid_2d_t(const int m_,const int n_,const bool x_prd_,const bool y_prd_,
                  const double ax_,const double bx_,const double ay_,const double by_,
                  const double visc_,const double rho_,unsigned int fflags_,
                  const char *filename_);
-        ~fluid_2d();
+        ~fluid_2d_t();
         void solve(double duration,int frames);
         void step_forward(double dt);
         void init_fields();
         void write_files(int k);
-        void initialize(int ntrace_,double dt_pad,double max_vel=-1);
+        void png_output(int mode,double zlo,double zhi,int ds=1);
+        void render_png(const char *prefix,int sn);
+        void initialize(int ntrace_,double dt_pad,double max_vel=-1,bool verbose=true);
         double advection_dt();
         void choose_dt(double dt_pad,double adv_dt,bool verbose=true);
+        void adaptive_dt(int k,double dt_lo_,double dt_hi_,double dt_grow_=1.1);
+        void varying_density(double vr_ratio_,int vr_setup_k_=1);
+        void time_integrator(int order);
+        /** Sets the order of the temporal extrapolation of previous pressure
+         * solutions that is used as the initial guess for each multigrid
+         * solve.
+         * \param[in] order the extrapolation order. (0=previous solution,
+         *                  1=linear, 2=quadratic) */
+        inline void pressure_extrapolation(int order) {
+            ms_fem.set_extrapolation(order);
+        }
+        /** Returns the average number of V-cycles per multigrid solve since
+         * the last call, and resets the counters.
+         * \return The average number of V-cycles. */
+        inline float fem_iters() {
+            return tpp->avg_iters();
+        }
         void init_tracers();
         void update_tracers(double dt);
         void output(const char *prefix,const int mode,const int sn,const bool ghost=false);
         void output_tracers(const char *prefix,const int sn);
         void save_header(double duration,int frames);
+        void write_checkpoint(const char *fn);
+        void read_checkpoint(const char *fn);
+        void reset_phases();
+        void phase_summary(FILE *fp=stdout);
         /** Chooses a timestep size that is the largest value smaller than dt_reg,
         * such that a given interval length is a perfect multiple of this timestep.
         * \param[in] interval the interval length to consider.
@@ -108,15 +217,146 @@ class fluid_2d {
         /** An object containing the configuration of the first linear
          * system to be solved using the multigrid method. */
         mgs_fem ms_fem;
+        /** An object containing the configuration of the variable density
+         * linear system, which is only allocated in the variable density
+         * mode. */
+        mgs_fem_varying_rho *ms_vr;
+        /** A pointer to the solution array of the active linear system. */
+        double *zs;
+        /** A pointer to the iteration predictor of the active linear
+         * system. */
+        tgmg_predict *tpp;
+        /** An array for the density field computed during a step. */
+        double *rsbase;
+        /** A pointer to the (0,0) grid cell in the intermediate density
+         * array. */
+        double *rsm;
+        /** The number of steps taken in the variable density mode. */
+        int vr_steps;
+        /** The number of multigrid hierarchy setups performed in the
+         * current frame. */
+        int vr_setups;
+        /** The wall clock time spent on multigrid hierarchy setups in the
+         * current frame. */
+        double vr_setup_time;
+        void vr_update();
+        void set_density_boundaries(double *rp);
+        /** Whether to compute the advection CFL condition during the
+         * velocity update of the next step. */
+        bool cfl_check;
+        /** The reciprocal of the advection timestep restriction, computed
+         * during the last step that checked the CFL condition. */
+        double cfl_max;
+        /** The minimum timestep used in the current frame. */
+        double dts_min;
+        /** The maximum timestep used in the current frame. */
+        double dts_max;
+        /** The sum of the timesteps used in the current frame. */
+        double dts_sum;
+        /** The total number of steps taken in the adaptive mode. */
+        int dts_steps;
+        /** The number of steps taken while the diagnostics file is open. */
+        int diag_steps;
+        /** The file handle for the diagnostic time series, which is open
+         * during the solve routine if diagnostics are requested. */
+        FILE *diag_fp;
+        /** An array for the velocity at the start of the step in the
+         * Runge-Kutta modes, storing (u,v) for each grid cell. */
+        T *rk0;
+        /** The color map lookup table used for the PNG images, containing
+         * (R,G,B) values for each of 256 levels. */
+        unsigned char png_lut[768];
+        /** The wall clock time spent in each phase during the current
+         * frame. */
+        double ph_ftime[f2d_phases];
+        /** The estimated memory traffic of each phase during the current
+         * frame, in bytes. */
+        double ph_fbytes[f2d_phases];
+        /** The wall clock time at the end of the last timed phase. */
+        double ph_t;
+        /** Records the end of a phase, adding the wall clock time since the
+         * end of the previous phase and the estimated memory traffic to the
+         * cumulative and per-frame counters.
+         * \param[in] p the index of the phase.
+         * \param[in] bytes the estimated memory traffic, in bytes. */
+        inline void phase_mark(int p,double bytes) {
+            double t=wtime(),e=t-ph_t;
+            ph_time[p]+=e;ph_ftime[p]+=e;
+            ph_bytes[p]+=bytes;ph_fbytes[p]+=bytes;
+            ph_t=t;
+        }
+        void phase_frame(FILE *fp,int l);
+        double png_value(int mode,int i,int j);
+        void diag_update(double cx,double cy,double pavg,double t);
+        void euler_stage(double dt,double a,double b,bool last);
+        int adaptive_frame(double t_end);
+        void chk_header(int *ih,double *dh);
+        off_t chk_io(int fd,bool wr,int *ih,double *dh);
+        void adapt_timestep();
         void set_boundaries();
+        inline void set_x_ghosts(field *fp);
+        void set_y_ghosts();
         void fem_source_term_conditions();
+        inline void fem_x_ghosts(field *fp);
+        void fem_y_ghosts();
         double average_pressure();
-        void copy_pressure();
+        /** Returns a pointer to a row of the finite-element solution,
+         * wrapping the row above the last one for y-periodic domains.
+         * \param[in] j the index of the row, from 0 to n.
+         * \return The pointer. */
+        inline double* z_row(int j) {
+            return zs+(y_prd&&j==n?0:j*m_fem);
+        }
+        /** Copies a row of the finite-element solution into the pressure
+         * field, subtracting off the mean, and taking into account the
+         * boundary conditions for the last entry.
+         * \param[in] fp a pointer to the first grid cell in the row.
+         * \param[in] sop a pointer to the row of the solution.
+         * \param[in] pavg the mean pressure. */
+        inline void copy_pressure(field *fp,double *sop,double pavg) {
+            for(double *soe=sop+m;sop<soe;) (fp++)->p=*(sop++)-pavg;
+            fp->p=(x_prd?sop[-m]:*sop)-pavg;
+        }
         inline void vel_eno2(double &ud,double &vd,double hs,field &f0,field &f1,field &f2,field &f3);
         inline double eno2(double p0,double p1,double p2,double p3);
+        inline void vel_weno5(double &ud,double &vd,double hs,double c,field *fp,int d);
+        inline void den_advect(int ij,double hx,double hy,double uc,double vc);
         inline double min(double a,double b) {return a<b?a:b;}
         inline double max(double a,double b) {return a>b?a:b;}
         inline void remap_tracer(double &xx,double &yy);
+        /** Computes the updated velocity at a grid point by subtracting the
+         * pressure gradient from the intermediate velocity.
+         * \param[in] fp a pointer to the first grid cell in the row.
+         * \param[in] (zd,zu) pointers to the rows of the finite-element
+         *                    solution below and above the row.
+         * \param[in] i the index of the grid cell within the row.
+         * \param[in] (cx,cy) the prefactors to apply to the pressure
+         *                    differences. */
+        inline void vel_correct(field *fp,double *zd,double *zu,int i,double cx,double cy) {
+            double un,vn;
+            vel_new(fp,zd,zu,i,cx,cy,un,vn);
+            fp[i].u=un;fp[i].v=vn;
+        }
+        /** Computes the updated velocity at a grid point by subtracting the
+         * pressure gradient from the intermediate velocity, without storing
+         * it. The gradient is evaluated directly from the finite-element
+         * solution, so that it does not depend on the pressure field being
+         * written by other threads, and in double precision for all field
+         * types. Since only differences are taken, the mean pressure does not
+         * need to be subtracted.
+         * \param[in] fp a pointer to the first grid cell in the row.
+         * \param[in] (zd,zu) pointers to the rows of the finite-element
+         *                    solution below and above the row.
+         * \param[in] i the index of the grid cell within the row.
+         * \param[in] (cx,cy) the prefactors to apply to the pressure
+         *                    differences.
+         * \param[out] (un,vn) the updated velocity. */
+        inline void vel_new(field *fp,double *zd,double *zu,int i,double cx,double cy,
+                            double &un,double &vn) {
+            int k=x_prd&&i==m-1?0:i+1;
+            un=fp[i].us-cx*(zu[k]+zd[k]-zu[i]-zd[i]);
+            vn=fp[i].vs-cy*(zu[k]-zd[k]+zu[i]-zd[i]);
+        }
         /** Temporary storage for used during the output routine. */
         float *buf;
 #ifdef _OPENMP
@@ -126,4 +366,9 @@ class fluid_2d {
 #endif
 };
 
+/** The fluid simulation class using double precision fields. */
+typedef fluid_2d_t<double> fluid_2d;
+/** The fluid simulation class using single precision fields. */
+typedef fluid_2d_t<float> fluid_2d_float;
+
 #endif
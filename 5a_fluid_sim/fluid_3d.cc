@@ -0,0 +1,692 @@
+#include <limits>
+
+#include "common.hh"
+#include "fluid_3d.hh"
+
+/** Computes the number of rows in each block of the cache-blocked stencil
+ * sweeps. The second-order ENO stencil reaches two gridpoints in each
+ * direction, so that five z planes of each block, plus four extra rows, must
+ * fit within the target working set size.
+ * \param[in] ml the memory step length in the y direction.
+ * \param[in] n the number of rows in each z plane.
+ * \return The number of rows. */
+static int block_rows(int ml,int n) {
+    int r=f3d_block_bytes/(5*ml*static_cast<int>(sizeof(field_3d)))-4;
+    return r<1?1:(r>n?n:r);
+}
+
+/** The class constructor sets up constants the control the geometry and the
+ * simulation, and dynamically allocates memory for the fields.
+ * \param[in] (m_,n_,o_) the number of grid points to use in the x, y, and z
+ *                       directions.
+ * \param[in] (x_prd_,y_prd_,z_prd_) the periodicity in the x, y, and z
+ *                                   directions.
+ * \param[in] (ax_,bx_) the lower and upper x-coordinate simulation bounds.
+ * \param[in] (ay_,by_) the lower and upper y-coordinate simulation bounds.
+ * \param[in] (az_,bz_) the lower and upper z-coordinate simulation bounds.
+ * \param[in] visc_ the fluid viscosity.
+ * \param[in] rho_ the fluid density.
+ * \param[in] fflags_ the fields to save to file.
+ * \param[in] filename_ the filename of the output directory. */
+fluid_3d::fluid_3d(const int m_,const int n_,const int o_,const bool x_prd_,
+        const bool y_prd_,const bool z_prd_,const double ax_,const double bx_,
+        const double ay_,const double by_,const double az_,const double bz_,
+        const double visc_,const double rho_,unsigned int fflags_,
+        const char *filename_)
+    : m(m_), n(n_), o(o_), mno(m_*n_*o_), m_fem(x_prd_?m_:m_+1),
+    n_fem(y_prd_?n_:n_+1), o_fem(z_prd_?o_:o_+1), ml(m_+4), mln(ml*(n_+4)),
+    yb(block_rows(ml,n_)), ntrace(0), x_prd(x_prd_), y_prd(y_prd_),
+    z_prd(z_prd_), ax(ax_), bx(bx_), ay(ay_), by(by_), az(az_), bz(bz_),
+    dx((bx_-ax_)/m_), dy((by_-ay_)/n_), dz((bz_-az_)/o_), xsp(1/dx),
+    ysp(1/dy), zsp(1/dz), xxsp(xsp*xsp), yysp(ysp*ysp), zzsp(zsp*zsp),
+    visc(visc_), rho(rho_), rhoinv(1/rho), filename(filename_),
+    fbase(new field_3d[mln*(o_+4)]), fm(fbase+2*mln+2*ml+2),
+    src(new double[m_fem*n_fem*o_fem]), tm(NULL), time(0.), f_num(0),
+    fflags(fflags_), ms_fem(m_fem,n_fem,o_fem,x_prd_,y_prd_,z_prd_,
+    dy*dz*xsp*xsp,dz*ysp,dy*zsp,src) {
+    int mx=m>n?m:n;
+    if(o>mx) mx=o;
+    buf=new float[mx>123?mx+5:128];
+}
+
+/** The class destructor frees the dynamically allocated memory. */
+fluid_3d::~fluid_3d() {
+    if(ntrace>0) delete [] tm;
+    delete [] buf;
+    delete [] src;
+    delete [] fbase;
+}
+
+/** Initializes the simulation, setting up the tracers and simulation fields,
+ * and choosing the timestep.
+ * \param[in] ntrace_ the number of tracers.
+ * \param[in] dt_pad the padding factor for the timestep, which should be
+ *                   smaller than 1.
+ * \param[in] max_spd a maximum fluid speed from which to estimate the
+ *                    advection timestep restriction. If a negative value is
+ *                    supplied, then the advection CFL condition is explicitly
+ *                    calculated.
+ * \param[in] verbose whether to print out the timestep information. */
+void fluid_3d::initialize(int ntrace_,double dt_pad,double max_spd,bool verbose) {
+
+    // Set up the tracers (if any) and initialize the simulation fields
+    if((ntrace=ntrace_)>0) init_tracers();
+    init_fields();
+
+    // Compute the timestep, based on the restrictions from the advection
+    // and velocity, plus a padding factor
+    double h=dx>dy?dx:dy;
+    if(dz>h) h=dz;
+    choose_dt(dt_pad,max_spd<=0?advection_dt():h/max_spd,verbose);
+}
+
+/** Computes the maximum timestep that can resolve the fluid advection, based
+ * on the CFL condition.
+ * \return The maximum timestep. */
+double fluid_3d::advection_dt() {
+    double adv_dt=0;
+#pragma omp parallel for reduction(max:adv_dt)
+    for(int k=0;k<o;k++) {
+        double t;
+        for(int j=0;j<n;j++) {
+            for(field_3d *fp=fm+(mln*k+ml*j),*fe=fp+m;fp<fe;fp++) {
+                t=fp->cfl(xsp,ysp,zsp);
+                if(t>adv_dt) adv_dt=t;
+            }
+        }
+    }
+    return adv_dt==0?std::numeric_limits<double>::max():1./adv_dt;
+}
+
+/** Chooses the timestep based on the limits from advection and viscosity.
+ * \param[in] dt_pad the padding factor for the timestep for the physical
+ *                   terms, which should be smaller than 1.
+ * \param[in] adv_dt the maximum timestep to resolve the fluid advection.
+ * \param[in] verbose whether to print out messages to the screen. */
+void fluid_3d::choose_dt(double dt_pad,double adv_dt,bool verbose) {
+    double vis_dt=0.5*rho/(visc*(xxsp+yysp+zzsp));
+    int ca;
+
+    // Choose the minimum of the two timestep restrictions
+    if(adv_dt<vis_dt) {ca=0;dt_reg=adv_dt;}
+    else {ca=1;dt_reg=vis_dt;}
+    dt_reg*=dt_pad;
+
+    // Print information if requested
+    if(verbose) {
+        const char mno_[]="", myes[]=" <-- use this";
+        printf("# Advection dt       : %g%s\n"
+               "# Viscous dt         : %g%s\n"
+               "# Padding factor     : %g\n"
+               "# Minimum dt         : %g\n",
+               adv_dt,ca==0?myes:mno_,vis_dt,ca==1?myes:mno_,dt_pad,dt_reg);
+    }
+}
+
+/** Initializes the simulation fields, using two jets of fluid that roll up
+ * into vortex rings. */
+void fluid_3d::init_fields() {
+
+    // Clear all fields, including the ghost regions and the extra
+    // cell-cornered pressure points
+#pragma omp parallel for
+    for(int k=0;k<o+4;k++) {
+        for(field_3d *fp=fbase+mln*k,*fe=fp+mln;fp<fe;fp++)
+            fp->u=fp->v=fp->w=fp->p=fp->us=fp->vs=fp->ws=0;
+    }
+
+    // Loop over the primary grid and set the velocity
+#pragma omp parallel for
+    for(int k=0;k<o;k++) {
+        double z=az+dz*(k+0.5),zz=z*z;
+        for(int j=0;j<n;j++) {
+            double y=ay+dy*(j+0.5),yy=y+0.5;
+            field_3d *fp=fm+(mln*k+ml*j);
+            for(int i=0;i<m;i++,fp++) {
+                double x=ax+dx*(i+0.5),xx=x+0.5,r=x*x+y*y+zz;
+                fp->u=4*exp(-20*r);
+                fp->v=exp(-20*r)-5*exp(-30*(xx*xx+yy*yy+zz));
+                fp->w=2*exp(-30*(xx*xx+y*y+zz));
+            }
+        }
+    }
+
+    // Now that the primary grid points are set up, initialize the ghost
+    // points according to the boundary conditions
+    set_boundaries();
+}
+
+/** Carries out the simulation for a specified time interval using the direct
+ * simulation method, periodically saving the output.
+ * \param[in] duration the simulation duration.
+ * \param[in] frames the number of frames to save. */
+void fluid_3d::solve(double duration,int frames) {
+    double t0,t1,t2,adt,interval=duration/frames;
+    int l=timestep_select(interval,adt);
+
+    // Save header file, output the initial fields and record the initial wall
+    // clock time
+    save_header(duration,frames);
+    if(f_num==0) write_files(0), puts("# Output frame 0");
+    t0=wtime();
+
+    // Loop over the output frames
+    for(int k=1;k<=frames;k++) {
+
+        // Perform the simulation steps
+        for(int j=0;j<l;j++) step_forward(adt);
+
+        // Output the fields
+        t1=wtime();
+        write_files(++f_num);
+
+        // Print diagnostic information
+        t2=wtime();
+        printf("# Output frame %d [%d, %.8g s, %.8g s] {FEM %.2f}\n",
+               k,l,t1-t0,t2-t1,fem_iters());
+        t0=t2;
+    }
+}
+
+/** Steps the simulation fields forward using the forward Euler method.
+ * \param[in] dt the time step to use. */
+void fluid_3d::step_forward(double dt) {
+    const double hx=0.5*dt*xsp,hy=0.5*dt*ysp,hz=0.5*dt*zsp,
+                 hxx=rhoinv*visc*xxsp*dt,hyy=rhoinv*visc*yysp*dt,
+                 hzz=rhoinv*visc*zzsp*dt;
+
+    // Perform an explicit Euler step of the tracer positions using the
+    // trilinear interpolation of the velocity field
+    update_tracers(dt);
+
+    // Compute the intermediate velocity and the source term for the
+    // finite-element projection within a single parallel region. The
+    // intermediate velocity is computed in blocks of rows, and within each
+    // block the threads sweep through contiguous ranges of z planes. Since
+    // each gridpoint is only written once, the threads do not need to
+    // synchronize between the blocks.
+    const double sx=0.25*rho*dy*dz*xsp/dt,sy=0.25*rho*dz/dt,sz=0.25*rho*dy/dt;
+#pragma omp parallel
+    {
+        for(int jb=0;jb<n;jb+=yb) {
+            int je=jb+yb<n?jb+yb:n;
+#pragma omp for nowait
+            for(int k=0;k<o;k++) for(int j=jb;j<je;j++) {
+                for(field_3d *fp=fm+(mln*k+ml*j),*fe=fp+m;fp<fe;fp++) {
+                    field_3d &f=*fp;
+
+                    // Compute the viscous terms
+                    double ux,vx,wx,uy,vy,wy,uz,vz,wz,uc=f.u,vc=f.v,wc=f.w,
+                           lu=hxx*(fp[-1].u-2*uc+fp[1].u)+hyy*(fp[-ml].u-2*uc+fp[ml].u)
+                             +hzz*(fp[-mln].u-2*uc+fp[mln].u),
+                           lv=hxx*(fp[-1].v-2*vc+fp[1].v)+hyy*(fp[-ml].v-2*vc+fp[ml].v)
+                             +hzz*(fp[-mln].v-2*vc+fp[mln].v),
+                           lw=hxx*(fp[-1].w-2*wc+fp[1].w)+hyy*(fp[-ml].w-2*wc+fp[ml].w)
+                             +hzz*(fp[-mln].w-2*wc+fp[mln].w);
+
+                    // Compute the advective terms using the second-order ENO
+                    // scheme
+                    uc>0?vel_eno2(ux,vx,wx,hx,fp[1],f,fp[-1],fp[-2])
+                        :vel_eno2(ux,vx,wx,-hx,fp[-1],f,fp[1],fp[2]);
+                    vc>0?vel_eno2(uy,vy,wy,hy,fp[ml],f,fp[-ml],fp[-2*ml])
+                        :vel_eno2(uy,vy,wy,-hy,fp[-ml],f,fp[ml],fp[2*ml]);
+                    wc>0?vel_eno2(uz,vz,wz,hz,fp[mln],f,fp[-mln],fp[-2*mln])
+                        :vel_eno2(uz,vz,wz,-hz,fp[-mln],f,fp[mln],fp[2*mln]);
+
+                    // Compute the intermediate velocity
+                    f.us=uc-uc*ux-vc*uy-wc*uz+lu;
+                    f.vs=vc-uc*vx-vc*vy-wc*vz+lv;
+                    f.ws=wc-uc*wx-vc*wy-wc*wz+lw;
+                }
+            }
+        }
+#pragma omp barrier
+
+        // Fill in the ghost values of the intermediate velocity that are
+        // needed for the source term
+#pragma omp for
+        for(int k=0;k<o;k++) {
+            field_3d *fp=fm+mln*k;
+            for(int j=0;j<n;j++) fem_x_ghosts(fp+ml*j);
+            fem_y_ghosts(fp);
+        }
+        fem_z_ghosts();
+
+        // Calculate the source term for the finite-element projection. Each
+        // node is surrounded by eight cells, the first of which is at
+        // (i-1,j-1,k-1).
+#pragma omp for
+        for(int k=0;k<o_fem;k++) {
+            double *srp=src+m_fem*n_fem*k;
+            for(int j=0;j<n_fem;j++) {
+                for(field_3d *fp=fm+(mln*k+ml*j)-(mln+ml+1),*fe=fp+m_fem;fp<fe;fp++)
+                    *(srp++)=sx*(fp->us+fp[ml].us+fp[mln].us+fp[mln+ml].us
+                                -fp[1].us-fp[ml+1].us-fp[mln+1].us-fp[mln+ml+1].us)
+                            +sy*(fp->vs+fp[1].vs+fp[mln].vs+fp[mln+1].vs
+                                -fp[ml].vs-fp[ml+1].vs-fp[mln+ml].vs-fp[mln+ml+1].vs)
+                            +sz*(fp->ws+fp[1].ws+fp[ml].ws+fp[ml+1].ws
+                                -fp[mln].ws-fp[mln+1].ws-fp[mln+ml].ws-fp[mln+ml+1].ws);
+            }
+        }
+    }
+
+    // Solve the finite-element problem, and copy the pressure back into the
+    // main data structure, subtracting off the mean, and taking into account
+    // the boundary conditions
+    ms_fem.solve_v_cycle();
+    copy_pressure();
+
+    // Update the velocity based on the intermediate velocity and the
+    // pressure gradient averaged over each cell, resetting the ghost points
+    // according to the boundary conditions in the same parallel region
+    const double cx=0.25*dt*rhoinv*xsp,cy=0.25*dt*rhoinv*ysp,cz=0.25*dt*rhoinv*zsp;
+#pragma omp parallel
+    {
+#pragma omp for
+        for(int k=0;k<o;k++) {
+            for(int j=0;j<n;j++) {
+                for(field_3d *fp=fm+(mln*k+ml*j),*fe=fp+m;fp<fe;fp++) {
+                    double p0=fp->p,p1=fp[1].p,p2=fp[ml].p,p3=fp[ml+1].p,
+                           p4=fp[mln].p,p5=fp[mln+1].p,p6=fp[mln+ml].p,
+                           p7=fp[mln+ml+1].p;
+                    fp->u=fp->us-cx*(p1+p3+p5+p7-p0-p2-p4-p6);
+                    fp->v=fp->vs-cy*(p2+p3+p6+p7-p0-p1-p4-p5);
+                    fp->w=fp->ws-cz*(p4+p5+p6+p7-p0-p1-p2-p3);
+                }
+                set_x_ghosts(fm+(mln*k+ml*j));
+            }
+            set_y_ghosts(fm+mln*k);
+        }
+        set_z_ghosts();
+    }
+
+    // Increment time at end of step
+    time+=dt;
+}
+
+/** Copies the pressure back into the main data structure, subtracting off the
+ * mean, and taking into account the boundary conditions. */
+void fluid_3d::copy_pressure() {
+    double pavg=average_pressure();
+
+#pragma omp parallel for
+    for(int k=0;k<=o;k++) {
+        int kk=z_prd&&k==o?0:k;
+        for(int j=0;j<=n;j++) {
+
+            // Set a pointer to the row to copy. For periodic directions, the
+            // last point is a copy of the first.
+            double *sop=ms_fem.z+m_fem*((y_prd&&j==n?0:j)+n_fem*kk),*soe=sop+m;
+            field_3d *fp=fm+(mln*k+ml*j);
+            while(sop<soe) (fp++)->p=*(sop++)-pavg;
+            fp->p=x_prd?fp[-m].p:*sop-pavg;
+        }
+    }
+}
+
+/** Computes the average pressure that has been computed using the
+ * finite-element method, weighting the nodes on non-periodic walls by the
+ * fraction of their surrounding volume that is within the domain.
+ * \return The pressure. */
+double fluid_3d::average_pressure() {
+    double pavg=0;
+
+#pragma omp parallel for reduction(+:pavg)
+    for(int k=0;k<o_fem;k++) {
+        double pl=0;
+        for(int j=0;j<n_fem;j++) {
+            double *sop=ms_fem.z+m_fem*(j+n_fem*k),*soe=sop+(m_fem-1);
+            double prow=*(sop++)*(x_prd?1:0.5);
+            while(sop<soe) prow+=*(sop++);
+            prow+=*sop*(x_prd?1:0.5);
+            if(!y_prd&&(j==0||j==n)) prow*=0.5;
+            pl+=prow;
+        }
+        if(!z_prd&&(k==0||k==o)) pl*=0.5;
+        pavg+=pl;
+    }
+    return pavg*(1./mno);
+}
+
+/** Computes the maximum magnitude of the velocity divergence at the cell
+ * corners, using the average of the differences across the four pairs of
+ * cells in each direction. Corners on non-periodic walls are excluded.
+ * \return The maximum divergence. */
+double fluid_3d::max_divergence() {
+    const double hx=0.25*xsp,hy=0.25*ysp,hz=0.25*zsp;
+    const int il=x_prd?0:1,jl=y_prd?0:1,kl=z_prd?0:1;
+    double dmax=0;
+#pragma omp parallel for reduction(max:dmax)
+    for(int k=kl;k<o;k++) for(int j=jl;j<n;j++) {
+        for(field_3d *fp=fm+(mln*k+ml*j+il)-(mln+ml+1),*fe=fp+(m-il);fp<fe;fp++) {
+            double dv=hx*(fp[1].u+fp[ml+1].u+fp[mln+1].u+fp[mln+ml+1].u
+                         -fp->u-fp[ml].u-fp[mln].u-fp[mln+ml].u)
+                     +hy*(fp[ml].v+fp[ml+1].v+fp[mln+ml].v+fp[mln+ml+1].v
+                         -fp->v-fp[1].v-fp[mln].v-fp[mln+1].v)
+                     +hz*(fp[mln].w+fp[mln+1].w+fp[mln+ml].w+fp[mln+ml+1].w
+                         -fp->w-fp[1].w-fp[ml].w-fp[ml+1].w);
+            if(fabs(dv)>dmax) dmax=fabs(dv);
+        }
+    }
+    return dmax;
+}
+
+/** Calculates one-sided derivatives of the velocity field using the
+ * second-order ENO2 scheme.
+ * \param[out] (ud,vd,wd) the computed ENO2 derivatives.
+ * \param[in] hs a multiplier to apply to the computed fields.
+ * \param[in] (f0,f1,f2,f3) the fields to compute the derivative with. */
+inline void fluid_3d::vel_eno2(double &ud,double &vd,double &wd,double hs,
+                               field_3d &f0,field_3d &f1,field_3d &f2,field_3d &f3) {
+    ud=hs*eno2(f0.u,f1.u,f2.u,f3.u);
+    vd=hs*eno2(f0.v,f1.v,f2.v,f3.v);
+    wd=hs*eno2(f0.w,f1.w,f2.w,f3.w);
+}
+
+/** Calculates the ENO derivative using a sequence of values at four
+ * gridpoints.
+ * \param[in] (p0,p1,p2,p3) the sequence of values to use.
+ * \return The computed derivative. */
+inline double fluid_3d::eno2(double p0,double p1,double p2,double p3) {
+    return fabs(p0-2*p1+p2)>fabs(p1-2*p2+p3)?3*p1-4*p2+p3:p0-p2;
+}
+
+/** Sets the fields in the ghost regions according to the boundary conditions.
+ */
+void fluid_3d::set_boundaries() {
+#pragma omp parallel
+    {
+#pragma omp for
+        for(int k=0;k<o;k++) {
+            for(int j=0;j<n;j++) set_x_ghosts(fm+(mln*k+ml*j));
+            set_y_ghosts(fm+mln*k);
+        }
+        set_z_ghosts();
+    }
+}
+
+/** Sets the ghost values at either end of a single row according to the
+ * boundary conditions.
+ * \param[in] fp a pointer to the first grid cell in the row. */
+void fluid_3d::set_x_ghosts(field_3d *fp) {
+    if(x_prd) {
+        fp[-2].prd_bc(fp[m-2]);
+        fp[-1].prd_bc(fp[m-1]);
+        fp[m].prd_bc(*fp);
+        fp[m+1].prd_bc(fp[1]);
+    } else {
+        fp[-2].no_slip(fp[1]);
+        fp[-1].no_slip(*fp);
+        fp[m].no_slip(fp[m-1]);
+        fp[m+1].no_slip(fp[m-2]);
+    }
+}
+
+/** Sets the ghost rows at either end of a z plane according to the boundary
+ * conditions, including the corners. This requires that the ghost values at
+ * the ends of all rows in the plane have been set.
+ * \param[in] fp a pointer to the first grid cell in the plane. */
+void fluid_3d::set_y_ghosts(field_3d *fp) {
+    const int tl=2*ml,g=n*ml;
+    for(field_3d *fe=fp+m+2,*fq=fp-2;fq<fe;fq++) {
+        if(y_prd) {
+            fq[-tl].prd_bc(fq[g-tl]);
+            fq[-ml].prd_bc(fq[g-ml]);
+            fq[g].prd_bc(*fq);
+            fq[g+ml].prd_bc(fq[ml]);
+        } else {
+            fq[-tl].no_slip(fq[ml]);
+            fq[-ml].no_slip(*fq);
+            fq[g].no_slip(fq[g-ml]);
+            fq[g+ml].no_slip(fq[g-tl]);
+        }
+    }
+}
+
+/** Sets the ghost planes at either end of the domain according to the
+ * boundary conditions, including the edges and corners. This requires that
+ * the ghost values of all z planes have been set. The rows are divided among
+ * the threads if this is called within a parallel region. */
+void fluid_3d::set_z_ghosts() {
+    const int tl=2*mln,g=o*mln;
+#pragma omp for
+    for(int j=-2;j<n+2;j++) {
+        for(field_3d *fp=fm+(ml*j-2),*fe=fp+m+4;fp<fe;fp++) {
+            if(z_prd) {
+                fp[-tl].prd_bc(fp[g-tl]);
+                fp[-mln].prd_bc(fp[g-mln]);
+                fp[g].prd_bc(*fp);
+                fp[g+mln].prd_bc(fp[mln]);
+            } else {
+                fp[-tl].no_slip(fp[mln]);
+                fp[-mln].no_slip(*fp);
+                fp[g].no_slip(fp[g-mln]);
+                fp[g+mln].no_slip(fp[g-tl]);
+            }
+        }
+    }
+}
+
+/** Sets the ghost values of the intermediate velocity at either end of a
+ * single row, for the FEM source term computation.
+ * \param[in] fp a pointer to the first grid cell in the row. */
+void fluid_3d::fem_x_ghosts(field_3d *fp) {
+    if(x_prd) {
+        fp[-1].us=fp[m-1].us;fp[-1].vs=fp[m-1].vs;fp[-1].ws=fp[m-1].ws;
+    } else {
+        fp[-1].us=fp[-1].vs=fp[-1].ws=0;
+        fp[m].us=fp[m].vs=fp[m].ws=0;
+    }
+}
+
+/** Sets the ghost rows of the intermediate velocity in a z plane, for the FEM
+ * source term computation. This requires that the ghost values at the ends of
+ * all rows in the plane have been set.
+ * \param[in] fp a pointer to the first grid cell in the plane. */
+void fluid_3d::fem_y_ghosts(field_3d *fp) {
+    const int g=n*ml;
+    for(field_3d *fe=fp+(x_prd?m:m+1),*fq=fp-1;fq<fe;fq++) {
+        if(y_prd) {
+            fq[-ml].us=fq[g-ml].us;fq[-ml].vs=fq[g-ml].vs;fq[-ml].ws=fq[g-ml].ws;
+        } else {
+            fq[-ml].us=fq[-ml].vs=fq[-ml].ws=0;
+            fq[g].us=fq[g].vs=fq[g].ws=0;
+        }
+    }
+}
+
+/** Sets the ghost planes of the intermediate velocity for the FEM source term
+ * computation. This requires that the ghost values of all z planes have been
+ * set. The rows are divided among the threads if this is called within a
+ * parallel region. */
+void fluid_3d::fem_z_ghosts() {
+    const int g=o*mln,xl=x_prd?m:m+1,yl=y_prd?n:n+1;
+#pragma omp for
+    for(int j=-1;j<yl;j++) {
+        for(field_3d *fp=fm+(ml*j-1),*fe=fp+(xl+1);fp<fe;fp++) {
+            if(z_prd) {
+                fp[-mln].us=fp[g-mln].us;fp[-mln].vs=fp[g-mln].vs;
+                fp[-mln].ws=fp[g-mln].ws;
+            } else {
+                fp[-mln].us=fp[-mln].vs=fp[-mln].ws=0;
+                fp[g].us=fp[g].vs=fp[g].ws=0;
+            }
+        }
+    }
+}
+
+/** Sets up the fluid tracers by initializing them at random positions. */
+void fluid_3d::init_tracers() {
+    tm=new double[3*ntrace];
+    for(double *tp=tm;tp<tm+3*ntrace;) {
+
+        // Create a random position vector within the simulation region
+        *(tp++)=ax+(bx-ax)/RAND_MAX*double(rand());
+        *(tp++)=ay+(by-ay)/RAND_MAX*double(rand());
+        *(tp++)=az+(bz-az)/RAND_MAX*double(rand());
+    }
+}
+
+/** Moves the tracers according to the trilinear interpolation of the fluid
+ * velocity.
+ * \param[in] dt the timestep to use. */
+void fluid_3d::update_tracers(double dt) {
+#pragma omp parallel for
+    for(int q=0;q<ntrace;q++) {
+        double *tp=tm+3*q;
+
+        // Find which grid cell the tracer is in, measured relative to the
+        // cell centers
+        double x=(*tp-ax)*xsp-0.5,y=(tp[1]-ay)*ysp-0.5,z=(tp[2]-az)*zsp-0.5;
+        int i=int(x+1)-1,j=int(y+1)-1,k=int(z+1)-1;
+        if(i<-1) i=-1;else if(i>=m) i=m-1;
+        if(j<-1) j=-1;else if(j>=n) j=n-1;
+        if(k<-1) k=-1;else if(k>=o) k=o-1;
+
+        // Compute tracer's fractional position with the grid cell
+        x-=i;y-=j;z-=k;
+
+        // Compute tracer's new position
+        field_3d *fp=fm+(i+ml*j+mln*k),*fq=fp+mln;
+        double w0=(1-x)*(1-y),w1=x*(1-y),w2=(1-x)*y,w3=x*y;
+        *tp+=dt*((1-z)*(w0*fp->u+w1*fp[1].u+w2*fp[ml].u+w3*fp[ml+1].u)
+                 +z*(w0*fq->u+w1*fq[1].u+w2*fq[ml].u+w3*fq[ml+1].u));
+        tp[1]+=dt*((1-z)*(w0*fp->v+w1*fp[1].v+w2*fp[ml].v+w3*fp[ml+1].v)
+                   +z*(w0*fq->v+w1*fq[1].v+w2*fq[ml].v+w3*fq[ml+1].v));
+        tp[2]+=dt*((1-z)*(w0*fp->w+w1*fp[1].w+w2*fp[ml].w+w3*fp[ml+1].w)
+                   +z*(w0*fq->w+w1*fq[1].w+w2*fq[ml].w+w3*fq[ml+1].w));
+        remap_tracer(*tp,tp[1],tp[2]);
+    }
+}
+
+/** Remap a tracer according to periodic boundary conditions, if they
+ * are being used.
+ * \param[in,out] (xx,yy,zz) the tracer position, which is updated in situ. */
+inline void fluid_3d::remap_tracer(double &xx,double &yy,double &zz) {
+    if(x_prd) xx-=(bx-ax)*floor((xx-ax)/(bx-ax));
+    if(y_prd) yy-=(by-ay)*floor((yy-ay)/(by-ay));
+    if(z_prd) zz-=(bz-az)*floor((zz-az)/(bz-az));
+}
+
+/** Outputs the tracer positions in a binary format, as consecutive (x,y,z)
+ * triplets of floats.
+ * \param[in] prefix the filename prefix.
+ * \param[in] sn the current frame number to append to the filename. */
+void fluid_3d::output_tracers(const char *prefix,const int sn) {
+    if(ntrace==0) return;
+
+    // Assemble the output filename and open the output file
+    char *bufc=reinterpret_cast<char*>(buf);
+    sprintf(bufc,"%s/%s.%d",filename,prefix,sn);
+    FILE *outf=safe_fopen(bufc,"wb");
+
+    // Output the tracer positions in batches of 126 floats
+    double *tp=tm,*te=tm+3*ntrace;
+    while(tp<te) {
+        float *fp=buf,*fe=buf+(te-tp>126?126:te-tp);
+        while(fp<fe) *(fp++)=*(tp++);
+        fwrite(buf,sizeof(float),fe-buf,outf);
+    }
+
+    // Close the file
+    fclose(outf);
+}
+
+/** Writes a selection of simulation fields to the output directory.
+ * \param[in] k the frame number to append to the output. */
+void fluid_3d::write_files(int k) {
+    if(fflags&1) output("u",0,k);
+    if(fflags&2) output("v",1,k);
+    if(fflags&4) output("w",2,k);
+    if(fflags&8) output("p",3,k);
+    output_tracers("trace",k);
+}
+
+/** Saves the header file.
+ * \param[in] duration the simulation duration.
+ * \param[in] frames the number of frames to save. */
+void fluid_3d::save_header(double duration, int frames) {
+    char *bufc=reinterpret_cast<char*>(buf);
+    sprintf(bufc,"%s/header",filename);
+    FILE *outf=safe_fopen(bufc,f_num==0?"w":"a");
+    fprintf(outf,"%g %g %d\n",time,time+duration,frames);
+    fclose(outf);
+}
+
+/** Returns the value of a field at a grid cell.
+ * \param[in] f the grid cell.
+ * \param[in] mode the code of the field. (0: x velocity, 1: y velocity, 2: z
+ *                 velocity, 3: pressure)
+ * \return The field value. */
+static inline float field_value(field_3d &f,int mode) {
+    switch(mode) {
+        case 0: return f.u;
+        case 1: return f.v;
+        case 2: return f.w;
+        default: return f.p;
+    }
+}
+
+/** Outputs a 3D field to a file in binary format. The file starts with three
+ * integers giving the dimensions of the field, followed by the values as
+ * floats, with the x index varying fastest. The velocity components are
+ * cell-centered, while the pressure is on the cell corners and includes the
+ * points on the upper boundaries.
+ * \param[in] prefix the field name to use as the filename prefix.
+ * \param[in] mode the code of the field to print.
+ * \param[in] sn the current frame number to append to the filename. */
+void fluid_3d::output(const char *prefix,const int mode,const int sn) {
+    const int e=mode==3?1:0,dims[3]={m+e,n+e,o+e};
+
+    // Assemble the output filename and open the output file
+    char *bufc=reinterpret_cast<char*>(buf);
+    sprintf(bufc,"%s/%s.%d",filename,prefix,sn);
+    FILE *outf=safe_fopen(bufc,"wb");
+    fwrite(dims,sizeof(int),3,outf);
+
+    // Output the field values a row at a time
+    for(int k=0;k<dims[2];k++) for(int j=0;j<dims[1];j++) {
+        field_3d *fp=fm+(mln*k+ml*j);
+        for(float *bp=buf,*be=buf+*dims;bp<be;) *(bp++)=field_value(*(fp++),mode);
+        fwrite(buf,sizeof(float),*dims,outf);
+    }
+
+    // Close the file
+    fclose(outf);
+}
+
+/** Outputs a z plane of a field to a file in a format that can be read by
+ * Gnuplot.
+ * \param[in] prefix the field name to use as the filename prefix.
+ * \param[in] mode the code of the field to print.
+ * \param[in] sn the current frame number to append to the filename.
+ * \param[in] k the index of the plane. */
+void fluid_3d::output_slice(const char *prefix,const int mode,const int sn,const int k) {
+
+    // Determine whether to output a cell-centered field or not
+    bool cen=mode<3;
+    int l=cen?m:m+1,ln=cen?n:n+1;
+    double disp=cen?0.5:0;
+
+    // Assemble the output filename and open the output file
+    char *bufc=reinterpret_cast<char*>(buf);
+    sprintf(bufc,"%s/%s.%d",filename,prefix,sn);
+    FILE *outf=safe_fopen(bufc,"wb");
+
+    // Output the first line of the file
+    float *bp=buf+1,*be=bp+l;
+    *buf=l;
+    for(int i=0;i<l;i++) *(bp++)=ax+(i+disp)*dx;
+    fwrite(buf,sizeof(float),l+1,outf);
+
+    // Output the field values to the file
+    for(int j=0;j<ln;j++) {
+        field_3d *fp=fm+(mln*k+ml*j);
+        *buf=ay+(j+disp)*dy;bp=buf+1;
+        while(bp<be) *(bp++)=field_value(*(fp++),mode);
+        fwrite(buf,sizeof(float),l+1,outf);
+    }
+
+    // Close the file
+    fclose(outf);
+}
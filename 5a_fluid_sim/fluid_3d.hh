@@ -0,0 +1,182 @@
+#ifndef FLUID_3D_HH
+#define FLUID_3D_HH
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+
+#include "fields.hh"
+#include "mgs_fem_3d.hh"
+
+#ifdef _OPENMP
+#include "omp.h"
+#endif
+
+/** The target size in bytes of the working set of the cache-blocked stencil
+ * sweeps, which should fit within the per-core cache. */
+const int f3d_block_bytes=1<<19;
+
+/** A class to carry out a 3D incompressible fluid simulation, using the same
+ * algorithm as the 2D simulation: the velocity is advected with the
+ * second-order ENO scheme, the viscous terms are treated explicitly, and the
+ * velocity is projected using a finite-element problem for the pressure on
+ * the cell corners. The fields are stored with the x index running fastest,
+ * followed by y and then z, with two ghost layers on each side. The stencil
+ * sweeps are parallelized over the z planes, and are divided into blocks of
+ * rows, so that the z planes that are needed for each block remain in the
+ * cache as the sweep moves through them. */
+class fluid_3d {
+    public:
+        /** The number of grid cells in the x direction. */
+        const int m;
+        /** The number of grid cells in the y direction. */
+        const int n;
+        /** The number of grid cells in the z direction. */
+        const int o;
+        /** The total number of grid cells. */
+        const int mno;
+        /** The number of cell-cornered points in the pressure
+         * finite-element problem in the x direction. */
+        const int m_fem;
+        /** The number of cell-cornered points in the pressure
+         * finite-element problem in the y direction. */
+        const int n_fem;
+        /** The number of cell-cornered points in the pressure
+         * finite-element problem in the z direction. */
+        const int o_fem;
+        /** The memory step length in the y direction, taking into account
+         * ghost point allocation. */
+        const int ml;
+        /** The memory step length in the z direction, taking into account
+         * ghost point allocation. */
+        const int mln;
+        /** The number of rows in each block of the cache-blocked stencil
+         * sweeps. */
+        const int yb;
+        /** The number of tracers. */
+        int ntrace;
+        /** The periodicity in the x direction. */
+        const bool x_prd;
+        /** The periodicity in the y direction. */
+        const bool y_prd;
+        /** The periodicity in the z direction. */
+        const bool z_prd;
+        /** The lower bound in the x direction. */
+        const double ax;
+        /** The upper bound in the x direction. */
+        const double bx;
+        /** The lower bound in the y direction. */
+        const double ay;
+        /** The upper bound in the y direction. */
+        const double by;
+        /** The lower bound in the z direction. */
+        const double az;
+        /** The upper bound in the z direction. */
+        const double bz;
+        /** The grid spacing in the x direction. */
+        const double dx;
+        /** The grid spacing in the y direction. */
+        const double dy;
+        /** The grid spacing in the z direction. */
+        const double dz;
+        /** The inverse grid spacing in the x direction. */
+        const double xsp;
+        /** The inverse grid spacing in the y direction. */
+        const double ysp;
+        /** The inverse grid spacing in the z direction. */
+        const double zsp;
+        /** The square inverse grid spacing in the x direction. */
+        const double xxsp;
+        /** The square inverse grid spacing in the y direction. */
+        const double yysp;
+        /** The square inverse grid spacing in the z direction. */
+        const double zzsp;
+        /** The viscosity. */
+        const double visc;
+        /** The density. */
+        const double rho;
+        /** The inverse density. */
+        const double rhoinv;
+        /** The filename of the output directory. */
+        const char *filename;
+        /** An array containing the simulation fields. */
+        field_3d* const fbase;
+        /** A pointer to the (0,0,0) grid cell in the field array. */
+        field_3d* const fm;
+        /** An array for the source terms used during the multigrid
+         * solve. */
+        double* const src;
+        /** An array containing the tracer positions. */
+        double* tm;
+        /** The regular timestep to be used. */
+        double dt_reg;
+        /** The current simulation time. */
+        double time;
+        /** The current frame number. */
+        int f_num;
+        /** The fields to save to file. (1: x velocity, 2: y velocity, 4: z
+         * velocity, 8: pressure) */
+        unsigned int fflags;
+        fluid_3d(const int m_,const int n_,const int o_,const bool x_prd_,
+                 const bool y_prd_,const bool z_prd_,const double ax_,
+                 const double bx_,const double ay_,const double by_,
+                 const double az_,const double bz_,const double visc_,
+                 const double rho_,unsigned int fflags_,const char *filename_);
+        ~fluid_3d();
+        void solve(double duration,int frames);
+        void step_forward(double dt);
+        void init_fields();
+        void write_files(int k);
+        void initialize(int ntrace_,double dt_pad,double max_vel=-1,bool verbose=true);
+        double advection_dt();
+        void choose_dt(double dt_pad,double adv_dt,bool verbose=true);
+        /** Returns the average number of V-cycles per multigrid solve since
+         * the last call, and resets the counters.
+         * \return The average number of V-cycles. */
+        inline float fem_iters() {
+            return ms_fem.tp.avg_iters();
+        }
+        void init_tracers();
+        void update_tracers(double dt);
+        void output(const char *prefix,const int mode,const int sn);
+        void output_slice(const char *prefix,const int mode,const int sn,const int k);
+        void output_tracers(const char *prefix,const int sn);
+        void save_header(double duration,int frames);
+        double max_divergence();
+        /** Chooses a timestep size that is the largest value smaller than dt_reg,
+        * such that a given interval length is a perfect multiple of this timestep.
+        * \param[in] interval the interval length to consider.
+        * \param[out] adt the timestep size.
+        * \return The number of timesteps the fit into the interval. */
+        inline int timestep_select(double interval, double &adt) {
+            int l=static_cast<int>(interval/dt_reg)+1;
+            adt=interval/l;
+            return l;
+        }
+    private:
+        /** The multigrid solver for the pressure finite-element
+         * problem. */
+        mgs_fem_3d ms_fem;
+        void set_boundaries();
+        void set_x_ghosts(field_3d *fp);
+        void set_y_ghosts(field_3d *fp);
+        void set_z_ghosts();
+        void fem_x_ghosts(field_3d *fp);
+        void fem_y_ghosts(field_3d *fp);
+        void fem_z_ghosts();
+        double average_pressure();
+        void copy_pressure();
+        inline void vel_eno2(double &ud,double &vd,double &wd,double hs,field_3d &f0,
+                             field_3d &f1,field_3d &f2,field_3d &f3);
+        inline double eno2(double p0,double p1,double p2,double p3);
+        inline void remap_tracer(double &xx,double &yy,double &zz);
+        /** Temporary storage for used during the output routine. */
+        float *buf;
+#ifdef _OPENMP
+        inline double wtime() {return omp_get_wtime();}
+#else
+        inline double wtime() {return 0;}
+#endif
+};
+
+#endif
@@ -0,0 +1,29 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <cmath>
+
+#include "fluid_3d.hh"
+
+const char fn[]="f3test.out";
+
+int main() {
+
+    // Create the output directory for storing the simulation frames
+    mkdir(fn,S_IRWXU|S_IRWXG|S_IROTH|S_IXOTH);
+
+    // Specify which fields should be outputted. 1: x velocity, 2: y velocity,
+    // 4: z velocity, 8: pressure.
+    unsigned int fflags=1|2|4|8;
+
+    // Construct the simulation class, setting the number of gridpoints, the
+    // periodicity, and physical constants
+    fluid_3d f3d(64,64,64,true,true,true,-1,1,-1,1,-1,1,0.002,1.,fflags,fn);
+
+    // Initialize the tracers, and set the timestep based on multiplying the
+    // maximum allowable by a padding factor
+    f3d.initialize(512,0.6);
+
+    // Run the simulation for a specified duration, outputting snapshots at
+    // regular intervals
+    f3d.solve(2,20);
+}
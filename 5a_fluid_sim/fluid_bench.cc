@@ -0,0 +1,148 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <ctime>
+#include <algorithm>
+
+#include "common.hh"
+#include "fluid_2d.hh"
+
+// Set up timing routine. If code was compiled with OpenMP, then use the
+// accurate wtime function. Otherwise use the clock function in the ctime
+// library.
+#ifdef _OPENMP
+#include "omp.h"
+inline double wtime() {return omp_get_wtime();}
+#else
+inline double wtime() {return double(clock())*(1./CLOCKS_PER_SEC);}
+#endif
+
+// The number of untimed steps taken before the measurements, which warm up
+// the caches and let the multigrid iteration predictor settle
+const int warm_steps=5;
+
+// The maximum number of timed repetitions
+const int max_reps=64;
+
+/** The measurements from a single benchmark configuration. */
+struct bench_result {
+    /** The median wall clock time per step over the repetitions. */
+    double t_med;
+    /** The minimum wall clock time per step over the repetitions. */
+    double t_min;
+    /** The number of grid cell updates per second, based on the median. */
+    double cups;
+    /** The average number of V-cycles per step. */
+    double vcyc;
+    /** The average wall clock time per step spent in each phase. */
+    double ph[f2d_phases];
+};
+
+/** Runs a fluid simulation with no output, and measures its performance.
+ * \param[in] m the grid size.
+ * \param[in] prd the periodicity in both directions.
+ * \param[in] threads the number of threads to use.
+ * \param[in] steps the number of steps in each timed repetition.
+ * \param[in] reps the number of timed repetitions.
+ * \param[out] br the measurements. */
+void run(int m,bool prd,int threads,int steps,int reps,bench_result &br) {
+#ifdef _OPENMP
+    omp_set_num_threads(threads);
+#endif
+    fluid_2d f2d(m,m,prd,prd,-1,1,-1,1,0.002,1.,0,".");
+    f2d.initialize(0,0.6,-1,false);
+    double dt=f2d.dt_reg,t[max_reps];
+
+    // Take the warm-up steps, and then reset the counters
+    for(int j=0;j<warm_steps;j++) f2d.step_forward(dt);
+    f2d.fem_iters();
+    f2d.reset_phases();
+
+    // Time each repetition separately, so that the median can be taken
+    for(int r=0;r<reps;r++) {
+        double t0=wtime();
+        for(int j=0;j<steps;j++) f2d.step_forward(dt);
+        t[r]=(wtime()-t0)/steps;
+    }
+    std::sort(t,t+reps);
+    br.t_med=reps&1?t[reps/2]:0.5*(t[reps/2-1]+t[reps/2]);
+    br.t_min=*t;
+    br.cups=double(m)*m/br.t_med;
+    br.vcyc=f2d.fem_iters()*f2d.rk_order;
+    for(int p=0;p<f2d_phases;p++) br.ph[p]=f2d.ph_time[p]/(steps*reps);
+}
+
+/** Prints a line of benchmark results.
+ * \param[in] type the type of scaling test.
+ * \param[in] m the grid size.
+ * \param[in] prd the periodicity.
+ * \param[in] threads the number of threads.
+ * \param[in] br the measurements.
+ * \param[in] eff the parallel efficiency. */
+void print_result(const char *type,int m,bool prd,int threads,bench_result &br,double eff) {
+    printf("%s %d %d %d %g %g %g %g",type,prd?1:0,m,threads,1e3*br.t_med,
+           1e3*br.t_min,br.cups,br.vcyc);
+    for(int p=0;p<f2d_phases;p++) printf(" %g",1e3*br.ph[p]);
+    printf(" %g\n",eff);
+    fflush(stdout);
+}
+
+int main(int argc,char **argv) {
+
+    // Check for command-line arguments
+    if(argc<3||argc>7) {
+        fputs("Syntax: ./fluid_bench <min_grid> <max_grid> [max_threads] [steps]\n"
+              "                      [repeats] [periodicity]\n\n"
+              "Benchmarks the fluid simulation with no output, for grid sizes\n"
+              "doubling from the minimum to the maximum, and thread counts\n"
+              "doubling from 1 to the maximum. For strong scaling, each grid\n"
+              "size is run at each thread count. For weak scaling, the number of\n"
+              "grid cells per thread is held at that of the minimum grid size.\n"
+              "Each configuration takes warm-up steps, followed by a number of\n"
+              "timed repetitions of the given number of steps, and the median\n"
+              "is reported. The periodicity is 0 for walls, 1 for periodic, or\n"
+              "2 for both (default). The results are written to standard output\n"
+              "with one line per configuration.\n",stderr);
+        return 1;
+    }
+    int m_lo=atoi(argv[1]),m_hi=atoi(argv[2]),
+        steps=argc>=5?atoi(argv[4]):10,reps=argc>=6?atoi(argv[5]):3,
+        pmode=argc==7?atoi(argv[6]):2;
+#ifdef _OPENMP
+    int max_t=argc>=4?atoi(argv[3]):omp_get_max_threads();
+#else
+    int max_t=1;
+#endif
+    if(m_lo<8||m_hi<m_lo||max_t<1||steps<1||reps<1||reps>max_reps||pmode<0||pmode>2)
+        fatal_error("Invalid benchmark parameters",1);
+
+    // Print the column headers
+    fputs("# type periodic grid threads step_ms_median step_ms_min "
+          "cell_updates_per_s vcycles_per_step",stdout);
+    for(int p=0;p<f2d_phases;p++) printf(" %s_ms",f2d_phase_names[p]);
+    puts(" efficiency");
+
+    bench_result br,b1;
+    for(int k=pmode==1?1:0;k<(pmode==0?1:2);k++) {
+        bool prd=k==1;
+
+        // Strong scaling: the efficiency is the speedup over one thread,
+        // divided by the number of threads
+        for(int m=m_lo;m<=m_hi;m<<=1) for(int t=1;t<=max_t;t<<=1) {
+            run(m,prd,t,steps,reps,br);
+            if(t==1) b1=br;
+            print_result("strong",m,prd,t,br,b1.t_med/(t*br.t_med));
+        }
+
+        // Weak scaling: the grid size is increased so that the number of
+        // cells per thread is approximately constant, rounding to a multiple
+        // of eight to keep a deep multigrid hierarchy. The efficiency is the
+        // cell update rate per thread relative to one thread.
+        for(int t=1;t<=max_t;t<<=1) {
+            int m=t==1?m_lo:8*static_cast<int>(0.125*m_lo*sqrt(double(t))+0.5);
+            run(m,prd,t,steps,reps,br);
+            if(t==1) b1=br;
+            print_result("weak",m,prd,t,br,br.cups/(t*b1.cups));
+        }
+    }
+}
@@ -0,0 +1,116 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <ctime>
+
+#include "common.hh"
+#include "fluid_2d.hh"
+
+// Set up timing routine. If code was compiled with OpenMP, then use the
+// accurate wtime function. Otherwise use the clock function in the ctime
+// library.
+#ifdef _OPENMP
+#include "omp.h"
+inline double wtime() {return omp_get_wtime();}
+#else
+inline double wtime() {return double(clock())*(1./CLOCKS_PER_SEC);}
+#endif
+
+const char fn[]="fens.out";
+
+int main(int argc,char **argv) {
+
+    // Grid size of each simulation
+    const int m=128,n=128;
+
+    // Range of viscosities to sweep over, using logarithmic spacing
+    const double visc_lo=0.0005,visc_hi=0.02;
+
+    // Simulation duration and number of frames for each case
+    const double duration=1;
+    const int frames=10;
+
+    // Check for command-line arguments
+    if(argc<3||argc>4) {
+        fputs("Syntax: ./fluid_ensemble <cases> <threads_per_case> [output]\n\n"
+              "Runs an ensemble of independent fluid simulations over a range of\n"
+              "viscosities. Each simulation is carried out by a small team of\n"
+              "threads, and the teams run concurrently. If the optional third\n"
+              "argument is 1, then the velocity fields of each case are saved.\n",stderr);
+        return 1;
+    }
+    int cases=atoi(argv[1]),tpc=atoi(argv[2]);
+    bool out=argc==4&&atoi(argv[3])==1;
+    if(cases<1||tpc<1) fatal_error("Invalid ensemble parameters",1);
+
+    // Choose the number of concurrent teams. If each case uses a single
+    // thread, then nested parallelism is disabled, so that the parallel loops
+    // within the fluid_2d and tgmg classes run serially without forking.
+#ifdef _OPENMP
+    int teams=omp_get_max_threads()/tpc;
+    if(teams<1) teams=1;
+    omp_set_max_active_levels(tpc>1?2:1);
+#else
+    int teams=1;
+#endif
+    printf("# Cases            : %d\n"
+           "# Threads per case : %d\n"
+           "# Concurrent teams : %d\n",cases,tpc,teams);
+
+    // Create the output directory and open the shared summary file. Each
+    // case appends a line to it after every frame, serialized through a
+    // critical section.
+    mkdir(fn,S_IRWXU|S_IRWXG|S_IROTH|S_IXOTH);
+    char sfn[256];
+    sprintf(sfn,"%s/summary",fn);
+    FILE *sf=safe_fopen(sfn,"w");
+    double cell_updates=0,t0=wtime();
+
+#pragma omp parallel for num_threads(teams) schedule(dynamic) reduction(+:cell_updates)
+    for(int c=0;c<cases;c++) {
+#ifdef _OPENMP
+        omp_set_num_threads(tpc);
+#endif
+
+        // Set up the output directory for this case
+        char dn[256];
+        sprintf(dn,"%s/c%04d",fn,c);
+        if(out) mkdir(dn,S_IRWXU|S_IRWXG|S_IROTH|S_IXOTH);
+
+        // Construct and initialize the simulation. The multigrid hierarchy
+        // determines its thread counts at this point, so this must be done
+        // after the team size is set.
+        double visc=cases==1?visc_lo:visc_lo*pow(visc_hi/visc_lo,c/(cases-1.));
+        fluid_2d f2d(m,n,true,true,-1,1,-1,1,visc,1.,out?3:0,dn);
+        f2d.initialize(0,0.6,-1,false);
+        double adt,ct0=wtime();
+        int l=f2d.timestep_select(duration/frames,adt);
+
+        // Carry out the simulation, writing a summary line after each frame
+        // containing the case number, viscosity, frame number, time,
+        // reciprocal of the advection timestep limit, and the average number
+        // of V-cycles per solve
+        for(int k=1;k<=frames;k++) {
+            for(int j=0;j<l;j++) f2d.step_forward(adt);
+            if(out) f2d.write_files(k);
+            double adv=f2d.advection_dt();
+            float fi=f2d.fem_iters();
+#pragma omp critical(ensemble_output)
+            fprintf(sf,"%d %g %d %g %g %.3f\n",c,visc,k,f2d.time,
+                    1/adv,fi);
+        }
+        double ct=wtime()-ct0;
+        cell_updates+=double(l)*frames*m*n;
+#pragma omp critical(ensemble_output)
+        printf("# Case %d: visc %g, %d steps, %g s, %g cell updates/s\n",
+               c,visc,l*frames,ct,double(l)*frames*m*n/ct);
+    }
+
+    // Print the aggregate throughput
+    double t=wtime()-t0;
+    fclose(sf);
+    printf("# Total wall clock time : %g s\n"
+           "# Aggregate throughput  : %g cell updates/s\n",t,cell_updates/t);
+}
@@ -0,0 +1,81 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <ctime>
+
+#include "common.hh"
+#include "fluid_2d.hh"
+
+// Set up timing routine. If code was compiled with OpenMP, then use the
+// accurate wtime function. Otherwise use the clock function in the ctime
+// library.
+#ifdef _OPENMP
+#include "omp.h"
+inline double wtime() {return omp_get_wtime();}
+#else
+inline double wtime() {return double(clock())*(1./CLOCKS_PER_SEC);}
+#endif
+
+/** Runs a simulation using a given field type, and stores the final velocity
+ * and pressure.
+ * \param[in] m the grid size.
+ * \param[in] duration the simulation duration.
+ * \param[out] out an array in which to store the (u,v,p) fields.
+ * \param[out] steps the number of steps taken.
+ * \return The wall clock time per step. */
+template<class T>
+double run(int m,double duration,double *out,int &steps) {
+    fluid_2d_t<T> f2d(m,m,true,true,-1,1,-1,1,0.002,1.,0,".");
+    f2d.initialize(0,0.6,-1,false);
+    double adt,t0;
+    steps=f2d.timestep_select(duration,adt);
+    t0=wtime();
+    for(int k=0;k<steps;k++) f2d.step_forward(adt);
+    t0=(wtime()-t0)/steps;
+
+    // Store the fields in double precision
+    for(int j=0;j<m;j++) {
+        typename fluid_2d_t<T>::field *fp=f2d.fm+j*f2d.ml;
+        for(int i=0;i<m;i++,fp++) {
+            *(out++)=fp->u;*(out++)=fp->v;*(out++)=fp->p;
+        }
+    }
+    return t0;
+}
+
+int main(int argc,char **argv) {
+
+    // Check for command-line arguments
+    if(argc>3) {
+        fputs("Syntax: ./fluid_prec_test [grid_size] [duration]\n\n"
+              "Runs the same fluid simulation with double and single precision\n"
+              "fields, and compares the step times and the final fields.\n",stderr);
+        return 1;
+    }
+    int m=argc>=2?atoi(argv[1]):256,steps;
+    double duration=argc==3?atof(argv[2]):1;
+    if(m<8||duration<=0) fatal_error("Invalid parameters",1);
+
+    // Run the simulation with both field types
+    double *fd=new double[6*m*m],*ff=fd+3*m*m;
+    double td=run<double>(m,duration,fd,steps),
+           tf=run<float>(m,duration,ff,steps);
+
+    // Compute the RMS and maximum differences of each field, along with the
+    // RMS value of the double precision field for reference
+    const char *nm[3]={"u","v","p"};
+    printf("# Grid %dx%d, %d steps\n"
+           "# Step time: double %g ms, float %g ms, speedup %g\n"
+           "# Field, RMS value, RMS difference, max difference\n",
+           m,m,steps,1e3*td,1e3*tf,td/tf);
+    for(int c=0;c<3;c++) {
+        double ref=0,rms=0,mx=0;
+        for(int ij=c;ij<3*m*m;ij+=3) {
+            double e=fabs(fd[ij]-ff[ij]);
+            ref+=fd[ij]*fd[ij];rms+=e*e;
+            if(e>mx) mx=e;
+        }
+        printf("%s %g %g %g\n",nm[c],sqrt(ref/(m*m)),sqrt(rms/(m*m)),mx);
+    }
+    delete [] fd;
+}
@@ -0,0 +1,95 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <ctime>
+
+#include "common.hh"
+#include "fluid_2d.hh"
+
+// Set up timing routine. If code was compiled with OpenMP, then use the
+// accurate wtime function. Otherwise use the clock function in the ctime
+// library.
+#ifdef _OPENMP
+#include "omp.h"
+inline double wtime() {return omp_get_wtime();}
+#else
+inline double wtime() {return double(clock())*(1./CLOCKS_PER_SEC);}
+#endif
+
+// The number of steps and the timestep for the spin-up phase
+const int spin_steps=20;
+const double spin_dt=1e-4;
+
+/** Runs a simulation to a given time using a specified integrator and timestep
+ * padding factor.
+ * \param[in] m the grid size.
+ * \param[in] order the integrator order, or zero for the reference run,
+ *                  which uses SSP-RK3.
+ * \param[in] pad the timestep padding factor.
+ * \param[in] duration the simulation duration.
+ * \param[in,out] ref the reference velocity field to compare to, or to
+ *                    store in the reference run.
+ * \param[out] steps the number of steps taken.
+ * \param[out] wt the wall clock time taken.
+ * \return The RMS velocity difference to the reference field. */
+double run(int m,int order,double pad,double duration,double *ref,int &steps,double &wt) {
+
+    // Set up the simulation. The initial velocity field is not divergence
+    // free, and its projection during the first step introduces an O(dt)
+    // error regardless of the integrator. All runs therefore start with an
+    // identical spin-up using small SSP-RK3 steps.
+    fluid_2d f2d(m,m,true,true,-1,1,-1,1,0.002,1.,0,".");
+    f2d.time_integrator(3);
+    f2d.initialize(0,pad,-1,false);
+    for(int k=0;k<spin_steps;k++) f2d.step_forward(spin_dt);
+
+    // Switch to the chosen integrator and run to the end time
+    f2d.time_integrator(order==0?3:order);
+    f2d.choose_dt(pad,f2d.advection_dt(),false);
+    double adt,t0=wtime(),err=0;
+    steps=f2d.timestep_select(duration-f2d.time,adt);
+    for(int k=0;k<steps;k++) f2d.step_forward(adt);
+    wt=wtime()-t0;
+
+    // Store the velocity field if this is the reference run, or otherwise
+    // compare to the reference
+    double *rp=ref;
+    for(int j=0;j<m;j++) for(field *fp=f2d.fm+j*f2d.ml,*fe=fp+m;fp<fe;fp++,rp+=2) {
+        if(order==0) {*rp=fp->u;rp[1]=fp->v;continue;}
+        double du=fp->u-*rp,dv=fp->v-rp[1];
+        err+=du*du+dv*dv;
+    }
+    return sqrt(err/(m*m));
+}
+
+int main(int argc,char **argv) {
+
+    // Check for command-line arguments
+    if(argc<2||argc>4) {
+        fputs("Syntax: ./fluid_rk_bench <grid_size> [duration] [pad]\n\n"
+              "Compares the accuracy and cost of the forward Euler, SSP-RK2, and\n"
+              "SSP-RK3 integrators on a periodic grid. Each integrator is run at\n"
+              "a sequence of timesteps, and the RMS velocity error is measured\n"
+              "against an SSP-RK3 solution with a much smaller timestep.\n",stderr);
+        return 1;
+    }
+    int m=atoi(argv[1]),steps;
+    double duration=argc>=3?atof(argv[2]):0.5,pad=argc==4?atof(argv[3]):0.6,wt;
+    if(m<8||duration<=spin_steps*spin_dt||pad<=0) fatal_error("Invalid benchmark parameters",1);
+
+    // Compute the reference solution and store its velocity field
+    double *ref=new double[2*m*m];
+    run(m,0,pad/64,duration,ref,steps,wt);
+    printf("# Reference: SSP-RK3, %d steps\n",steps);
+
+    // Run each integrator with a sequence of timesteps
+    puts("# Order, padding, steps, pressure solves, wall clock time (s), RMS error");
+    for(int order=1;order<=3;order++) {
+        for(int r=1;r<=8;r<<=1) {
+            double err=run(m,order,pad/r,duration,ref,steps,wt);
+            printf("%d %g %d %d %g %g\n",order,pad/r,steps,steps*order,wt,err);
+        }
+        puts("\n");
+    }
+    delete [] ref;
+}
@@ -23,6 +23,9 @@ int main() {
     // maximum allowable by a padding factor
     f2d.initialize(512,0.6);
 
+    // Save the initial horizontal velocity including the ghost regions
+    f2d.output("u_ghost",0,0,true);
+
     // Run the simulation for a specified duration, outputting snapshots at
     // regular intervals
     f2d.solve(10,200);
@@ -5,16 +5,77 @@
 /** The constructor sets many internal constants from the parent fluid_2d
  * class.
  * \param[in] f a reference to the parent fluid_2d class. */
-mgs_fem::mgs_fem(fluid_2d &f) : m(f.m_fem), n(f.n_fem), mn(m*n),
+template<class T>
+mgs_fem::mgs_fem(fluid_2d_t<T> &f) : m(f.m_fem), n(f.n_fem), mn(m*n),
     x_prd(f.x_prd), y_prd(f.y_prd), dydx(f.dy/f.dx), dxdy(f.dx/f.dy),
     fm(4./3.*(dxdy+dydx)), fm_inv(1.0/fm), fey(1./3.*(-2*dxdy+dydx)),
     hey(0.5*fey), fex(1./3.*(-2*dydx+dxdy)), hex(0.5*fex),
     fc(-1./6.*(dxdy+dydx)), acc(tgmg_accuracy(fm,1e4)), z(new double[mn]),
-    mg(*this,f.src,z) {
+    ext_order(0), nh(0), mg(*this,f.src,z) {
+    zh[0]=zh[1]=NULL;
+    dth[0]=dth[1]=0;
     mg.setup();
     mg.clear_z();
 }
 
+/** Sets the order of the temporal extrapolation used to construct the initial
+ * guess for each solve, allocating the memory for the solution history if
+ * this has not already been done. When extrapolation is switched on, the
+ * history is cleared, since it is not recorded while extrapolation is off.
+ * \param[in] order the extrapolation order, from 0 to 2. */
+void mgs_fem::set_extrapolation(int order) {
+    if(order<0||order>2) {
+        fputs("Extrapolation order must be between 0 and 2\n",stderr);
+        exit(1);
+    }
+    if(order>0&&ext_order==0) {
+        if(zh[0]==NULL) {
+            zh[0]=new double[mn];
+            zh[1]=new double[mn];
+        }
+        nh=0;
+    }
+    ext_order=order;
+}
+
+/** Replaces the solution array with a guess for the next solve, by
+ * extrapolating the previous solutions in time using Lagrange interpolation.
+ * The current solution is pushed into the history at the same time, so that
+ * only a single pass over the arrays is needed.
+ * \param[in] dt the time interval to the next solve. */
+void mgs_fem::extrapolate(double dt) {
+    if(ext_order==0) return;
+
+    // Compute the Lagrange weights for the available history, where the
+    // solutions are at times 0, -h1, and -h1-h2, and the guess is at time dt
+    int k=nh-1<ext_order?nh-1:ext_order;
+    double c0=1,c1=0,c2=0,h1=dth[0],h2=dth[1];
+    if(k==1) {
+        c0=(dt+h1)/h1;c1=-dt/h1;
+    } else if(k==2) {
+        double t2=h1+h2;
+        c0=(dt+h1)*(dt+t2)/(h1*t2);
+        c1=-dt*(dt+t2)/(h1*h2);
+        c2=dt*(dt+h1)/(t2*h2);
+    }
+
+    // Push the current solution into the history, overwriting the oldest
+    // entry, and compute the initial guess
+    if(nh>0) {
+        double *zo=zh[1],*z1=zh[0];
+#pragma omp parallel for
+        for(int j=0;j<mn;j+=m) {
+            for(int ij=j;ij<j+m;ij++) {
+                double z0=z[ij];
+                z[ij]=c0*z0+c1*z1[ij]+c2*zo[ij];
+                zo[ij]=z0;
+            }
+        }
+        zh[0]=zo;zh[1]=z1;
+    }
+    dth[1]=dth[0];dth[0]=dt;
+}
+
 /** Evaluates a single entry of the linear matrix system multiplied by the
  * current vector (held in the z array).
  * \param[in] i the horizontal index of the entry to consider.
@@ -50,6 +111,8 @@ double mgs_fem::mul_a(int i,int ij) {
 }
 
 // Explicit instantiation
+template mgs_fem::mgs_fem(fluid_2d_t<double> &f);
+template mgs_fem::mgs_fem(fluid_2d_t<float> &f);
 #include "tgmg.cc"
 template class tgmg<mgs_fem,double,double>;
 template void tgmg_base<mgs_fem,double,double>::output(char const*,double*,double,double,double,double);
@@ -1,7 +1,7 @@
 #ifndef MGS_FEM_HH
 #define MGS_FEM_HH
 
-class fluid_2d;
+template<class T> class fluid_2d_t;
 
 #include "tgmg.hh"
 
@@ -44,10 +44,30 @@ struct mgs_fem {
     /** The array holding the solution of the linear system (i.e. the fluid
      * pressure). */
     double* const z;
-    mgs_fem(fluid_2d &f);
+    /** The order of the temporal extrapolation used to construct the
+     * initial guess for each solve. (0=previous solution, 1=linear,
+     * 2=quadratic) */
+    int ext_order;
+    /** The number of consecutive solutions that are available for
+     * extrapolation, including the one held in the z array. */
+    int nh;
+    /** The two previous solutions, which are only allocated if
+     * extrapolation is enabled. */
+    double *zh[2];
+    /** The time intervals between the solution in the z array and the
+     * previous solutions. */
+    double dth[2];
+    template<class T>
+    mgs_fem(fluid_2d_t<T> &f);
     ~mgs_fem() {
+        if(zh[0]!=NULL) {
+            delete [] zh[1];
+            delete [] zh[0];
+        }
         delete [] z;
     }
+    void set_extrapolation(int order);
+    void extrapolate(double dt);
     inline bool not_l(int i) {return x_prd||i>0;}
     inline bool not_r(int i) {return x_prd||i<m-1;}
     inline bool not_lr(int i) {return x_prd||(i>0&&i<m-1);}
@@ -75,6 +95,7 @@ struct mgs_fem {
             fputs("V-cycle failed to converge in FEM problem\n",stderr);
             exit(1);
         }
+        if(ext_order>0&&nh<3) nh++;
     }
     /** A helper class for the multigrid library that holds information for
      * predicting the number of V-cycles that are required. */
@@ -0,0 +1,315 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+
+#include "mgs_fem_3d.hh"
+#include "tgmg.hh"
+
+/** The one-dimensional stiffness factors of the trilinear elements, for
+ * interior gridpoints and gridpoints on the lower and upper walls. */
+const double k1d[3][3]={{-1,2,-1},{0,1,-1},{-1,1,0}};
+
+/** The one-dimensional mass factors of the trilinear elements, for interior
+ * gridpoints and gridpoints on the lower and upper walls. */
+const double m1d[3][3]={{1/6.,2/3.,1/6.},{0,1/3.,1/6.},{1/6.,1/3.,0}};
+
+/** The number of Gauss--Seidel sweeps on the way down the hierarchy. */
+const int mgs3_cyc_down=1;
+/** The number of Gauss--Seidel sweeps on the way up the hierarchy, not
+ * including the top level. */
+const int mgs3_cyc_up=1;
+/** The number of Gauss--Seidel sweeps on the bottom level. */
+const int mgs3_cyc_bottom=20;
+/** The number of Gauss--Seidel sweeps on the top level. */
+const int mgs3_cyc_top=2;
+
+/** The constructor sets up the multigrid hierarchy, coarsening by a factor of
+ * two in all directions until the grid can no longer be coarsened, or the
+ * number of gridpoints is small.
+ * \param[in] (m_,n_,o_) the number of gridpoints in each direction.
+ * \param[in] (x_prd_,y_prd_,z_prd_) the periodicity in each direction.
+ * \param[in] (fx,fy,fz) the prefactors of the stiffness terms in each
+ *                       direction on the finest level.
+ * \param[in] b the source term array of the finest level. */
+mgs_fem_3d::mgs_fem_3d(int m_,int n_,int o_,bool x_prd_,bool y_prd_,
+        bool z_prd_,double fx,double fy,double fz,double *b)
+    : m(m_), n(n_), o(o_), mno(m_*n_*o_), x_prd(x_prd_), y_prd(y_prd_),
+    z_prd(z_prd_), fm(8/9.*(fx+fy+fz)), acc(tgmg_accuracy(fm,1e4)),
+    z(new double[mno]), nlev(1) {
+
+    // Set up the finest level, which uses the external source term array
+    mgs_level_3d *l=lv;
+    l->m=m;l->n=n;l->o=o;l->mn=m*n;l->mno=mno;
+    l->fx=fx;l->fy=fy;l->fz=fz;
+    l->z=z;l->b=b;l->r=new double[mno];
+    set_stencil(*l);
+
+    // Add coarser levels. Since the physical stiffness prefactors scale
+    // linearly with the grid spacing, they double on each coarsening.
+    int mc=m,nc=n,oc=o;
+    while(nlev<tgmg_max_levels&&l->mno>64&&coarsen(mc,x_prd)
+          &&coarsen(nc,y_prd)&&coarsen(oc,z_prd)) {
+        mgs_level_3d *c=l+1;
+        c->m=mc;c->n=nc;c->o=oc;c->mn=mc*nc;c->mno=c->mn*oc;
+        c->fx=2*l->fx;c->fy=2*l->fy;c->fz=2*l->fz;
+        c->z=new double[3*c->mno];
+        c->b=c->z+c->mno;c->r=c->b+c->mno;
+        set_stencil(*c);
+        l=c;nlev++;
+    }
+    clear_z();
+}
+
+/** The destructor frees the dynamically allocated memory. */
+mgs_fem_3d::~mgs_fem_3d() {
+    for(int i=nlev-1;i>0;i--) delete [] lv[i].z;
+    delete [] lv->r;
+    delete [] z;
+}
+
+/** Computes the number of gridpoints in a direction after coarsening, if
+ * this is possible.
+ * \param[in,out] c the number of gridpoints, which is replaced with the
+ *                  coarsened value if coarsening is possible.
+ * \param[in] prd the periodicity in this direction.
+ * \return True if the direction can be coarsened, false otherwise. */
+bool mgs_fem_3d::coarsen(int &c,bool prd) {
+    if(prd) {
+        if(c<4||(c&1)) return false;
+        c>>=1;
+    } else {
+        if(c<5||!(c&1)) return false;
+        c=(c>>1)+1;
+    }
+    return true;
+}
+
+/** Computes the entries of the finite-element stencil at interior gridpoints
+ * of a level, from the tensor products of the one-dimensional factors.
+ * \param[in] l the level to consider. */
+void mgs_fem_3d::set_stencil(mgs_level_3d &l) {
+    double f=l.fx+l.fy+l.fz;
+    l.s0=8/9.*f;
+    l.sx=(-4*l.fx+2*l.fy+2*l.fz)/9.;
+    l.sy=(2*l.fx-4*l.fy+2*l.fz)/9.;
+    l.sz=(2*l.fx+2*l.fy-4*l.fz)/9.;
+    l.sxy=(-2*l.fx-2*l.fy+l.fz)/18.;
+    l.sxz=(-2*l.fx+l.fy-2*l.fz)/18.;
+    l.syz=(l.fx-2*l.fy-2*l.fz)/18.;
+    l.sxyz=-f/36.;
+}
+
+/** Sets the solution array to zero. */
+void mgs_fem_3d::clear_z() {
+#pragma omp parallel for
+    for(int k=0;k<mno;k+=m*n)
+        for(double *zp=z+k,*ze=zp+m*n;zp<ze;zp++) *zp=0.;
+}
+
+/** Evaluates the product of the finite-element matrix with the solution at a
+ * single gridpoint. The stencil is the sum of three tensor products of the
+ * one-dimensional stiffness and mass factors, so the 27 entries are
+ * evaluated as nine x-direction rows.
+ * \param[in] l the level to consider.
+ * \param[in] (i,j,k) the indices of the gridpoint.
+ * \param[out] dg the diagonal entry of the matrix.
+ * \return The component of the matrix-vector product. */
+double mgs_fem_3d::mul_a(mgs_level_3d &l,int i,int j,int k,double &dg) {
+    int dx[2],dy[2],dz[2];
+    const int tx=nbr(i,l.m,x_prd,1,dx),ty=nbr(j,l.n,y_prd,l.m,dy),
+              tz=nbr(k,l.o,z_prd,l.mn,dz);
+    const double *kx=k1d[tx],*mx=m1d[tx],*ky=k1d[ty],*my=m1d[ty],
+                 *kz=k1d[tz],*mz=m1d[tz];
+    const int oy[3]={dy[0],0,dy[1]},oz[3]={dz[0],0,dz[1]};
+    double *w=l.z+(i+l.m*j+l.mn*k),ans=0;
+    for(int c=0;c<3;c++) for(int b=0;b<3;b++) {
+        double *wr=w+(oy[b]+oz[c]),
+               sk=kx[0]*wr[dx[0]]+kx[1]*(*wr)+kx[2]*wr[dx[1]],
+               sm=mx[0]*wr[dx[0]]+mx[1]*(*wr)+mx[2]*wr[dx[1]];
+        ans+=l.fx*sk*my[b]*mz[c]+(l.fy*ky[b]*mz[c]+l.fz*my[b]*kz[c])*sm;
+    }
+    dg=l.fx*kx[1]*my[1]*mz[1]+(l.fy*ky[1]*mz[1]+l.fz*my[1]*kz[1])*mx[1];
+    return ans;
+}
+
+/** Carries out Gauss--Seidel sweeps on a level. The stencil only couples
+ * neighboring z planes, so the even planes are updated in parallel, followed
+ * by the odd planes. If the domain is z-periodic with an odd number of
+ * planes, then the last plane neighbors the first, and it is updated
+ * separately.
+ * \param[in] l the level to consider.
+ * \param[in] sweeps the number of sweeps to carry out. */
+void mgs_fem_3d::gauss_seidel(mgs_level_3d &l,int sweeps) {
+    const int ke=z_prd&&(l.o&1)?l.o-1:l.o;
+#pragma omp parallel
+    for(int s=0;s<sweeps;s++) {
+#pragma omp for
+        for(int k=0;k<ke;k+=2) gs_plane(l,k);
+#pragma omp for
+        for(int k=1;k<ke;k+=2) gs_plane(l,k);
+        if(ke<l.o) {
+#pragma omp single
+            gs_plane(l,ke);
+        }
+    }
+}
+
+/** Carries out a Gauss--Seidel sweep over a single z plane.
+ * \param[in] l the level to consider.
+ * \param[in] k the index of the plane. */
+void mgs_fem_3d::gs_plane(mgs_level_3d &l,int k) {
+    double dg,*zp=l.z+l.mn*k,*bp=l.b+l.mn*k;
+    const double s0inv=1/l.s0;
+    for(int j=0;j<l.n;j++) {
+        if(int_row(l,j,k)) {
+            *zp+=(*bp-mul_a(l,0,j,k,dg))/dg;
+            for(double *ze=(zp++)+l.m-1;zp<ze;zp++) *zp=(*(++bp)-mul_a_int(l,zp))*s0inv;
+            *zp+=(*(++bp)-mul_a(l,l.m-1,j,k,dg))/dg;
+            zp++;bp++;
+        } else for(int i=0;i<l.m;i++,zp++,bp++)
+            *zp+=(*bp-mul_a(l,i,j,k,dg))/dg;
+    }
+}
+
+/** Computes the residual on a level, storing it in the residual array.
+ * \param[in] l the level to consider.
+ * \return The sum of the squared residual. */
+double mgs_fem_3d::residual(mgs_level_3d &l) {
+    double rsq=0;
+#pragma omp parallel for reduction(+:rsq)
+    for(int k=0;k<l.o;k++) {
+        double dg,*rp=l.r+l.mn*k,*bp=l.b+l.mn*k,*zp=l.z+l.mn*k;
+        for(int j=0;j<l.n;j++) {
+            bool in=int_row(l,j,k);
+            for(int i=0;i<l.m;i++,rp++,bp++,zp++) {
+                *rp=in&&i>0&&i<l.m-1?*bp-mul_a_int(l,zp)-l.s0*(*zp)
+                                    :*bp-mul_a(l,i,j,k,dg);
+                rsq+=*rp*(*rp);
+            }
+        }
+    }
+    return rsq;
+}
+
+/** Computes the mean squared residual on the finest level.
+ * \return The mean squared residual. */
+double mgs_fem_3d::l2_error() {
+    return residual(*lv)/mno;
+}
+
+/** Restricts the residual on a level to the source term on the next coarser
+ * level, using the transpose of the trilinear interpolation.
+ * \param[in] l the fine level.
+ * \param[in] c the coarse level. */
+void mgs_fem_3d::restrict_residual(mgs_level_3d &l,mgs_level_3d &c) {
+    const double w[3]={0.5,1,0.5};
+#pragma omp parallel for
+    for(int kc=0;kc<c.o;kc++) {
+        double *bp=c.b+c.mn*kc;
+        for(int jc=0;jc<c.n;jc++) for(int ic=0;ic<c.m;ic++,bp++) {
+            double s=0;
+            for(int dk=-1;dk<=1;dk++) {
+                int k=2*kc+dk;
+                if(k<0||k>=l.o) {if(!z_prd) continue;k+=k<0?l.o:-l.o;}
+                for(int dj=-1;dj<=1;dj++) {
+                    int j=2*jc+dj;
+                    if(j<0||j>=l.n) {if(!y_prd) continue;j+=j<0?l.n:-l.n;}
+                    double *rp=l.r+(l.m*j+l.mn*k),wjk=w[dj+1]*w[dk+1];
+                    for(int di=-1;di<=1;di++) {
+                        int i=2*ic+di;
+                        if(i<0||i>=l.m) {if(!x_prd) continue;i+=i<0?l.m:-l.m;}
+                        s+=wjk*w[di+1]*rp[i];
+                    }
+                }
+            }
+            *bp=s;
+        }
+    }
+}
+
+/** Interpolates the solution on a coarse level trilinearly, and adds it to the
+ * solution on the next finer level.
+ * \param[in] c the coarse level.
+ * \param[in] l the fine level. */
+void mgs_fem_3d::interpolate(mgs_level_3d &c,mgs_level_3d &l) {
+#pragma omp parallel for
+    for(int k=0;k<l.o;k++) {
+        int k0=k>>1,k1=(k&1)?(k0+1==c.o?0:k0+1):k0;
+        double *zp=l.z+l.mn*k;
+        for(int j=0;j<l.n;j++) {
+            int j0=j>>1,j1=(j&1)?(j0+1==c.n?0:j0+1):j0;
+            double *c00=c.z+(c.m*j0+c.mn*k0),*c10=c.z+(c.m*j1+c.mn*k0),
+                   *c01=c.z+(c.m*j0+c.mn*k1),*c11=c.z+(c.m*j1+c.mn*k1);
+            for(int i=0;i<l.m;i++,zp++) {
+                int i0=i>>1,i1=(i&1)?(i0+1==c.m?0:i0+1):i0;
+                *zp+=0.125*(c00[i0]+c00[i1]+c10[i0]+c10[i1]
+                           +c01[i0]+c01[i1]+c11[i0]+c11[i1]);
+            }
+        }
+    }
+}
+
+/** Carries out a multigrid V-cycle. The coarse levels start from a zero
+ * solution. */
+void mgs_fem_3d::v_cycle() {
+    if(nlev>1) {
+
+        // Propagate the residual down the hierarchy, smoothing at each step
+        residual(*lv);
+        for(int i=1;i<nlev;i++) {
+            mgs_level_3d &c=lv[i];
+            restrict_residual(lv[i-1],c);
+#pragma omp parallel for
+            for(int k=0;k<c.mno;k+=c.mn)
+                for(double *zp=c.z+k,*ze=zp+c.mn;zp<ze;zp++) *zp=0.;
+            if(i<nlev-1) {
+                gauss_seidel(c,mgs3_cyc_down);
+                residual(c);
+            }
+        }
+
+        // Carry out smoothing sweeps on the bottom level, and propagate the
+        // corrections up the hierarchy
+        gauss_seidel(lv[nlev-1],mgs3_cyc_bottom);
+        for(int i=nlev-1;i>0;i--) {
+            if(i<nlev-1) gauss_seidel(lv[i],mgs3_cyc_up);
+            interpolate(lv[i],lv[i-1]);
+        }
+    }
+
+    // Apply smoothing sweeps on the top level
+    gauss_seidel(*lv,mgs3_cyc_top);
+}
+
+/** Solves the linear system using multigrid V-cycles, predicting the number of
+ * V-cycles that are required from the previous solves in the same way as the
+ * two-dimensional multigrid library. */
+void mgs_fem_3d::solve_v_cycle() {
+    int nv=tp.lim/tp.mult,i;
+    double res;
+    for(i=0;i<nv;i++) v_cycle();
+    res=l2_error();
+
+    // If the tolerance is reached, then try to decrease the number of
+    // V-cycles for the next solve. Otherwise carry out more V-cycles,
+    // testing the residual after every triangular number of them.
+    if(res<acc) {
+        if(tp.lim>0) tp.lim-=1+tp.lim/tp.decay;
+    } else {
+        int k=0;
+        do {
+            tp.lim+=++k*tp.mult;
+            if(tp.lim>tp.max_thresh) {
+                fprintf(stderr,"V-cycle failed to converge in 3D FEM problem. "
+                        "Residual=%g not reached %g threshold after %d iterations\n",
+                        res,acc,nv);
+                exit(1);
+            }
+            nv+=k;
+            for(i=0;i<k;i++) v_cycle();
+            res=l2_error();
+        } while(res>=acc);
+    }
+    tp.add_iters(nv);
+    for(i=0;i<tp.extra_iters;i++) v_cycle();
+}
@@ -0,0 +1,132 @@
+#ifndef MGS_FEM_3D_HH
+#define MGS_FEM_3D_HH
+
+#include "tgmg_config.hh"
+#include "tgmg_predict.hh"
+
+/** Data for a single level of the 3D multigrid hierarchy. */
+struct mgs_level_3d {
+    /** The number of gridpoints in the x direction. */
+    int m;
+    /** The number of gridpoints in the y direction. */
+    int n;
+    /** The number of gridpoints in the z direction. */
+    int o;
+    /** The number of gridpoints in a z plane. */
+    int mn;
+    /** The total number of gridpoints. */
+    int mno;
+    /** The prefactors of the finite-element stiffness terms in the x, y,
+     * and z directions. */
+    double fx,fy,fz;
+    /** The entries of the finite-element stencil at interior gridpoints,
+     * for the central term, the face neighbors in each direction, the edge
+     * neighbors in each plane, and the corner neighbors. */
+    double s0,sx,sy,sz,sxy,sxz,syz,sxyz;
+    /** The solution array. */
+    double *z;
+    /** The source term array. */
+    double *b;
+    /** An array for the residual. */
+    double *r;
+};
+
+/** A class for solving the finite-element pressure projection problem of the
+ * 3D fluid simulation, using trilinear elements on cell corners. The linear
+ * system is solved with a geometric multigrid method. The coarse levels use
+ * the finite-element operator on a grid with double the spacing, which
+ * coincides with the Galerkin coarse operator for trilinear interpolation, so
+ * that no matrix entries need to be stored. Gauss--Seidel smoothing is
+ * parallelized over the z planes, by processing the even and odd planes in
+ * two separate passes. */
+class mgs_fem_3d {
+    public:
+        /** The number of gridpoints in the x direction. */
+        const int m;
+        /** The number of gridpoints in the y direction. */
+        const int n;
+        /** The number of gridpoints in the z direction. */
+        const int o;
+        /** The total number of gridpoints. */
+        const int mno;
+        /** Periodicity in the x direction. */
+        const bool x_prd;
+        /** Periodicity in the y direction. */
+        const bool y_prd;
+        /** Periodicity in the z direction. */
+        const bool z_prd;
+        /** The central term in the finite element stencil. */
+        const double fm;
+        /** Threshold on the mean squared residual to terminate the multigrid
+         * solve. */
+        const double acc;
+        /** The array holding the solution of the linear system (i.e. the
+         * fluid pressure). */
+        double* const z;
+        /** The number of levels in the multigrid hierarchy. */
+        int nlev;
+        /** A helper class that holds information for predicting the number
+         * of V-cycles that are required. */
+        tgmg_predict tp;
+        mgs_fem_3d(int m_,int n_,int o_,bool x_prd_,bool y_prd_,bool z_prd_,
+                   double fx,double fy,double fz,double *b);
+        ~mgs_fem_3d();
+        void solve_v_cycle();
+        void v_cycle();
+        double l2_error();
+        void clear_z();
+    private:
+        /** The levels of the multigrid hierarchy, with the finest first. */
+        mgs_level_3d lv[tgmg_max_levels];
+        bool coarsen(int &c,bool prd);
+        void set_stencil(mgs_level_3d &l);
+        double mul_a(mgs_level_3d &l,int i,int j,int k,double &dg);
+        /** Evaluates the product of the finite-element matrix with the
+         * solution at an interior gridpoint, whose neighbors are all
+         * within the grid without wrapping around.
+         * \param[in] l the level to consider.
+         * \param[in] w a pointer to the solution at the gridpoint.
+         * \return The component of the matrix-vector product, excluding the
+         *         central term. */
+        inline double mul_a_int(mgs_level_3d &l,double *w) {
+            const int s=l.m,t=l.mn;
+            return l.sx*(w[-1]+w[1])+l.sy*(w[-s]+w[s])+l.sz*(w[-t]+w[t])
+                  +l.sxy*(w[-s-1]+w[-s+1]+w[s-1]+w[s+1])
+                  +l.sxz*(w[-t-1]+w[-t+1]+w[t-1]+w[t+1])
+                  +l.syz*(w[-t-s]+w[-t+s]+w[t-s]+w[t+s])
+                  +l.sxyz*(w[-t-s-1]+w[-t-s+1]+w[-t+s-1]+w[-t+s+1]
+                          +w[t-s-1]+w[t-s+1]+w[t+s-1]+w[t+s+1]);
+        }
+        /** Determines whether the rows in a plane can use the interior
+         * stencil, apart from their first and last gridpoints.
+         * \param[in] l the level to consider.
+         * \param[in] (j,k) the indices of the row.
+         * \return Whether the interior stencil can be used. */
+        inline bool int_row(mgs_level_3d &l,int j,int k) {
+            return j>0&&j<l.n-1&&k>0&&k<l.o-1&&l.m>2;
+        }
+        void gauss_seidel(mgs_level_3d &l,int sweeps);
+        void gs_plane(mgs_level_3d &l,int k);
+        double residual(mgs_level_3d &l);
+        void restrict_residual(mgs_level_3d &l,mgs_level_3d &c);
+        void interpolate(mgs_level_3d &c,mgs_level_3d &l);
+        /** Computes the memory offsets to the neighbors of a gridpoint in
+         * one direction, and the type of the gridpoint for selecting the
+         * one-dimensional stencil factors. Offsets to neighbors that are
+         * outside a non-periodic domain are set to zero, since they are
+         * multiplied by zero stencil entries.
+         * \param[in] i the index of the gridpoint.
+         * \param[in] c the number of gridpoints in this direction.
+         * \param[in] prd the periodicity in this direction.
+         * \param[in] s the memory step in this direction.
+         * \param[out] d the offsets to the lower and upper neighbors.
+         * \return The gridpoint type. (0: interior, 1: lower wall, 2: upper
+         *         wall) */
+        inline int nbr(int i,int c,bool prd,int s,int *d) {
+            d[0]=i>0?-s:(prd?(c-1)*s:0);
+            d[1]=i<c-1?s:(prd?(1-c)*s:0);
+            return prd||(i>0&&i<c-1)?0:(i==0?1:2);
+        }
+};
+
+#endif
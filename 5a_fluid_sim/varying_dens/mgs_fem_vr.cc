@@ -5,7 +5,8 @@
 /** The constructor sets many internal constants from the parent fluid_2d
  * class.
  * \param[in] f a reference to the parent fluid_2d class. */
-mgs_fem_varying_rho::mgs_fem_varying_rho(fluid_2d &f) : m(f.m_fem), n(f.n_fem),
+template<class T>
+mgs_fem_varying_rho::mgs_fem_varying_rho(fluid_2d_t<T> &f) : m(f.m_fem), n(f.n_fem),
     mn(m*n), x_prd(f.x_prd), y_prd(f.y_prd), dydx(f.dy/f.dx), dxdy(f.dx/f.dy),
     fm(1./3.*(dxdy+dydx)), fm_inv(1.0/fm), fey(1./3.*(-2*dxdy+dydx)),
     hey(0.5*fey), fex(1./3.*(-2*dydx+dxdy)), hex(0.5*fex),
@@ -70,6 +71,8 @@ double mgs_fem_varying_rho::mul_a(int i,int ij) {
 }
 
 // Explicit instantiation
+template mgs_fem_varying_rho::mgs_fem_varying_rho(fluid_2d_t<double> &f);
+template mgs_fem_varying_rho::mgs_fem_varying_rho(fluid_2d_t<float> &f);
 #include "tgmg.cc"
 template class tgmg<mgs_fem_varying_rho,double,double>;
 template void tgmg_base<mgs_fem_varying_rho,double,double>
@@ -7,7 +7,7 @@
 
 #include "tgmg.hh"
 
-class fluid_2d;
+template<class T> class fluid_2d_t;
 
 struct mgs_fem_varying_rho {
     /** The number of gridpoints in the x direction. */
@@ -54,7 +54,8 @@ struct mgs_fem_varying_rho {
     /** An array for holding the reciprocal of the density field. */
     double* const irho;
     enum cell_center {dl,dr,ul,ur};
-    mgs_fem_varying_rho(fluid_2d &f);
+    template<class T>
+    mgs_fem_varying_rho(fluid_2d_t<T> &f);
     mgs_fem_varying_rho(int m_,int n_,bool x_prd_,bool y_prd_,double dx,double dy);
     ~mgs_fem_varying_rho();
     inline bool not_l(int i) {return x_prd||i>0;}
@@ -12,79 +12,93 @@
  * \param[in] (ay_,by_) the lower and upper y-coordinate simulation bounds. */
 fmm::fmm(const int m_,const int n_,const double ax_,const double bx_,
         const double ay_,const double by_)
-    : m(m_), n(n_), mn(m_*n_), ml(m+4), ax(ax_), ay(ay_), bx(bx_), by(by_),
-    dx((bx_-ax_)/m_), dy((by_-ay_)/n_), xsp(1/dx), ysp(1/dy), xxsp(xsp*xsp),
-    yysp(ysp*ysp), phibase(new phi_field[ml*(n+4)]), phim(phibase+2*ml+2),
-    w(1), mem(20*(m+n)), he(new phi_field*[mem]) {
+    : m(m_), n(n_), mn(m_*n_), ml((m+19)&~15), mlt(ml*(n+4)), ax(ax_), ay(ay_),
+    bx(bx_), by(by_), dx((bx_-ax_)/m_), dy((by_-ay_)/n_), xsp(1/dx), ysp(1/dy),
+    xxsp(xsp*xsp), yysp(ysp*ysp), phibase(new double[mlt]),
+    phim(phibase+2*ml+2), cs(new unsigned int[mlt>>4]), bp(new int[mlt]),
+    w(1), he(new fmm_heap_entry[mn+1]), nb(0), bh(NULL), ft(NULL) {
     setup_indicator_field();
 }
 
 /** The class destructor frees the dynamically allocated memory. */
 fmm::~fmm() {
-    delete [] buf;
+    if(ft!=NULL) {
+        delete [] rg;
+        delete [] rs;
+        delete [] ft;
+    }
+    if(bh!=NULL) {
+        delete [] bl;
+        delete [] bh;
+    }
+    delete [] he;
+    delete [] bp;
+    delete [] cs;
     delete [] phibase;
 }
 
 /** Initializes the simulation fields. */
 void fmm::init_fields() {
-    phi_field *fp=phim+10*ml+10;
-    fp->c=2;
-    fp->phi=0.;
+    int l=index(10,10);
+    set_status(l,2);
+    phibase[l]=0.;
 
 /*    mark_box(45,55,30,80);
     return;
 
     const int jl=4*n/10,ju=6*n/10;
     for(int j=jl;j<ju;j++) {
-        phi_field *fp=phim+ml*j+(m/2);
-        fp->c=2;
-        fp->phi=0;
+        int l=index(m/2,j);
+        set_status(l,2);
+        phibase[l]=0;
     }*/
 }
 
 /** Marks a box of points to be part of the boundary. */
 void fmm::mark_box(int il,int iu,int jl,int ju) {
     for(int j=jl;j<ju;j++) for(int i=il;i<iu;i++)
-        phim[j*ml+i].c=3;
+        set_status(index(i,j),3);
 }
 
 /** Initializes the heap by scanning over the grid and adding all the neighbors
  * of set points. */
 void fmm::init_heap() {
-    w=1;
+    clear_heap();
+
+    // If the order is being tracked, then reset the times of all points
+    if(ft!=NULL) {
+        for(int l=0;l<mlt;l++) ft[l]=status(l)==2?-sweep_inf:sweep_inf;
+        tf=-sweep_inf;
+    }
     for(int j=0;j<n;j++) {
-        for(int i=0;i<m;i++) {
-            phi_field *phip=phim+ml*j+i;
+        for(int l=index(0,j),le=l+m;l<le;l++) {
 
             // If this point's indicator is 2, then scan all of its neighbors
-            if(phip->c==2) add_neighbors(phip);
+            if(status(l)==2) add_neighbors(l);
         }
     }
 }
 
 /** Scans the neighbors of a grid point, and adds any empty ones to the heap.
- * \param[in] phip a pointer to the grid point to consider. */
-void fmm::add_neighbors(phi_field *phip) {
-
-    // Check that there is enough heap memory for four new pointers
-    if(w+4>mem) add_heap_memory();
+ * \param[in] l the index of the grid point to consider. */
+void fmm::add_neighbors(int l) {
 
     // Add any empty grid points to the heap
-    if(phip[-ml].c==0) add_to_heap(phip-ml);
-    if(phip[-1].c==0) add_to_heap(phip-1);
-    if(phip[1].c==0) add_to_heap(phip+1);
-    if(phip[ml].c==0) add_to_heap(phip+ml);
+    if(status(l-ml)==0) add_to_heap(l-ml);
+    if(status(l-1)==0) add_to_heap(l-1);
+    if(status(l+1)==0) add_to_heap(l+1);
+    if(status(l+ml)==0) add_to_heap(l+ml);
 }
 
 /** Calculates the value of the phi field at a given grid point.
- * \param[in] phip a pointer to the grid point to consider. */
-double fmm::calc_phi(phi_field *phip) {
+ * \param[in] l the index of the grid point to consider. */
+double fmm::calc_phi(int l) {
     double phiv,phih;
 
     // Look for available phi values in the horizontal and vertical directions,
     // finding the minimum
-    bool vert=phi_look(phip,ml,phiv),
-         horiz=phi_look(phip,1,phih);
+    bool vert=phi_look(l,ml,phiv),
+         horiz=phi_look(l,1,phih);
 
     // Compute the phi value. For the case when both horizontal and vertical
     // neighbors are available, we need
@@ -92,164 +106,574 @@ double fmm::calc_phi(phi_field *phip) {
                :(horiz?phih+dx:0);
 }
 
+/** Solves the quadratic update for a grid point that has both horizontal and
+ * vertical neighbors available. If the neighboring values differ by too much
+ * for a solution to exist, which can happen when the points are not set in
+ * strict order, then the smaller one-sided update is used instead.
+ * \param[in] phiv the vertical neighbor value.
+ * \param[in] phih the horizontal neighbor value.
+ * \return The updated value. */
 double fmm::phi_full(double phiv,double phih) {
     const double a=xxsp+yysp;
     double b=-phih*xxsp-phiv*yysp;
-    double c=phih*phih*xxsp+phiv*phiv*yysp-1;
-    return (-b+sqrt(b*b-a*c))/a;
+    double c=phih*phih*xxsp+phiv*phiv*yysp-1,disc=b*b-a*c;
+    return disc<0?min(phiv+dy,phih+dx):(-b+sqrt(disc))/a;
 }
 
 /** Finds the minimum set value of phi by comparing two adjacent neighbors.
- * \param[in] phip a pointer to the grid point to consider.
+ * The status of both neighbors is read from the status plane before any phi
+ * values are loaded.
+ * \param[in] l the index of the grid point to consider.
  * \param[in] d the memory step to the neighbors.
  * \param[out] phid the minimum set value, if available.
  * \return True if a value was found, false otherwise. */
-inline bool fmm::phi_look(phi_field *phip,int d,double &phid) {
-    if(phip[-d].c==2) {
-        phid=phip[d].c==2?min(phip[-d].phi,phip[d].phi)
-                         :phip[-d].phi;
+inline bool fmm::phi_look(int l,int d,double &phid) {
+    bool lo=status(l-d)==2,hi=status(l+d)==2;
+    if(lo) {
+        phid=hi?min(phibase[l-d],phibase[l+d]):phibase[l-d];
         return true;
-    } else if(phip[d].c==2) {
-        phid=phip[d].phi;
+    } else if(hi) {
+        phid=phibase[l+d];
         return true;
     }
     return false;
 }
 
 /** Adds a grid point to the heap.
- * \param[in] phip a pointer to the grid point to consider. */
-void fmm::add_to_heap(phi_field *phip) {
-    double tphi=calc_phi(phip);
+ * \param[in] l the index of the grid point to consider. */
+void fmm::add_to_heap(int l) {
+    double tphi=calc_phi(l);
+    if(bh!=NULL) {
+        bq_insert(l,tphi);
+        return;
+    }
 
     // Initially, the grid point will be placed at the top of the heap. Perform
     // swap operations until the heap property is restored.
     int c=w++,bc=c>>1;
-    while(bc>=1&&tphi<he[bc]->phi) {
-        he[bc]->bp=c;
+    while(bc>=1&&tphi<he[bc].phi) {
+        bp[he[bc].l]=c;
         he[c]=he[bc];
         c=bc;bc=c>>1;
     }
 
     // Set the information for the new point
-    he[c]=phip;
-    he[c]->bp=c;
-    he[c]->phi=tphi;
-    he[c]->c=1;
+    he[c].phi=tphi;he[c].l=l;
+    bp[l]=c;
+    phibase[l]=tphi;
+    set_status(l,1);
 }
 
-/** Adjusts the heap when a phi value may have decreased. */
-void fmm::trickle(phi_field *phip) {
-
-    // Compute the new phi value
-    double tphi=calc_phi(phip);
+/** Adjusts the heap when a phi value may have decreased.
+ * \param[in] l the index of the grid point to consider. */
+void fmm::trickle(int l) {
+
+    // Compute the new phi value. If the bucketed queue is in use, then move
+    // the point to a different bucket if needed.
+    double tphi=calc_phi(l);
+    if(bh!=NULL) {
+        if(static_cast<int>(tphi*bq_inv)!=bl[l].k) {
+            bq_remove(l);
+            bq_insert(l,tphi);
+        } else phibase[l]=tphi;
+        return;
+    }
 
     // If the phi value is smaller than the parent, then swap it with the parent
-    int c=phip->bp,bc=c>>1;
-    if(bc>=1&&tphi<he[bc]->phi) {
-        do {
-            he[bc]->bp=c;
-            he[c]=he[bc];
-            c=bc;bc=c>>1;
-        } while(bc>=1&&tphi<he[bc]->phi);
-        he[c]=phip;
-        he[c]->bp=c;
+    int c=bp[l],bc=c>>1;
+    while(bc>=1&&tphi<he[bc].phi) {
+        bp[he[bc].l]=c;
+        he[c]=he[bc];
+        c=bc;bc=c>>1;
     }
+    he[c].phi=tphi;he[c].l=l;
+    bp[l]=c;
 
     // Update the new phi value
-    he[c]->phi=tphi;
+    phibase[l]=tphi;
 }
 
 /** Performs the fast marching method. */
 void fmm::fast_march() {
-    phi_field *phip;
 
     // Initialize the heap, by finding neighbors of set points
     init_heap();
+    march(std::numeric_limits<double>::max());
+}
+
+/** Marches the front outward from the points on the heap, until the heap is
+ * empty or the smallest phi value on it exceeds a limit. Points that are left
+ * on the heap keep their tentative values.
+ * \param[in] lim the limit on phi. */
+void fmm::march(double lim) {
+    int l;
+    if(bh!=NULL) {
+        march_buckets(lim);
+        return;
+    }
 
     // Loop until the heap is non-empty, each time considering the point with
     // the smallest phi value
-    while(w>1) {
+    while(w>1&&he[1].phi<=lim) {
 
         // Change the status of the point with the smallest phi value to "set"
-        phip=he[1];
-        phip->c=2;
+        l=he[1].l;
+        set_status(l,2);
+        if(ft!=NULL) {
+            if(he[1].phi>tf) tf=he[1].phi;
+            ft[l]=tf;
+        }
 
         // Remove this point from the heap
         reduce_heap();
 
         // Check neighbors of this point, to see if they must be added to the
         // heap or have their phi values updated
-        if(w+4>mem) add_heap_memory();
-        update(phip-ml);update(phip-1);
-        update(phip+1);update(phip+ml);
+        update(l-ml);update(l-1);
+        update(l+1);update(l+ml);
     }
 }
 
 void fmm::reduce_heap() {
-    phi_field *phip=he[--w];
-    double &tphi=phip->phi;
+    fmm_heap_entry e=he[--w];
     int bc=1,c=bc<<1,cmin;
     while(c+1<w) {
-        if(he[c]->phi<tphi) {
-            cmin=he[c+1]->phi<he[c]->phi?c+1:c;
+        if(he[c].phi<e.phi) {
+            cmin=he[c+1].phi<he[c].phi?c+1:c;
         } else {
-            if(he[c+1]->phi<tphi) cmin=c+1;
+            if(he[c+1].phi<e.phi) cmin=c+1;
             else break;
         }
         he[bc]=he[cmin];
-        he[bc]->bp=bc;
+        bp[he[bc].l]=bc;
         bc=cmin;
         c=bc<<1;
     }
     if(c+1==w) {
-        if(he[c]->phi<tphi) {
+        if(he[c].phi<e.phi) {
             he[bc]=he[c];
-            he[bc]->bp=bc;
+            bp[he[bc].l]=bc;
             bc=c;
         }
     }
-    he[bc]=phip;
-    he[bc]->bp=bc;
+    he[bc]=e;
+    bp[e.l]=bc;
+}
+
+/** Removes a grid point from the heap, by moving the last entry into its
+ * position and restoring the heap property.
+ * \param[in] l the index of the grid point. */
+void fmm::remove_from_heap(int l) {
+    int c=bp[l],bc;
+    fmm_heap_entry e=he[--w];
+    if(c==w) return;
+
+    // Move the entry up if it is smaller than its new parent, or otherwise
+    // move it down
+    while(c>1&&e.phi<he[bc=c>>1].phi) {
+        he[c]=he[bc];
+        bp[he[c].l]=c;
+        c=bc;
+    }
+    while((bc=c<<1)<w) {
+        if(bc+1<w&&he[bc+1].phi<he[bc].phi) bc++;
+        if(!(he[bc].phi<e.phi)) break;
+        he[c]=he[bc];
+        bp[he[c].l]=c;
+        c=bc;
+    }
+    he[c]=e;
+    bp[e.l]=c;
 }
 
 /* Updates a grid point during the fast marching calculation. If it has never been
  * considered, it is added to the heap. If it is already marked, then its phi value
  * is updated.
- * \param[in] phip a pointer to the grid point to consider. */
-void fmm::update(phi_field *phip) {
-    if(phip->c==1) trickle(phip);
-    else if(phip->c==0) add_to_heap(phip);
+ * \param[in] l the index of the grid point to consider. */
+void fmm::update(int l) {
+    int c=status(l);
+    if(c==1) trickle(l);
+    else if(c==0) add_to_heap(l);
 }
 
 /** Sets up the indicator field that marks the status of the grid points during
- * the fast march. */
+ * the fast march. All points are first marked as boundary points, including
+ * the padding at the end of each row, and then the primary grid is marked as
+ * empty. */
 void fmm::setup_indicator_field() {
-    phi_field *phip=phibase,*phie;
-    for(phie=phip+2*ml;phip<phie;phip++) phip->c=3;
-    while(phip<phibase+(n+2)*ml) {
-        (phip++)->c=3;(phip++)->c=3;
-        for(phie=phip+m;phip<phie;phip++) phip->c=0;
-        (phip++)->c=3;(phip++)->c=3;
+    memset(cs,0xff,(mlt>>4)*sizeof(unsigned int));
+    for(int j=0;j<n;j++) for(int l=index(0,j),le=l+m;l<le;l++) set_status(l,0);
+}
+
+/** Switches to a bucketed queue in place of the binary heap, following the
+ * untidy priority queue of Yatziv et al. (J. Comput. Phys. 212, 2006). The
+ * points are placed in buckets according to their phi values, and the
+ * buckets are processed in order, taking the points within each bucket in an
+ * arbitrary order. Each queue operation takes constant time, so that the
+ * march takes O(N) time, at the cost of an additional error that scales with
+ * the bucket width. The buckets are stored in a circular array that covers
+ * the range of tentative phi values on the front, and each bucket is a doubly
+ * linked list through an array of links that is allocated once for the whole
+ * grid.
+ * \param[in] bw the bucket width, as a fraction of the smaller grid spacing.
+ *               If zero, then 1/sqrt(2) is used. */
+void fmm::bucket_queue(double bw) {
+    if(bw<0) fatal_error("Bucket width must be positive",1);
+    if(bw==0) bw=M_SQRT1_2;
+    bw*=dx<dy?dx:dy;
+    bq_inv=1/bw;
+
+    // The tentative values on the front are within one grid spacing of the
+    // set values, which are within one bucket width of the current bucket.
+    // Allocate enough buckets to cover this range, plus a margin.
+    if(bh!=NULL) {
+        delete [] bl;
+        delete [] bh;
+    }
+    nb=static_cast<int>((dx>dy?dx:dy)*bq_inv)+3;
+    bh=new int[2*nb];
+    bt=bh+nb;
+    bl=new fmm_bucket_link[mlt];
+    bq_clear();
+}
+
+/** Empties the bucketed queue. */
+void fmm::bq_clear() {
+    for(int k=0;k<2*nb;k++) bh[k]=-1;
+    nq=0;
+}
+
+/** Adds a grid point to the bucketed queue.
+ * \param[in] l the index of the grid point.
+ * \param[in] tphi the tentative phi value of the point. */
+void fmm::bq_insert(int l,double tphi) {
+    phibase[l]=tphi;
+    set_status(l,1);
+    bq_link(l,static_cast<int>(tphi*bq_inv));
+}
+
+/** Adds a grid point to the end of the list for a bucket. If the bucket is
+ * before the current one, which can happen due to the untidy ordering, then
+ * the current bucket is moved back to it.
+ * \param[in] l the index of the grid point.
+ * \param[in] k the bucket number. */
+void fmm::bq_link(int l,int k) {
+    int s=k%nb;
+    bl[l].nx=-1;bl[l].pv=bt[s];bl[l].k=k;
+    if(bt[s]!=-1) bl[bt[s]].nx=l;else bh[s]=l;
+    bt[s]=l;
+    if(nq==0||k<cb) cb=k;
+    nq++;
+}
+
+/** Removes a grid point from the bucketed queue.
+ * \param[in] l the index of the grid point. */
+void fmm::bq_remove(int l) {
+    fmm_bucket_link &b=bl[l];
+    int s=b.k%nb;
+    if(b.pv==-1) bh[s]=b.nx;
+    else bl[b.pv].nx=b.nx;
+    if(b.nx==-1) bt[s]=b.pv;
+    else bl[b.nx].pv=b.pv;
+    nq--;
+}
+
+/** Marches the front outward using the bucketed queue, until the queue is
+ * empty or the smallest phi value on it exceeds a limit.
+ * \param[in] lim the limit on phi. */
+void fmm::march_buckets(double lim) {
+    int l;
+    while(nq>0) {
+
+        // Look for a point in the current bucket. Since the buckets are
+        // circular, points in later buckets may share the same list, and
+        // are skipped.
+        for(l=bh[cb%nb];l!=-1&&bl[l].k!=cb;l=bl[l].nx);
+        if(l==-1) {
+            if(++cb>lim*bq_inv) return;
+            continue;
+        }
+        bq_remove(l);
+
+        // Points in the final bucket that exceed the limit are moved to the
+        // next bucket, so that they are left on the queue
+        if(phibase[l]>lim) {
+            bq_link(l,cb+1);
+            continue;
+        }
+
+        // Change the status of the point to "set", and update its neighbors
+        set_status(l,2);
+        update(l-ml);update(l-1);
+        update(l+1);update(l+ml);
+    }
+}
+
+/** Enables tracking of the order in which the grid points are set during the
+ * fast march, which is needed for incremental updates. This must be called
+ * before fast_march. */
+void fmm::track_order() {
+    if(ft!=NULL) return;
+    ft=new double[mlt];
+    rs=new int[mlt];
+    for(int l=0;l<mlt;l++) {
+        ft[l]=sweep_inf;
+        rs[l]=-1;
     }
-    for(phie=phip+2*ml;phip<phie;phip++) phip->c=3;
+    nr=0;rmem=1024;
+    rg=new fmm_region_entry[rmem];
 }
 
-/** Doubles the size of the heap memory. */
-void fmm::add_heap_memory() {
+/** Updates the solution after obstacle points have been added or removed,
+ * giving the same result as a full recompute, but only recomputing the region
+ * that is affected. The points that depended on the new obstacles, found from
+ * the order in which the points were set, are invalidated along with the
+ * removed obstacles. The valid points that border this region are placed on
+ * the heap with their previous times as keys, and their status is set to
+ * boundary until they are removed from the heap, so that the region sees them
+ * in the same order as in a full recompute. If a point in the region is set
+ * with a new value before a bordering point, then that point may have a lower
+ * value too, and it is moved into the region. This requires the binary heap,
+ * and the order must have been tracked during the previous fast march. A grid
+ * point should not appear in both lists.
+ * \param[in] na the number of obstacle points to add.
+ * \param[in] add the indices of the grid points to add.
+ * \param[in] nr_ the number of obstacle points to remove.
+ * \param[in] rem the indices of the grid points to remove. */
+void fmm::update_obstacles(int na,const int *add,int nr_,const int *rem) {
+    if(ft==NULL) fatal_error("Order tracking is needed for incremental updates",1);
+    if(bh!=NULL) fatal_error("Incremental updates need the binary heap",1);
+    int k,l;
+
+    // Mark the new obstacle points, so that they are not placed in the
+    // region, but keep their previous values while the dependents are found
+    nr=0;
+    for(k=0;k<na;k++) {
+        l=add[k];
+        if(status(l)==2&&ft[l]==-sweep_inf)
+            fatal_error("Obstacle covers a source point",1);
+        if(status(l)!=3) rs[l]=-3;
+    }
 
-    // If the current allocation exceeds the total number of grid points, that indicates
-    // a problem, so exit with an error.
-    if(mem>m*n) {
-        fputs("Maximum heap memory allocation exceeded\n",stderr);
-        exit(1);
+    // Find all the points that depend on the new obstacles, using the list
+    // itself as the queue
+    for(k=0;k<na;k++) if(rs[add[k]]==-3&&status(add[k])==2) add_dependents(add[k]);
+    for(k=0;k<nr;k++) add_dependents(rg[k].l);
+
+    // Mark the new obstacle points, and add the removed obstacles to the
+    // region
+    for(k=0;k<na;k++) if(rs[l=add[k]]==-3) {
+        set_status(l,3);
+        ft[l]=sweep_inf;
+        rs[l]=-1;
+    }
+    for(k=0;k<nr_;k++) if(status(l=rem[k])==3&&rs[l]==-1)
+        add_region(l,sweep_inf,sweep_inf);
+
+    // Invalidate the region, and add the bordering points to the heap
+    clear_heap();
+    int nrr=nr;
+    for(k=0;k<nrr;k++) set_status(rg[k].l,0);
+    for(k=0;k<nrr;k++) {
+        l=rg[k].l;
+        add_pending(l-ml);add_pending(l-1);
+        add_pending(l+1);add_pending(l+ml);
     }
+    tf=-sweep_inf;
+    march_region();
 
-    // Allocate an array of double the size, and copy the contents of the
-    // current array into it
-    mem<<=1;
-    phi_field **nhe=new phi_field*[mem];
-    for(int i=0;i<w;i++) nhe[i]=he[i];
-    delete [] he;
+    // Reset the region list, and mark any points that could not be reached
+    for(k=0;k<nr;k++) {
+        rs[l=rg[k].l]=-1;
+        if(status(l)==0) ft[l]=sweep_inf;
+    }
+    nr=0;
+}
+
+/** Adds a grid point to the region list.
+ * \param[in] l the index of the grid point.
+ * \param[in] (po,to) the previous phi value and time of the point. */
+void fmm::add_region(int l,double po,double to) {
+    if(nr==rmem) add_region_memory();
+    rg[nr].l=l;
+    rg[nr].phi=po;
+    rg[nr].t=to;
+    rs[l]=nr++;
+}
+
+/** Doubles the memory allocated for the region list. */
+void fmm::add_region_memory() {
+    if(rmem>=mlt) fatal_error("Region list exceeded grid size",1);
+    fmm_region_entry *nrg=new fmm_region_entry[rmem<<1];
+    for(int k=0;k<rmem;k++) nrg[k]=rg[k];
+    delete [] rg;
+    rg=nrg;
+    rmem<<=1;
+}
+
+/** Adds the neighbors of a grid point that depend on it to the region list. A
+ * neighbor depends on the grid point if the point was set before it, and was
+ * the smaller of the two values in that direction. Ties are counted as
+ * dependencies.
+ * \param[in] l the index of the grid point. */
+void fmm::add_dependents(int l) {
+    const int d[4]={-ml,-1,1,ml};
+    for(int k=0;k<4;k++) {
+        int q=l+d[k],o=q+d[k];
+        if(rs[q]!=-1||status(q)!=2||ft[q]<=ft[l]) continue;
+        if(status(o)==2&&ft[o]<ft[q]&&phibase[o]<phibase[l]) continue;
+        add_region(q,phibase[q],ft[q]);
+    }
+}
+
+/** Adds a valid grid point that borders the region to the heap, with its
+ * previous time as the key, and marks it as a boundary point until it is
+ * removed from the heap.
+ * \param[in] l the index of the grid point. */
+void fmm::add_pending(int l) {
+    if(rs[l]!=-1||status(l)!=2) return;
+    add_region(l,phibase[l],ft[l]);
+    set_status(l,3);
+
+    int c=w++,bc=c>>1;
+    while(bc>=1&&ft[l]<he[bc].phi) {
+        bp[he[bc].l]=c;
+        he[c]=he[bc];
+        c=bc;bc=c>>1;
+    }
+    he[c].phi=ft[l];he[c].l=l;
+    bp[l]=c;
+}
+
+/** Moves a bordering grid point that is waiting on the heap into the region,
+ * and adds its own valid neighbors that have not yet been reached by the
+ * march as bordering points.
+ * \param[in] l the index of the grid point. */
+void fmm::reopen(int l) {
+    remove_from_heap(l);
+    set_status(l,0);
+    const int d[4]={-ml,-1,1,ml};
+    for(int k=0;k<4;k++) if(ft[l+d[k]]>=tf) add_pending(l+d[k]);
+}
+
+/** Marches the region during an incremental update. This follows the same
+ * steps as march, but also checks whether each point that is set affects
+ * its bordering neighbors. */
+void fmm::march_region() {
+    int l;
+    while(w>1) {
+
+        // Remove the point with the smallest key from the heap, and set its
+        // time
+        l=he[1].l;
+        bool pend=status(l)==3;
+        set_status(l,2);
+        if(he[1].phi>tf) tf=he[1].phi;
+        ft[l]=tf;
+        reduce_heap();
+
+        // If the point was in the region, then check whether the bordering
+        // points are affected by its new value. Points that were not
+        // previously reached have no previous value.
+        if(!pend) {
+            double po=sweep_inf,to=sweep_inf;
+            if(rs[l]>=0) {po=rg[rs[l]].phi;to=rg[rs[l]].t;}
+            check_pending(l,l-ml,po,to);check_pending(l,l-1,po,to);
+            check_pending(l,l+1,po,to);check_pending(l,l+ml,po,to);
+        }
+        update(l-ml);update(l-1);
+        update(l+1);update(l+ml);
+    }
+}
+
+const double fmm::sweep_inf=std::numeric_limits<double>::max();
+
+/** Solves for the phi field using the fast sweeping method, as an alternative
+ * to the fast marching method. The set points are held fixed, and the
+ * remaining points are repeatedly updated with Gauss--Seidel sweeps in the
+ * four diagonal orderings, until the largest change in a complete iteration
+ * falls below a tolerance. For parallelism, the grid is divided into tiles,
+ * and the tiles are processed in a wavefront along their anti-diagonals: each
+ * tile only depends on the tiles before it in the sweep direction, so the
+ * tiles on an anti-diagonal can be swept concurrently, and the result is
+ * identical to a serial sweep. The sweeps only read the status plane, and
+ * since each row starts on a word boundary of the status plane, the rows can
+ * be updated by different threads. After the solve, the points that were
+ * reached are marked as set.
+ * \param[in] tol the tolerance on the largest change.
+ * \param[in] max_iters the maximum number of iterations.
+ * \return The number of iterations, or -1 if the tolerance was not
+ *         reached. */
+int fmm::fast_sweep(double tol,int max_iters) {
+    const int ntx=(m+fmm_sweep_tile-1)/fmm_sweep_tile,
+              nty=(n+fmm_sweep_tile-1)/fmm_sweep_tile;
+    int it,j;
+
+    // Clear any points that are not set or boundary points
+#pragma omp parallel for
+    for(j=0;j<n;j++) for(int l=index(0,j),le=l+m;l<le;l++)
+        if(status(l)<2) {phibase[l]=sweep_inf;set_status(l,0);}
+
+    for(it=1;it<=max_iters;it++) {
+        double dm=0;
+#pragma omp parallel
+        {
+            for(int o=0;o<4;o++) {
+                int sx=o&1?-1:1,sy=o&2?-1:1;
+
+                // Sweep the anti-diagonals of tiles in order, where the tile
+                // coordinates are measured along the sweep directions
+                for(int d=0;d<ntx+nty-1;d++) {
+                    int tl=d<nty?0:d-nty+1,tu=d<ntx?d:ntx-1;
+#pragma omp for schedule(dynamic) reduction(max:dm)
+                    for(int t=tl;t<=tu;t++)
+                        sweep_tile(sx>0?t:ntx-1-t,sy>0?d-t:nty-1-d+t,sx,sy,dm);
+                }
+            }
+        }
+        if(dm<tol) break;
+    }
+
+    // Mark the points that were reached as set
+#pragma omp parallel for
+    for(j=0;j<n;j++) for(int l=index(0,j),le=l+m;l<le;l++)
+        if(status(l)==0&&phibase[l]<sweep_inf) set_status(l,2);
+    return it>max_iters?-1:it;
+}
+
+/** Carries out a Gauss--Seidel sweep over a tile in the fast sweeping
+ * method.
+ * \param[in] (ti,tj) the tile coordinates.
+ * \param[in] (sx,sy) the sweep directions, either 1 or -1.
+ * \param[in,out] dm the largest change so far, which is updated. */
+void fmm::sweep_tile(int ti,int tj,int sx,int sy,double &dm) {
+    int i0=ti*fmm_sweep_tile,i1=i0+fmm_sweep_tile,
+        j0=tj*fmm_sweep_tile,j1=j0+fmm_sweep_tile;
+    if(i1>m) i1=m;
+    if(j1>n) j1=n;
+    if(sx<0) {int k=i0;i0=i1-1;i1=k-1;}
+    if(sy<0) {int k=j0;j0=j1-1;j1=k-1;}
+    for(int j=j0;j!=j1;j+=sy) for(int i=i0;i!=i1;i+=sx) {
+        int l=index(i,j);
+        if(status(l)!=0) continue;
+
+        // Compute the upwind update from the smallest neighbors in each
+        // direction, using the two-sided update only if the one-sided update
+        // exceeds both neighbors
+        double ph=sweep_look(l,1),pv=sweep_look(l,ml),tphi;
+        if(ph==sweep_inf) {
+            if(pv==sweep_inf) continue;
+            tphi=pv+dy;
+        } else if(pv==sweep_inf) tphi=ph+dx;
+        else {
+            tphi=min(ph+dx,pv+dy);
+            if(tphi>ph&&tphi>pv) tphi=phi_full(pv,ph);
+        }
+        if(tphi<phibase[l]) {
+            if(phibase[l]-tphi>dm) dm=phibase[l]-tphi;
+            phibase[l]=tphi;
+        }
+    }
 }
 
 /** Outputs a 2D array to a file in a format that can be read by Gnuplot.
@@ -261,19 +685,18 @@ void fmm::output(const char *filename,int mode) {
 
     // Output the first line of the file
     int i,j;
-    float *buf=new float[m+1],*bp=buf+1,*be=bp+m;
+    float *buf=new float[m+1],*fp=buf+1,*be=fp+m;
     *buf=m;
-    for(i=0;i<m;i++) *(bp++)=ax+(i+0.5)*dx;
+    for(i=0;i<m;i++) *(fp++)=ax+(i+0.5)*dx;
     fwrite(buf,sizeof(float),m+1,outf);
 
     // Output the field values to the file
-    phi_field *phir=phim;
-    for(j=0;j<m;j++,phir+=ml) {
-        phi_field *phip=phir;
-        *buf=ay+(j+0.5)*dy;bp=buf+1;
+    for(j=0;j<m;j++) {
+        int l=index(0,j);
+        *buf=ay+(j+0.5)*dy;fp=buf+1;
         switch(mode) {
-            case 0: while(bp<be) *(bp++)=(phip++)->phi;break;
-            case 1: while(bp<be) *(bp++)=(phip++)->c;
+            case 0: while(fp<be) *(fp++)=phibase[l++];break;
+            case 1: while(fp<be) *(fp++)=status(l++);
         }
         fwrite(buf,sizeof(float),m+1,outf);
     }
@@ -286,24 +709,154 @@ void fmm::output(const char *filename,int mode) {
 /** Sets the boundary points to have a large phi value. */
 void fmm::set_boundary_phi() {
     const double phimax=1.05*sqrt((bx-ax)*(bx-ax)+(by-ay)*(by-ay));
-    for(int i=0;i<ml*(n+4);i++) if(phibase[i].c==3) phibase[i].phi=phimax;
+    for(int l=0;l<mlt;l++) if(status(l)==3) phibase[l]=phimax;
 }
 
-/** Integrates an ODE following the negative gradient.
+/** Integrates an ODE following the negative gradient, and prints the points
+ * along the path with the interpolated phi value and gradient.
  * \param[in] (x,y) the starting point. */
 void fmm::integrate_path(double x,double y) {
-    double dt=0.0001;
-    double p,gx,gy;
+    int k,max_pts=16*(m+n);
+    double p,gx,gy,*pts=new double[2*max_pts],*pp=pts;
+    if(!trace_path(x,y,max_pts,pts,k,0.))
+        fputs("# Path did not reach the source\n",stderr);
+    for(;pp<pts+2*k;pp+=2) {
+        p=bilinear(*pp,pp[1],gx,gy);
+        printf("%g %g %g %g %g\n",*pp,pp[1],p,gx,gy);
+    }
+    delete [] pts;
+}
+
+/** Traces the paths of steepest descent of the phi field from many starting
+ * points in parallel, storing the points along each path in a preallocated
+ * buffer.
+ * \param[in] np the number of paths.
+ * \param[in] xy the starting points, as consecutive (x,y) pairs.
+ * \param[in] max_pts the maximum number of points to store for each path.
+ * \param[out] pts the buffer for the points, with space for max_pts (x,y)
+ *                pairs for each path.
+ * \param[out] npts an array for the number of points stored for each path.
+ * \param[in] tol the tolerance on the local error of each step. If zero,
+ *                then a thousandth of the grid spacing is used.
+ * \return The number of paths that reached the source. */
+int fmm::trace_paths(int np,const double *xy,int max_pts,double *pts,
+                     int *npts,double tol) {
+    int q,nr=0;
+#pragma omp parallel for schedule(dynamic,16) reduction(+:nr)
+    for(q=0;q<np;q++)
+        if(trace_path(xy[2*q],xy[2*q+1],max_pts,pts+2*max_pts*q,npts[q],tol)) nr++;
+    return nr;
+}
+
+/** Traces a path of steepest descent of the phi field, using the adaptive
+ * third-order Runge--Kutta method of Bogacki and Shampine. The path is
+ * parameterized by arc length, and the step size is bounded by the grid
+ * spacing and by the remaining distance to the source. The path terminates
+ * when it comes within a tenth of a grid spacing of the source, and the
+ * error control is switched off within two grid spacings of it.
+ * \param[in] (x,y) the starting point.
+ * \param[in] max_pts the maximum number of points to store.
+ * \param[out] pts the buffer for the points, as consecutive (x,y) pairs.
+ * \param[out] k the number of points stored, including the starting point.
+ * \param[in] tol the tolerance on the local error of each step. If zero,
+ *                then a thousandth of the grid spacing is used.
+ * \return True if the path reached the source, false if it became stuck at
+ *         the domain edge, at an obstacle, or at a point where phi does not
+ *         decrease, or if it exceeded the maximum number of points. */
+bool fmm::trace_path(double x,double y,int max_pts,double *pts,int &k,
+                     double tol) {
+    const double hmax=min(dx,dy),hmin=1e-3*hmax,pend=0.1*(dx+dy);
+    double p,h=hmax,p4,x1,y1,k1x,k1y,k2x,k2y,k3x,k3y,k4x,k4y,ex,ey,err,fac;
+    bool ok;
+    if(tol<=0) tol=1e-3*hmax;
+
+    k=0;
+    if(max_pts<1) return false;
+    *pts=x;pts[1]=y;k=1;
+    if(!path_dir(x,y,p,k1x,k1y)) return p<=pend;
+    while(p>pend) {
+        if(k==max_pts) return false;
+        if(h>p) h=p;
+
+        // Take a step, reusing the final stage as the first stage of the
+        // next step
+        ok=path_dir(x+0.5*h*k1x,y+0.5*h*k1y,p4,k2x,k2y)&&
+           path_dir(x+0.75*h*k2x,y+0.75*h*k2y,p4,k3x,k3y);
+        if(ok) {
+            x1=x+h*((2/9.)*k1x+(1/3.)*k2x+(4/9.)*k3x);
+            y1=y+h*((2/9.)*k1y+(1/3.)*k2y+(4/9.)*k3y);
+            ok=x1>=ax&&x1<=bx&&y1>=ay&&y1<=by;
+        }
+        if(ok&&!path_dir(x1,y1,p4,k4x,k4y)) {
+            if(p4<=pend) {
+                pts[2*k]=x1;pts[2*k+1]=y1;k++;
+                return true;
+            }
+            ok=false;
+        }
+
+        // If a stage left the domain, entered a region of boundary points,
+        // or phi did not decrease, then retry with a smaller step
+        if(!ok||p4>=p) {
+            if(h<=hmin) return false;
+            h*=0.5;
+            if(h<hmin) h=hmin;
+            continue;
+        }
 
-    p=bilinear(x,y,gx,gy);
-    printf("%g %g %g %g %g\n",x,y,p,gx,gy);
+        // Estimate the local error, and reject the step if it is too large.
+        // Within two grid spacings of the source, the phi field has a kink
+        // that is not resolved by the interpolation, so the step is always
+        // accepted.
+        ex=h*((-5/72.)*k1x+(1/12.)*k2x+(1/9.)*k3x-0.125*k4x);
+        ey=h*((-5/72.)*k1y+(1/12.)*k2y+(1/9.)*k3y-0.125*k4y);
+        err=sqrt(ex*ex+ey*ey);
+        fac=err>0?0.9*pow(tol/err,1/3.):2;
+        if(err>tol&&h>hmin&&p>2*hmax) {
+            h*=fac<0.2?0.2:fac;
+            if(h<hmin) h=hmin;
+            continue;
+        }
 
-    while(p>0.1*(dx+dy)) {
-        x-=dt*gx;
-        y-=dt*gy;
-        p=bilinear(x,y,gx,gy);
-        printf("%g %g %g %g %g\n",x,y,p,gx,gy);
+        // Accept the step
+        x=x1;y=y1;p=p4;k1x=k4x;k1y=k4y;
+        pts[2*k]=x;pts[2*k+1]=y;k++;
+        h*=fac>2?2:fac;
+        if(h>hmax) h=hmax;
     }
+    return true;
+}
+
+/** Computes the bilinear interpolation of the phi field and of its gradient,
+ * where the gradient at the grid points is computed with centered
+ * differences. Unlike the gradient of the bilinear interpolant, this is
+ * continuous across the grid lines, which avoids zig-zagging when following
+ * the gradient along the bottom of a valley in the phi field. Boundary points
+ * are left out of the interpolation, with the weights of the other points
+ * rescaled, so that paths are not blocked by the large phi values of the
+ * boundary points when they pass close to an obstacle.
+ * \param[in] (x,y) the position.
+ * \param[out] p the interpolated phi value.
+ * \param[out] (gx,gy) the interpolated gradient. */
+void fmm::grad_interp(double x,double y,double &p,double &gx,double &gy) {
+    x=(x-ax)*xsp-0.5;y=(y-ay)*ysp-0.5;
+    int i=int(x+1)-1,j=int(y+1)-1;
+    if(i<0) i=0;else if(i>m-2) i=m-2;
+    if(j<0) j=0;else if(j>n-2) j=n-2;
+    x-=i;y-=j;
+
+    // Compute the bilinear weights, removing any boundary points
+    int l=index(i,j);
+    double *fp=phibase+l,w0=status(l)==3?0:(1-x)*(1-y),
+           w1=status(l+1)==3?0:x*(1-y),w2=status(l+ml)==3?0:(1-x)*y,
+           w3=status(l+ml+1)==3?0:x*y,ws=w0+w1+w2+w3;
+    if(ws==0) {p=*fp;gx=gy=0;return;}
+    ws=1/ws;w0*=ws;w1*=ws;w2*=ws;w3*=ws;
+
+    // Interpolate the fields
+    p=w0**fp+w1*fp[1]+w2*fp[ml]+w3*fp[ml+1];
+    gx=xsp*(w0*cdiff(l,1)+w1*cdiff(l+1,1)+w2*cdiff(l+ml,1)+w3*cdiff(l+ml+1,1));
+    gy=ysp*(w0*cdiff(l,ml)+w1*cdiff(l+1,ml)+w2*cdiff(l+ml,ml)+w3*cdiff(l+ml+1,ml));
 }
 
 double fmm::bilinear(double x,double y,double &gx,double &gy) {
@@ -311,14 +864,14 @@ double fmm::bilinear(double x,double y,double &gx,double &gy) {
     int i=int(x);
     int j=int(y);
     if(i<-1) i=-1;else if(i>=m) i=m-1;
-    if(j<-1) j=-1;else if(j>=n) i=n-1;
+    if(j<-1) j=-1;else if(j>=n) j=n-1;
 
     // Compute the tracer's fractional position with the grid cell
     x-=i;y-=j;
 
     // Compute tracer's new position
-    phi_field *fp=phim+(i+ml*j);
-    gx=xsp*((1-y)*(fp[1].phi-fp->phi)+y*(fp[ml+1].phi-fp[ml].phi));
-    gy=ysp*((1-x)*(fp[ml].phi-fp->phi)+x*(fp[ml+1].phi-fp[1].phi));
-    return (1-y)*(fp->phi*(1-x)+fp[1].phi*x)+y*(fp[ml].phi*(1-x)+fp[ml+1].phi*x);
+    double *fp=phim+(i+ml*j);
+    gx=xsp*((1-y)*(fp[1]-*fp)+y*(fp[ml+1]-fp[ml]));
+    gy=ysp*((1-x)*(fp[ml]-*fp)+x*(fp[ml+1]-fp[1]));
+    return (1-y)*(*fp*(1-x)+fp[1]*x)+y*(fp[ml]*(1-x)+fp[ml+1]*x);
 }
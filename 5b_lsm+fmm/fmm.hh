@@ -5,9 +5,49 @@
 #include <cstdlib>
 #include <cmath>
 
-#include "fields.hh"
+/** The side length of the square tiles that are used in the parallel fast
+ * sweeping method, in grid cells. */
+const int fmm_sweep_tile=32;
 
-/** A class to perform the fast marching method. */
+/** An entry on the binary heap, holding a copy of the tentative phi value so
+ * that the heap can be reordered without reading the phi plane. */
+struct fmm_heap_entry {
+    /** The tentative phi value. */
+    double phi;
+    /** The index of the grid point. */
+    int l;
+};
+
+/** The links of a grid point in the bucketed queue. The bucket number is
+ * kept alongside the links, since the two are read together when a bucket is
+ * scanned. */
+struct fmm_bucket_link {
+    /** The next grid point in the same bucket. */
+    int nx;
+    /** The previous grid point in the same bucket, or -1 for the first. */
+    int pv;
+    /** The bucket number, measured from phi=0 without wrapping around. */
+    int k;
+};
+
+/** A grid point in the region that is recomputed during an incremental
+ * update, together with the values that it had beforehand. */
+struct fmm_region_entry {
+    /** The index of the grid point. */
+    int l;
+    /** The previous phi value. */
+    double phi;
+    /** The previous time at which the point was set. */
+    double t;
+};
+
+/** A class to perform the fast marching method. The phi values, the status of
+ * each grid point, and the back pointers used by the queues are stored in
+ * separate arrays, since the march reads the status of the neighbors of each
+ * point far more often than it reads their phi values. The status takes two
+ * bits per grid point, packed into unsigned integers, so that the status plane
+ * is a thirty-second of the size of the phi plane. Grid points are referred
+ * to by their index in these arrays. */
 class fmm {
     public:
         /** The number of grid cells in the horizontal direction. */
@@ -16,8 +56,12 @@ class fmm {
         const int n;
         /** The total number of grid cells. */
         const int mn;
-        /** The memory step length, taking into account ghost point allocation. */
+        /** The memory step length, taking into account ghost point
+         * allocation, and rounded up to a multiple of sixteen so that each
+         * row starts on a word boundary of the status plane. */
         const int ml;
+        /** The total number of grid points including ghost points. */
+        const int mlt;
         /** The lower bound in the x direction. */
         const double ax;
         /** The lower bound in the y direction. */
@@ -38,10 +82,10 @@ class fmm {
         const double xxsp;
         /** The square inverse grid spacing in the y direction. */
         const double yysp;
-        /** An array containing the simulation fields. */
-        phi_field* const phibase;
-        /** A pointer to the (0,0) grid cell in the field array. */
-        phi_field* const phim;
+        /** An array containing the phi values. */
+        double* const phibase;
+        /** A pointer to the (0,0) grid cell in the phi array. */
+        double* const phim;
         fmm(const int m_,const int n_,const double ax_,const double bx_,
             const double ay_,const double by_);
         ~fmm();
@@ -49,32 +93,180 @@ class fmm {
         void mark_box(int il,int iu,int jl,int ju);
         void init_heap();
         void fast_march();
-        void add_neighbors(phi_field *phip);
-        void add_to_heap(phi_field *phip);
-        double calc_phi(phi_field *phip);
+        void march(double lim);
+        void bucket_queue(double bw=0.);
+        void track_order();
+        void update_obstacles(int na,const int *add,int nr_,const int *rem);
+        int fast_sweep(double tol=1e-12,int max_iters=1000);
+        /** Empties the heap, so that a front can be set up by calling
+         * add_neighbors on a chosen set of points. */
+        inline void clear_heap() {
+            w=1;
+            if(bh!=NULL) bq_clear();
+        }
+        /** Computes the index of a grid point.
+         * \param[in] (i,j) the coordinates of the grid point.
+         * \return The index. */
+        inline int index(int i,int j) {
+            return ml*(j+2)+i+2;
+        }
+        /** Returns the status of a grid point.
+         * \param[in] l the index of the grid point.
+         * \return The status. (0: empty, 1: on heap, 2: set, 3: boundary) */
+        inline int status(int l) {
+            return (cs[l>>4]>>((l&15)<<1))&3;
+        }
+        /** Sets the status of a grid point. Since sixteen grid points share
+         * each word of the status plane, this is not safe to call concurrently
+         * for grid points in the same row.
+         * \param[in] l the index of the grid point.
+         * \param[in] c the status. */
+        inline void set_status(int l,int c) {
+            int s=(l&15)<<1;
+            cs[l>>4]=(cs[l>>4]&~(3u<<s))|(static_cast<unsigned int>(c)<<s);
+        }
+        void add_neighbors(int l);
+        void add_to_heap(int l);
+        double calc_phi(int l);
         double phi_full(double phiv,double phih);
         void setup_indicator_field();
-        void trickle(phi_field *phip);
-        void update(phi_field *phip);
+        void trickle(int l);
+        void update(int l);
         void reduce_heap();
+        void remove_from_heap(int l);
         void set_boundary_phi();
         void integrate_path(double x,double y);
+        int trace_paths(int np,const double *xy,int max_pts,double *pts,
+                        int *npts,double tol=0.);
+        bool trace_path(double x,double y,int max_pts,double *pts,int &k,
+                        double tol);
         double bilinear(double x,double y,double &gx,double &gy);
         void output(const char *filename,int mode);
     private:
         inline double min(double a,double b) {
             return a<b?a:b;
         }
-        void add_heap_memory();
-        inline bool phi_look(phi_field *phip,int d,double &phid);
+        inline bool phi_look(int l,int d,double &phid);
+        /** The status plane, with two bits per grid point. */
+        unsigned int* const cs;
+        /** The back pointers, giving the position of each grid point on the
+         * heap. */
+        int* const bp;
         /** The heap counter, equal to the number of elements minus one. */
         int w;
-        /** The current memory allocation for the heap. */
-        int mem;
-        /** The heap entries, which are pointers to the main grid. */
-        phi_field** he;
-        /** Temporary storage for used during the output routine. */
-        float *buf;
+        /** The heap entries. Since each grid point can be on the heap at
+         * most once, this is allocated with one entry per grid point. */
+        fmm_heap_entry* const he;
+        /** The number of buckets in the bucketed queue, or zero if the
+         * binary heap is in use. */
+        int nb;
+        /** The index of the current bucket, measured from phi=0 without
+         * wrapping around. */
+        int cb;
+        /** The number of grid points in the bucketed queue. */
+        int nq;
+        /** The inverse width of the buckets. */
+        double bq_inv;
+        /** The first grid point in each bucket, or -1 if the bucket is
+         * empty. */
+        int *bh;
+        /** The last grid point in each bucket, or -1 if the bucket is
+         * empty. */
+        int *bt;
+        /** The bucket links for each grid point. */
+        fmm_bucket_link *bl;
+        void grad_interp(double x,double y,double &p,double &gx,double &gy);
+        /** Computes a centered difference of the phi field at a grid point.
+         * Next to a boundary point, a one-sided difference is used, and it is
+         * set to zero if following the negative gradient would lead into the
+         * boundary, so that paths slide along obstacles instead of becoming
+         * stuck on them.
+         * \param[in] l the index of the grid point.
+         * \param[in] d the memory step to the neighbors.
+         * \return The difference, which must be scaled by the inverse grid
+         *         spacing. */
+        inline double cdiff(int l,int d) {
+            bool lo=status(l-d)!=3,hi=status(l+d)!=3;
+            double q;
+            if(lo) {
+                if(hi) return 0.5*(phibase[l+d]-phibase[l-d]);
+                q=phibase[l]-phibase[l-d];
+                return q>0?q:0;
+            }
+            if(!hi) return 0;
+            q=phibase[l+d]-phibase[l];
+            return q<0?q:0;
+        }
+        /** Computes the direction of steepest descent of the phi field at
+         * a position, using bilinear interpolation of the gradient.
+         * \param[in] (x,y) the position.
+         * \param[out] p the interpolated phi value.
+         * \param[out] (vx,vy) the unit direction.
+         * \return False if the gradient vanishes, true otherwise. */
+        inline bool path_dir(double x,double y,double &p,double &vx,double &vy) {
+            grad_interp(x,y,p,vx,vy);
+            double g=vx*vx+vy*vy;
+            if(g<1e-12) return false;
+            g=-1/sqrt(g);vx*=g;vy*=g;
+            return true;
+        }
+        void sweep_tile(int ti,int tj,int sx,int sy,double &dm);
+        /** Finds the smallest value of the two neighbors of a grid point in
+         * one direction during the fast sweeping method, ignoring boundary
+         * points.
+         * \param[in] l the index of the grid point to consider.
+         * \param[in] d the memory step to the neighbors.
+         * \return The smallest value. */
+        inline double sweep_look(int l,int d) {
+            double p0=status(l-d)==3?sweep_inf:phibase[l-d],
+                   p1=status(l+d)==3?sweep_inf:phibase[l+d];
+            return p0<p1?p0:p1;
+        }
+        /** The value used for points that have not been reached during the
+         * fast sweeping method. */
+        static const double sweep_inf;
+        /** The times at which the grid points were set, given by the
+         * largest phi value that had been removed from the heap, or NULL if
+         * the order is not being tracked. Source points have the lowest
+         * possible time, and points that were never set have the highest. */
+        double *ft;
+        /** The current time of the march, when the order is being
+         * tracked. */
+        double tf;
+        /** The position of each grid point in the region list, or -1 if it
+         * is not in the region. */
+        int *rs;
+        /** The number of entries in the region list. */
+        int nr;
+        /** The allocated size of the region list. */
+        int rmem;
+        /** The region list, containing the grid points that are recomputed
+         * during an incremental update, and the valid points that border
+         * them. */
+        fmm_region_entry *rg;
+        void add_region(int l,double po,double to);
+        void add_region_memory();
+        void add_dependents(int l);
+        void add_pending(int l);
+        void reopen(int l);
+        void march_region();
+        /** Checks whether a neighbor of a grid point that has just been set
+         * during an incremental update is a pending boundary point that may
+         * be affected, and if so, reopens it. A pending point is unaffected
+         * if the grid point was set before it previously, with the same
+         * value.
+         * \param[in] l the index of the grid point that has been set.
+         * \param[in] q the index of the neighbor.
+         * \param[in] (po,to) the previous phi value and time of the grid
+         *                    point. */
+        inline void check_pending(int l,int q,double po,double to) {
+            if(rs[q]>=0&&status(q)==3&&!(to<ft[q]&&po==phibase[l])) reopen(q);
+        }
+        void march_buckets(double lim);
+        void bq_clear();
+        void bq_insert(int l,double tphi);
+        void bq_link(int l,int k);
+        void bq_remove(int l);
 };
 
 #endif
@@ -0,0 +1,465 @@
+#include <cstring>
+#include <climits>
+#include <limits>
+
+#include "common.hh"
+#include "fmm_3d.hh"
+
+/** Computes the total number of grid points including ghost points, checking
+ * that they can be referred to by 32-bit indices.
+ * \param[in] (m,n,o) the number of grid cells in each direction.
+ * \return The number of grid points. */
+static int fmm_3d_points(int m,int n,int o) {
+    double t=double(m+2)*(n+2)*(o+2);
+    if(t>INT_MAX) fatal_error("Grid too large for 32-bit indices",1);
+    return static_cast<int>(t);
+}
+
+/** The class constructor sets up constants that control the geometry, and
+ * dynamically allocates memory for the fields.
+ * \param[in] (m_,n_,o_) the number of grid points to use in the x, y, and z
+ *                       directions.
+ * \param[in] (ax_,bx_) the lower and upper x-coordinate simulation bounds.
+ * \param[in] (ay_,by_) the lower and upper y-coordinate simulation bounds.
+ * \param[in] (az_,bz_) the lower and upper z-coordinate simulation bounds. */
+fmm_3d::fmm_3d(const int m_,const int n_,const int o_,const double ax_,
+               const double bx_,const double ay_,const double by_,
+               const double az_,const double bz_)
+    : m(m_), n(n_), o(o_), ml(m_+2), mln(ml*(n_+2)),
+    mlt(fmm_3d_points(m_,n_,o_)), ax(ax_), ay(ay_), az(az_), bx(bx_), by(by_),
+    bz(bz_), dx((bx_-ax_)/m_), dy((by_-ay_)/n_), dz((bz_-az_)/o_),
+    xxsp(1/(dx*dx)), yysp(1/(dy*dy)), zzsp(1/(dz*dz)),
+    phibase(new double[mlt]), phim(phibase+mln+ml+1),
+    cs(new unsigned int[(mlt+15)>>4]), bp(new int[mlt]), w(1), mem(1024),
+    he(new fmm_heap_entry[mem]), nb(0), bh(NULL) {
+    setup_indicator_field();
+}
+
+/** The class destructor frees the dynamically allocated memory. */
+fmm_3d::~fmm_3d() {
+    if(bh!=NULL) {
+        delete [] bl;
+        delete [] bh;
+    }
+    delete [] he;
+    delete [] bp;
+    delete [] cs;
+    delete [] phibase;
+}
+
+/** Sets up the indicator field that marks the status of the grid points during
+ * the fast march. All points are first marked as boundary points, including
+ * the ghost layers, and then the primary grid is marked as empty. */
+void fmm_3d::setup_indicator_field() {
+    memset(cs,0xff,((mlt+15)>>4)*sizeof(unsigned int));
+    for(int k=0;k<o;k++) for(int j=0;j<n;j++)
+        for(int l=index(0,j,k),le=l+m;l<le;l++) set_status(l,0);
+}
+
+/** Marks a box of points to be part of the boundary.
+ * \param[in] (il,iu) the range of x indices, with the upper one excluded.
+ * \param[in] (jl,ju) the range of y indices, with the upper one excluded.
+ * \param[in] (kl,ku) the range of z indices, with the upper one excluded. */
+void fmm_3d::mark_box(int il,int iu,int jl,int ju,int kl,int ku) {
+    for(int k=kl;k<ku;k++) for(int j=jl;j<ju;j++) for(int i=il;i<iu;i++)
+        set_status(index(i,j,k),3);
+}
+
+/** Marks the grid points whose centers are inside a sphere to be part of the
+ * boundary.
+ * \param[in] (x,y,z) the center of the sphere.
+ * \param[in] r the radius of the sphere. */
+void fmm_3d::mark_sphere(double x,double y,double z,double r) {
+    int il=int((x-r-ax)/dx),iu=int((x+r-ax)/dx)+1,
+        jl=int((y-r-ay)/dy),ju=int((y+r-ay)/dy)+1,
+        kl=int((z-r-az)/dz),ku=int((z+r-az)/dz)+1;
+    if(il<0) il=0;
+    if(iu>m) iu=m;
+    if(jl<0) jl=0;
+    if(ju>n) ju=n;
+    if(kl<0) kl=0;
+    if(ku>o) ku=o;
+    for(int k=kl;k<ku;k++) for(int j=jl;j<ju;j++) for(int i=il;i<iu;i++) {
+        double ex=ax+(i+0.5)*dx-x,ey=ay+(j+0.5)*dy-y,ez=az+(k+0.5)*dz-z;
+        if(ex*ex+ey*ey+ez*ez<r*r) set_status(index(i,j,k),3);
+    }
+}
+
+/** Sets a grid point to be a source with a given phi value.
+ * \param[in] (i,j,k) the coordinates of the grid point.
+ * \param[in] phi the phi value. */
+void fmm_3d::set_source(int i,int j,int k,double phi) {
+    int l=index(i,j,k);
+    set_status(l,2);
+    phibase[l]=phi;
+}
+
+/** Initializes the heap by scanning over the grid and adding all the neighbors
+ * of set points. */
+void fmm_3d::init_heap() {
+    clear_heap();
+    for(int k=0;k<o;k++) for(int j=0;j<n;j++)
+        for(int l=index(0,j,k),le=l+m;l<le;l++)
+            if(status(l)==2) add_neighbors(l);
+}
+
+/** Scans the neighbors of a grid point, and adds any empty ones to the heap.
+ * \param[in] l the index of the grid point to consider. */
+void fmm_3d::add_neighbors(int l) {
+    if(status(l-mln)==0) add_to_heap(l-mln);
+    if(status(l-ml)==0) add_to_heap(l-ml);
+    if(status(l-1)==0) add_to_heap(l-1);
+    if(status(l+1)==0) add_to_heap(l+1);
+    if(status(l+ml)==0) add_to_heap(l+ml);
+    if(status(l+mln)==0) add_to_heap(l+mln);
+}
+
+/** Finds the minimum set value of phi by comparing two adjacent neighbors.
+ * \param[in] l the index of the grid point to consider.
+ * \param[in] d the memory step to the neighbors.
+ * \param[out] phid the minimum set value, if available.
+ * \return True if a value was found, false otherwise. */
+inline bool fmm_3d::phi_look(int l,int d,double &phid) {
+    bool lo=status(l-d)==2,hi=status(l+d)==2;
+    if(lo) {
+        phid=hi&&phibase[l+d]<phibase[l-d]?phibase[l+d]:phibase[l-d];
+        return true;
+    } else if(hi) {
+        phid=phibase[l+d];
+        return true;
+    }
+    return false;
+}
+
+/** Calculates the value of the phi field at a given grid point, by solving
+ * the upwind discretization of the eikonal equation with up to three
+ * neighbors. The available directions are sorted by their neighbor values,
+ * and are included in turn, stopping once the solution does not exceed the
+ * next neighbor value, so that only the directions upwind of the solution
+ * are used.
+ * \param[in] l the index of the grid point to consider.
+ * \return The phi value. */
+double fmm_3d::calc_phi(int l) {
+    double p[3],s[3],a=0,b=0,c=-1,u=0,disc;
+    int k=0,q;
+
+    // Look for available phi values in each direction, and sort them in
+    // increasing order
+    if(phi_look(l,1,p[k])) s[k++]=xxsp;
+    if(phi_look(l,ml,p[k])) s[k++]=yysp;
+    if(phi_look(l,mln,p[k])) s[k++]=zzsp;
+    for(q=1;q<k;q++) for(int r=q;r>0&&p[r]<p[r-1];r--) {
+        double t=p[r];p[r]=p[r-1];p[r-1]=t;
+        t=s[r];s[r]=s[r-1];s[r-1]=t;
+    }
+
+    // Add the directions in order, solving the quadratic a*u^2-2*b*u+c=0 for
+    // each set
+    for(q=0;q<k;q++) {
+        a+=s[q];b+=s[q]*p[q];c+=s[q]*p[q]*p[q];
+        disc=b*b-a*c;
+        if(disc<0) break;
+        u=(b+sqrt(disc))/a;
+        if(q+1<k&&u<=p[q+1]) break;
+    }
+    return u;
+}
+
+/** Doubles the memory allocated for the heap. */
+void fmm_3d::add_heap_memory() {
+    if(mem>=mlt) fatal_error("Heap exceeded grid size",1);
+    fmm_heap_entry *nhe=new fmm_heap_entry[mem<<1];
+    memcpy(nhe,he,mem*sizeof(fmm_heap_entry));
+    delete [] he;
+    he=nhe;
+    mem<<=1;
+}
+
+/** Adds a grid point to the heap.
+ * \param[in] l the index of the grid point to consider. */
+void fmm_3d::add_to_heap(int l) {
+    double tphi=calc_phi(l);
+    if(bh!=NULL) {
+        bq_insert(l,tphi);
+        return;
+    }
+    if(w==mem) add_heap_memory();
+
+    // Initially, the grid point will be placed at the top of the heap. Perform
+    // swap operations until the heap property is restored.
+    int c=w++,bc=c>>1;
+    while(bc>=1&&tphi<he[bc].phi) {
+        bp[he[bc].l]=c;
+        he[c]=he[bc];
+        c=bc;bc=c>>1;
+    }
+
+    // Set the information for the new point
+    he[c].phi=tphi;he[c].l=l;
+    bp[l]=c;
+    phibase[l]=tphi;
+    set_status(l,1);
+}
+
+/** Adjusts the heap when a phi value may have decreased.
+ * \param[in] l the index of the grid point to consider. */
+void fmm_3d::trickle(int l) {
+
+    // Compute the new phi value. If the bucketed queue is in use, then move
+    // the point to a different bucket if needed.
+    double tphi=calc_phi(l);
+    if(bh!=NULL) {
+        if(static_cast<int>(tphi*bq_inv)!=bl[l].k) {
+            bq_remove(l);
+            bq_insert(l,tphi);
+        } else phibase[l]=tphi;
+        return;
+    }
+
+    // If the phi value is smaller than the parent, then swap it with the parent
+    int c=bp[l],bc=c>>1;
+    while(bc>=1&&tphi<he[bc].phi) {
+        bp[he[bc].l]=c;
+        he[c]=he[bc];
+        c=bc;bc=c>>1;
+    }
+    he[c].phi=tphi;he[c].l=l;
+    bp[l]=c;
+
+    // Update the new phi value
+    phibase[l]=tphi;
+}
+
+/** Performs the fast marching method. */
+void fmm_3d::fast_march() {
+
+    // Initialize the heap, by finding neighbors of set points
+    init_heap();
+    march(std::numeric_limits<double>::max());
+}
+
+/** Marches the front outward from the points on the heap, until the heap is
+ * empty or the smallest phi value on it exceeds a limit. Points that are left
+ * on the heap keep their tentative values.
+ * \param[in] lim the limit on phi. */
+void fmm_3d::march(double lim) {
+    int l;
+    if(bh!=NULL) {
+        march_buckets(lim);
+        return;
+    }
+
+    // Loop until the heap is non-empty, each time considering the point with
+    // the smallest phi value
+    while(w>1&&he[1].phi<=lim) {
+
+        // Change the status of the point with the smallest phi value to "set"
+        // and remove it from the heap
+        l=he[1].l;
+        set_status(l,2);
+        reduce_heap();
+
+        // Check neighbors of this point, to see if they must be added to the
+        // heap or have their phi values updated
+        update(l-mln);update(l-ml);update(l-1);
+        update(l+1);update(l+ml);update(l+mln);
+    }
+}
+
+/** Removes the top entry of the heap, and restores the heap property. */
+void fmm_3d::reduce_heap() {
+    fmm_heap_entry e=he[--w];
+    int bc=1,c=bc<<1,cmin;
+    while(c+1<w) {
+        if(he[c].phi<e.phi) {
+            cmin=he[c+1].phi<he[c].phi?c+1:c;
+        } else {
+            if(he[c+1].phi<e.phi) cmin=c+1;
+            else break;
+        }
+        he[bc]=he[cmin];
+        bp[he[bc].l]=bc;
+        bc=cmin;
+        c=bc<<1;
+    }
+    if(c+1==w) {
+        if(he[c].phi<e.phi) {
+            he[bc]=he[c];
+            bp[he[bc].l]=bc;
+            bc=c;
+        }
+    }
+    he[bc]=e;
+    bp[e.l]=bc;
+}
+
+/** Updates a grid point during the fast marching calculation. If it has never
+ * been considered, it is added to the heap. If it is already on the heap,
+ * then its phi value is updated.
+ * \param[in] l the index of the grid point to consider. */
+void fmm_3d::update(int l) {
+    int c=status(l);
+    if(c==1) trickle(l);
+    else if(c==0) add_to_heap(l);
+}
+
+/** Switches to a bucketed queue in place of the binary heap, using the same
+ * scheme as the 2D class.
+ * \param[in] bw the bucket width, as a fraction of the smallest grid spacing.
+ *               If zero, then 1/sqrt(3) is used. */
+void fmm_3d::bucket_queue(double bw) {
+    if(bw<0) fatal_error("Bucket width must be positive",1);
+    if(bw==0) bw=1/sqrt(3.);
+    double hmin=dx<dy?dx:dy,hmax=dx>dy?dx:dy;
+    if(dz<hmin) hmin=dz;
+    if(dz>hmax) hmax=dz;
+    bq_inv=1/(bw*hmin);
+
+    // The tentative values on the front are within one grid spacing of the
+    // set values, which are within one bucket width of the current bucket.
+    // Allocate enough buckets to cover this range, plus a margin.
+    if(bh!=NULL) {
+        delete [] bl;
+        delete [] bh;
+    }
+    nb=static_cast<int>(hmax*bq_inv)+3;
+    bh=new int[2*nb];
+    bt=bh+nb;
+    bl=new fmm_bucket_link[mlt];
+    bq_clear();
+}
+
+/** Empties the bucketed queue. */
+void fmm_3d::bq_clear() {
+    for(int k=0;k<2*nb;k++) bh[k]=-1;
+    nq=0;
+}
+
+/** Adds a grid point to the bucketed queue.
+ * \param[in] l the index of the grid point.
+ * \param[in] tphi the tentative phi value of the point. */
+void fmm_3d::bq_insert(int l,double tphi) {
+    phibase[l]=tphi;
+    set_status(l,1);
+    bq_link(l,static_cast<int>(tphi*bq_inv));
+}
+
+/** Adds a grid point to the end of the list for a bucket. If the bucket is
+ * before the current one, which can happen due to the untidy ordering, then
+ * the current bucket is moved back to it.
+ * \param[in] l the index of the grid point.
+ * \param[in] k the bucket number. */
+void fmm_3d::bq_link(int l,int k) {
+    int s=k%nb;
+    bl[l].nx=-1;bl[l].pv=bt[s];bl[l].k=k;
+    if(bt[s]!=-1) bl[bt[s]].nx=l;else bh[s]=l;
+    bt[s]=l;
+    if(nq==0||k<cb) cb=k;
+    nq++;
+}
+
+/** Removes a grid point from the bucketed queue.
+ * \param[in] l the index of the grid point. */
+void fmm_3d::bq_remove(int l) {
+    fmm_bucket_link &b=bl[l];
+    int s=b.k%nb;
+    if(b.pv==-1) bh[s]=b.nx;
+    else bl[b.pv].nx=b.nx;
+    if(b.nx==-1) bt[s]=b.pv;
+    else bl[b.nx].pv=b.pv;
+    nq--;
+}
+
+/** Marches the front outward using the bucketed queue, until the queue is
+ * empty or the smallest phi value on it exceeds a limit.
+ * \param[in] lim the limit on phi. */
+void fmm_3d::march_buckets(double lim) {
+    int l;
+    while(nq>0) {
+
+        // Look for a point in the current bucket, skipping points in later
+        // buckets that share the same list
+        for(l=bh[cb%nb];l!=-1&&bl[l].k!=cb;l=bl[l].nx);
+        if(l==-1) {
+            if(++cb>lim*bq_inv) return;
+            continue;
+        }
+        bq_remove(l);
+
+        // Points in the final bucket that exceed the limit are moved to the
+        // next bucket, so that they are left on the queue
+        if(phibase[l]>lim) {
+            bq_link(l,cb+1);
+            continue;
+        }
+
+        // Change the status of the point to "set", and update its neighbors
+        set_status(l,2);
+        update(l-mln);update(l-ml);update(l-1);
+        update(l+1);update(l+ml);update(l+mln);
+    }
+}
+
+/** Sets the boundary points to have a large phi value. */
+void fmm_3d::set_boundary_phi() {
+    const double phimax=1.05*sqrt((bx-ax)*(bx-ax)+(by-ay)*(by-ay)+(bz-az)*(bz-az));
+    for(int l=0;l<mlt;l++) if(status(l)==3) phibase[l]=phimax;
+}
+
+/** Returns the value to output for a grid point.
+ * \param[in] l the index of the grid point.
+ * \param[in] mode the field to output. (0: phi, 1: status)
+ * \return The value. */
+inline float fmm_3d::out_value(int l,int mode) {
+    return mode==0?phibase[l]:status(l);
+}
+
+/** Outputs the phi field or the status to a file in binary format. The file
+ * starts with three integers giving the dimensions of the field, followed by
+ * the values as floats, with the x index varying fastest.
+ * \param[in] filename the name of the file to write to.
+ * \param[in] mode the field to output. (0: phi, 1: status) */
+void fmm_3d::output(const char *filename,int mode) {
+    const int dims[3]={m,n,o};
+    FILE *outf=safe_fopen(filename,"wb");
+    fwrite(dims,sizeof(int),3,outf);
+
+    // Output the field values a row at a time
+    float *buf=new float[m];
+    for(int k=0;k<o;k++) for(int j=0;j<n;j++) {
+        int l=index(0,j,k);
+        for(float *fp=buf,*be=buf+m;fp<be;) *(fp++)=out_value(l++,mode);
+        fwrite(buf,sizeof(float),m,outf);
+    }
+
+    // Close the file and free the dynamically allocated memory
+    fclose(outf);
+    delete [] buf;
+}
+
+/** Outputs a z plane of the phi field or the status to a file in a format
+ * that can be read by Gnuplot, matching the 2D class.
+ * \param[in] filename the name of the file to write to.
+ * \param[in] mode the field to output. (0: phi, 1: status)
+ * \param[in] k the index of the plane. */
+void fmm_3d::output_slice(const char *filename,int mode,int k) {
+    FILE *outf=safe_fopen(filename,"wb");
+
+    // Output the first line of the file
+    float *buf=new float[m+1],*fp=buf+1,*be=fp+m;
+    *buf=m;
+    for(int i=0;i<m;i++) *(fp++)=ax+(i+0.5)*dx;
+    fwrite(buf,sizeof(float),m+1,outf);
+
+    // Output the field values to the file
+    for(int j=0;j<n;j++) {
+        int l=index(0,j,k);
+        *buf=ay+(j+0.5)*dy;fp=buf+1;
+        while(fp<be) *(fp++)=out_value(l++,mode);
+        fwrite(buf,sizeof(float),m+1,outf);
+    }
+
+    // Close the file and free the dynamically allocated memory
+    fclose(outf);
+    delete [] buf;
+}
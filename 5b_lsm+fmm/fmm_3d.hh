@@ -0,0 +1,148 @@
+#ifndef FMM_3D_HH
+#define FMM_3D_HH
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+
+#include "fmm.hh"
+
+/** A class to perform the fast marching method in three dimensions, using the
+ * same algorithm and storage scheme as the 2D class. The phi values, the
+ * status plane with two bits per grid point, and the heap back pointers are
+ * stored in separate arrays with the x index running fastest, followed by y
+ * and then z, with one ghost layer on each side that is marked as boundary.
+ * Grid points are referred to by 32-bit indices. Since the front of the march
+ * only covers a thin shell of the volume, the heap is allocated on demand
+ * rather than with one entry per grid point. */
+class fmm_3d {
+    public:
+        /** The number of grid cells in the x direction. */
+        const int m;
+        /** The number of grid cells in the y direction. */
+        const int n;
+        /** The number of grid cells in the z direction. */
+        const int o;
+        /** The memory step length in the y direction, taking into account
+         * ghost point allocation. */
+        const int ml;
+        /** The memory step length in the z direction, taking into account
+         * ghost point allocation. */
+        const int mln;
+        /** The total number of grid points including ghost points. */
+        const int mlt;
+        /** The lower bound in the x direction. */
+        const double ax;
+        /** The lower bound in the y direction. */
+        const double ay;
+        /** The lower bound in the z direction. */
+        const double az;
+        /** The upper bound in the x direction. */
+        const double bx;
+        /** The upper bound in the y direction. */
+        const double by;
+        /** The upper bound in the z direction. */
+        const double bz;
+        /** The grid spacing in the x direction. */
+        const double dx;
+        /** The grid spacing in the y direction. */
+        const double dy;
+        /** The grid spacing in the z direction. */
+        const double dz;
+        /** The square inverse grid spacing in the x direction. */
+        const double xxsp;
+        /** The square inverse grid spacing in the y direction. */
+        const double yysp;
+        /** The square inverse grid spacing in the z direction. */
+        const double zzsp;
+        /** An array containing the phi values. */
+        double* const phibase;
+        /** A pointer to the (0,0,0) grid cell in the phi array. */
+        double* const phim;
+        fmm_3d(const int m_,const int n_,const int o_,const double ax_,
+               const double bx_,const double ay_,const double by_,
+               const double az_,const double bz_);
+        ~fmm_3d();
+        void mark_box(int il,int iu,int jl,int ju,int kl,int ku);
+        void mark_sphere(double x,double y,double z,double r);
+        void set_source(int i,int j,int k,double phi=0.);
+        void init_heap();
+        void fast_march();
+        void march(double lim);
+        void bucket_queue(double bw=0.);
+        /** Empties the heap, so that a front can be set up by calling
+         * add_neighbors on a chosen set of points. */
+        inline void clear_heap() {
+            w=1;
+            if(bh!=NULL) bq_clear();
+        }
+        /** Computes the index of a grid point.
+         * \param[in] (i,j,k) the coordinates of the grid point.
+         * \return The index. */
+        inline int index(int i,int j,int k) {
+            return mln*(k+1)+ml*(j+1)+i+1;
+        }
+        /** Returns the status of a grid point.
+         * \param[in] l the index of the grid point.
+         * \return The status. (0: empty, 1: on heap, 2: set, 3: boundary) */
+        inline int status(int l) {
+            return (cs[l>>4]>>((l&15)<<1))&3;
+        }
+        /** Sets the status of a grid point.
+         * \param[in] l the index of the grid point.
+         * \param[in] c the status. */
+        inline void set_status(int l,int c) {
+            int s=(l&15)<<1;
+            cs[l>>4]=(cs[l>>4]&~(3u<<s))|(static_cast<unsigned int>(c)<<s);
+        }
+        void add_neighbors(int l);
+        void add_to_heap(int l);
+        double calc_phi(int l);
+        void trickle(int l);
+        void update(int l);
+        void reduce_heap();
+        void set_boundary_phi();
+        void output(const char *filename,int mode);
+        void output_slice(const char *filename,int mode,int k);
+    private:
+        inline bool phi_look(int l,int d,double &phid);
+        /** The status plane, with two bits per grid point. */
+        unsigned int* const cs;
+        /** The back pointers, giving the position of each grid point on the
+         * heap. */
+        int* const bp;
+        /** The heap counter, equal to the number of elements minus one. */
+        int w;
+        /** The number of heap entries that have been allocated. */
+        int mem;
+        /** The heap entries. */
+        fmm_heap_entry *he;
+        /** The number of buckets in the bucketed queue, or zero if the
+         * binary heap is in use. */
+        int nb;
+        /** The index of the current bucket, measured from phi=0 without
+         * wrapping around. */
+        int cb;
+        /** The number of grid points in the bucketed queue. */
+        int nq;
+        /** The inverse width of the buckets. */
+        double bq_inv;
+        /** The first grid point in each bucket, or -1 if the bucket is
+         * empty. */
+        int *bh;
+        /** The last grid point in each bucket, or -1 if the bucket is
+         * empty. */
+        int *bt;
+        /** The bucket links for each grid point. */
+        fmm_bucket_link *bl;
+        void add_heap_memory();
+        void setup_indicator_field();
+        void march_buckets(double lim);
+        void bq_clear();
+        void bq_insert(int l,double tphi);
+        void bq_link(int l,int k);
+        void bq_remove(int l);
+        float out_value(int l,int mode);
+};
+
+#endif
@@ -0,0 +1,71 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <ctime>
+
+#include "common.hh"
+#include "fmm_3d.hh"
+
+// Set up timing routine. If code was compiled with OpenMP, then use the
+// accurate wtime function. Otherwise use the clock function in the ctime
+// library.
+#ifdef _OPENMP
+#include "omp.h"
+inline double wtime() {return omp_get_wtime();}
+#else
+inline double wtime() {return double(clock())*(1./CLOCKS_PER_SEC);}
+#endif
+
+// The names of the available solution methods
+const char *method_names[2]={"fast marching (heap)","fast marching (buckets)"};
+
+int main(int argc,char **argv) {
+
+    // Check for command-line arguments
+    if(argc>4) {
+        fputs("Syntax: ./fmm_3d_test [method] [grid] [obstacle]\n\n"
+              "The method is 0 for fast marching with a binary heap (default),\n"
+              "or 1 for fast marching with a bucketed queue. The grid size\n"
+              "defaults to 64. The distance is computed from a point source in\n"
+              "the unit cube. If the obstacle flag is 1, then a sphere and a\n"
+              "slab are marked as a boundary; otherwise the errors compared to\n"
+              "the exact distance are reported. The solve time is written to\n"
+              "standard error. The volume is saved to phi3.out, and the plane\n"
+              "through the source is saved to phi3_slice.out.\n",stderr);
+        return 1;
+    }
+    int method=argc>=2?atoi(argv[1]):0,m=argc>=3?atoi(argv[2]):64;
+    bool obs=argc==4&&atoi(argv[3])==1;
+    if(method<0||method>1||m<8) fatal_error("Invalid test parameters",1);
+
+    fmm_3d f(m,m,m,0,1,0,1,0,1);
+    const int s=m/4;
+    f.set_source(s,s,s);
+    if(obs) {
+        f.mark_sphere(0.55,0.5,0.5,0.2);
+        f.mark_box(0,3*m/4,m/2,m/2+2,0,3*m/4);
+    }
+
+    // Solve for the distance field using the chosen method
+    if(method==1) f.bucket_queue();
+    double t0=wtime();
+    f.fast_march();
+    t0=wtime()-t0;
+    fprintf(stderr,"# %s: %g ms, %g ns per cell\n",method_names[method],1e3*t0,
+            1e9*t0/(double(m)*m*m));
+
+    // Compare to the exact distance from the source
+    if(!obs) {
+        double e,e_max=0,e_avg=0;
+        for(int k=0;k<m;k++) for(int j=0;j<m;j++) for(int i=0;i<m;i++) {
+            e=fabs(f.phibase[f.index(i,j,k)]-f.dx*sqrt(double((i-s)*(i-s)+(j-s)*(j-s)+(k-s)*(k-s))));
+            e_avg+=e;
+            if(e>e_max) e_max=e;
+        }
+        fprintf(stderr,"# Errors: maximum %g, mean %g\n",e_max,e_avg/(double(m)*m*m));
+    }
+
+    f.set_boundary_phi();
+    f.output("phi3.out",0);
+    f.output_slice("phi3_slice.out",0,s);
+}
@@ -0,0 +1,148 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <ctime>
+
+#include "common.hh"
+#include "fmm.hh"
+
+// Set up timing routine. If code was compiled with OpenMP, then use the
+// accurate wtime function. Otherwise use the clock function in the ctime
+// library.
+#ifdef _OPENMP
+#include "omp.h"
+inline double wtime() {return omp_get_wtime();}
+#else
+inline double wtime() {return double(clock())*(1./CLOCKS_PER_SEC);}
+#endif
+
+// The number of point sources, and their positions in the unit square
+const int n_src=3;
+const double src_x[n_src]={0.5,0.17,0.83};
+const double src_y[n_src]={0.5,0.81,0.26};
+
+/** The measurements from a single fast marching calculation. */
+struct bench_result {
+    /** The minimum wall clock time over the repetitions. */
+    double t;
+    /** The maximum error compared to the exact distance. */
+    double e_max;
+    /** The mean error compared to the exact distance. */
+    double e_avg;
+    /** The number of iterations, for the fast sweeping method. */
+    int iters;
+};
+
+/** Computes the exact distance from a grid cell to the nearest source.
+ * \param[in] f the fast marching class.
+ * \param[in] (i,j) the indices of the grid cell.
+ * \param[in] ns the number of sources.
+ * \return The distance. */
+double exact(fmm &f,int i,int j,int ns) {
+    double x=f.ax+(i+0.5)*f.dx,y=f.ay+(j+0.5)*f.dy,d=f.bx-f.ax+f.by-f.ay;
+    for(int s=0;s<ns;s++) {
+        double ex=x-src_x[s],ey=y-src_y[s],dd=sqrt(ex*ex+ey*ey);
+        if(dd<d) d=dd;
+    }
+    return d;
+}
+
+/** Sets the grid cells containing the sources to have their exact
+ * distances.
+ * \param[in] f the fast marching class.
+ * \param[in] ns the number of sources. */
+void seed(fmm &f,int ns) {
+    for(int s=0;s<ns;s++) {
+        int i=static_cast<int>(src_x[s]*f.m),j=static_cast<int>(src_y[s]*f.n);
+        int l=f.index(i,j);
+        f.set_status(l,2);
+        f.phibase[l]=exact(f,i,j,ns);
+    }
+}
+
+/** Solves for the distance field on a unit square, and measures the time and
+ * accuracy.
+ * \param[in] m the grid size.
+ * \param[in] ns the number of sources.
+ * \param[in] method the method to use. (0: fast marching with the binary
+ *                   heap, 1: fast marching with the bucketed queue, 2: fast
+ *                   sweeping)
+ * \param[in] bw the bucket width.
+ * \param[in] reps the number of repetitions.
+ * \param[out] br the measurements.
+ * \param[out] phi an array in which to store the computed distances. */
+void run(int m,int ns,int method,double bw,int reps,bench_result &br,double *phi) {
+    br.t=1e100;br.e_max=br.e_avg=0;br.iters=0;
+    for(int r=0;r<reps;r++) {
+        fmm f(m,m,0,1,0,1);
+        if(method==1) f.bucket_queue(bw);
+        seed(f,ns);
+        double t0=wtime();
+        if(method==2) br.iters=f.fast_sweep();
+        else f.fast_march();
+        t0=wtime()-t0;
+        if(t0<br.t) br.t=t0;
+
+        // On the first repetition, compute the errors and store the field
+        if(r==0) {
+            for(int j=0;j<m;j++) for(int i=0;i<m;i++) {
+                double p=f.phim[f.ml*j+i],e=fabs(p-exact(f,i,j,ns));
+                br.e_avg+=e;
+                if(e>br.e_max) br.e_max=e;
+                *(phi++)=p;
+            }
+            br.e_avg/=double(m)*m;
+        }
+    }
+}
+
+int main(int argc,char **argv) {
+
+    // Check for command-line arguments
+    if(argc<3||argc>5) {
+        fputs("Syntax: ./fmm_bench <min_grid> <max_grid> [bucket_width] [repeats]\n\n"
+              "Compares the fast marching method using the binary heap and the\n"
+              "bucketed queue, and the fast sweeping method, for grid sizes\n"
+              "doubling from the minimum to the maximum. The distance is\n"
+              "computed from one and from several point sources in the unit\n"
+              "square, and compared to the exact distance. The bucket width is\n"
+              "a fraction of the grid spacing, defaulting to 1/sqrt(2). The\n"
+              "results are written to standard output with one line per\n"
+              "configuration, and the times are the minimum over the\n"
+              "repetitions. The differences are measured from the fast marching\n"
+              "method with the binary heap.\n",stderr);
+        return 1;
+    }
+    int m_lo=atoi(argv[1]),m_hi=atoi(argv[2]),reps=argc==5?atoi(argv[4]):3;
+    double bw=argc>=4?atof(argv[3]):0;
+    if(m_lo<8||m_hi<m_lo||bw<0||reps<1)
+        fatal_error("Invalid benchmark parameters",1);
+
+    // Print the column headers
+    puts("# grid sources heap_ms bucket_ms sweep_ms sweep_iters heap_err_max "
+         "heap_err_avg bucket_err_max bucket_err_avg bucket_diff sweep_err_max "
+         "sweep_err_avg sweep_diff");
+
+    bench_result bh,bb,bs;
+    for(int m=m_lo;m<=m_hi;m<<=1) {
+        double *ph=new double[3*m*m],*pb=ph+m*m,*ps=pb+m*m;
+        for(int ns=1;ns<=n_src;ns+=n_src-1) {
+
+            // Run the calculation with each method, and find the largest
+            // differences from the binary heap
+            run(m,ns,0,bw,reps,bh,ph);
+            run(m,ns,1,bw,reps,bb,pb);
+            run(m,ns,2,bw,reps,bs,ps);
+            double mdb=0,mds=0;
+            for(int k=0;k<m*m;k++) {
+                if(fabs(ph[k]-pb[k])>mdb) mdb=fabs(ph[k]-pb[k]);
+                if(fabs(ph[k]-ps[k])>mds) mds=fabs(ph[k]-ps[k]);
+            }
+            printf("%d %d %g %g %g %d %g %g %g %g %g %g %g %g\n",m,ns,1e3*bh.t,
+                   1e3*bb.t,1e3*bs.t,bs.iters,bh.e_max,bh.e_avg,bb.e_max,bb.e_avg,
+                   mdb,bs.e_max,bs.e_avg,mds);
+            fflush(stdout);
+        }
+        delete [] ph;
+    }
+}
@@ -1,16 +1,121 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <ctime>
+
+#include "common.hh"
 #include "fmm.hh"
 
-int main() {
+// Set up timing routine. If code was compiled with OpenMP, then use the
+// accurate wtime function. Otherwise use the clock function in the ctime
+// library.
+#ifdef _OPENMP
+#include "omp.h"
+inline double wtime() {return omp_get_wtime();}
+#else
+inline double wtime() {return double(clock())*(1./CLOCKS_PER_SEC);}
+#endif
+
+// The names of the available solution methods
+const char *method_names[3]={"fast marching (heap)","fast marching (buckets)",
+                             "fast sweeping"};
+
+int main(int argc,char **argv) {
+
+    // Check for command-line arguments
+    if(argc>4) {
+        fputs("Syntax: ./fmm_test [method] [grid] [obstacle]\n\n"
+              "The method is 0 for fast marching with a binary heap (default),\n"
+              "1 for fast marching with a bucketed queue, or 2 for fast\n"
+              "sweeping. The grid size defaults to 128. If the obstacle flag\n"
+              "is 1, then a box is marked as a boundary. If it is 2, then the\n"
+              "box is also moved across the grid one cell at a time, updating\n"
+              "the solution incrementally, and each update is compared to a\n"
+              "full recompute; this needs the binary heap. A batch of paths to\n"
+              "the source is traced from a lattice of starting points. The\n"
+              "solve, update, and path tracing times are written to standard\n"
+              "error.\n",stderr);
+        return 1;
+    }
+    int method=argc>=2?atoi(argv[1]):0,m=argc>=3?atoi(argv[2]):128;
+    int obs=argc==4?atoi(argv[3]):0;
+    if(method<0||method>2||m<16||obs<0||obs>2||(obs==2&&method!=0))
+        fatal_error("Invalid test parameters",1);
 
-    fmm f(128,128,0,1,0,1);
+    fmm f(m,m,0,1,0,1);
+    const int il=45*m/128,iu=55*m/128,jl=30*m/128,ju=80*m/128;
 
     f.init_fields();
+    if(obs==2) f.track_order();
+    if(obs>0) f.mark_box(il,iu,jl,ju);
 
-    f.fast_march();
+    // Solve for the distance field using the chosen method
+    double t0=wtime();
+    if(method==2) {
+        int it=f.fast_sweep();
+        t0=wtime()-t0;
+        if(it<0) fatal_error("Fast sweeping did not converge",1);
+        fprintf(stderr,"# %s: %g ms, %d iterations\n",method_names[method],1e3*t0,it);
+    } else {
+        if(method==1) f.bucket_queue();
+        f.fast_march();
+        fprintf(stderr,"# %s: %g ms\n",method_names[method],1e3*(wtime()-t0));
+    }
+
+    // Move the box to the right, updating the solution incrementally. After
+    // each step, compare to a full recompute.
+    if(obs==2) {
+        const int steps=20*m/128;
+        int *add=new int[2*(ju-jl)],*rem=add+(ju-jl);
+        double ti=0,tr=0,md=0;
+        for(int s=0;s<steps;s++) {
+            for(int j=jl;j<ju;j++) {
+                add[j-jl]=f.index(iu+s,j);
+                rem[j-jl]=f.index(il+s,j);
+            }
+            t0=wtime();
+            f.update_obstacles(ju-jl,add,ju-jl,rem);
+            ti+=wtime()-t0;
+
+            fmm g(m,m,0,1,0,1);
+            g.init_fields();
+            g.mark_box(il+s+1,iu+s+1,jl,ju);
+            t0=wtime();
+            g.fast_march();
+            tr+=wtime()-t0;
+            for(int j=0;j<m;j++) for(int i=0;i<m;i++) {
+                int l=f.index(i,j);
+                if(f.status(l)!=g.status(l)) fatal_error("Status mismatch",1);
+                if(f.status(l)==2&&fabs(f.phibase[l]-g.phibase[l])>md)
+                    md=fabs(f.phibase[l]-g.phibase[l]);
+            }
+        }
+        fprintf(stderr,"# Moving box: %d steps, %g ms per update, %g ms per "
+                "recompute, max difference %g\n",steps,1e3*ti/steps,1e3*tr/steps,md);
+        delete [] add;
+    }
 
     f.set_boundary_phi();
     f.output("phi.out",0);
     f.output("ind.out",1);
 
+    // Trace a batch of paths from a lattice of starting points
+    const int pl=64,np=pl*pl,max_pts=4*m;
+    double *xy=new double[2*np],*pts=new double[2*np*max_pts];
+    int *npts=new int[np],tot=0;
+    for(int j=0;j<pl;j++) for(int i=0;i<pl;i++) {
+        xy[2*(i+pl*j)]=(i+0.5)/pl;
+        xy[2*(i+pl*j)+1]=(j+0.5)/pl;
+    }
+    t0=wtime();
+    int nr=f.trace_paths(np,xy,max_pts,pts,npts);
+    t0=wtime()-t0;
+    for(int q=0;q<np;q++) tot+=npts[q];
+    fprintf(stderr,"# Paths: %d of %d reached the source, %d points, %g ms\n",
+            nr,np,tot,1e3*t0);
+    delete [] npts;
+    delete [] pts;
+    delete [] xy;
+
     f.integrate_path(0.9,0.9);
 }
@@ -3,6 +3,7 @@
 
 #include "common.hh"
 #include "levelset.hh"
+#include "weno.hh"
 
 /** The class constructor sets up constants the control the geometry and the
  * simulation, dynamically allocates memory for the level set.
@@ -15,15 +16,27 @@
 levelset::levelset(const int m_,const int n_,const bool x_prd_,
         const bool y_prd_,const double ax_,const double bx_,
         const double ay_,const double by_,const char *filename_)
-    : m(m_), n(n_), mn(m_*n_), ml(m+4), x_prd(x_prd_), y_prd(y_prd_), ax(ax_),
+    : m(m_), n(n_), mn(m_*n_), ml(m+6), x_prd(x_prd_), y_prd(y_prd_), ax(ax_),
     ay(ay_), bx(bx_), by(by_), dx((bx_-ax_)/m_), dy((by_-ay_)/n_), xsp(1/dx),
     ysp(1/dy), xxsp(xsp*xsp), yysp(ysp*ysp), filename(filename_),
-    fbase(new field[ml*(n+4)]), fm(fbase+2*ml+2),
-    time(0.), f_num(0), oscillate_vel(false), buf(new float[m>123?m+5:128]) {}
+    fbase(new field[ml*(n+6)]), fm(fbase+3*ml+3),
+    pbase(new double[2*ml*(n+6)]), phim(pbase+3*ml+3), phin(phim+ml*(n+6)),
+    time(0.), f_num(0), oscillate_vel(false), use_weno(false),
+    tx((m_+ls_tile-1)/ls_tile), ty((n_+ls_tile-1)/ls_tile), ntl(0), reinit_k(0),
+    reinit_w(0.), nb_w(0.), nb_rebuilds(0), tmin(NULL), tact(NULL), tl(NULL),
+    rf(NULL), rpx(0), rpy(0), reinit_steps(0), reinits(0), reinit_time(0.),
+    buf(new float[ml+1>128?ml+1:128]) {}
 
 /** The class destructor frees the dynamically allocated memory. */
 levelset::~levelset() {
+    if(rf!=NULL) delete rf;
+    if(tact!=NULL) {
+        delete [] tl;
+        delete [] tact;
+        delete [] tmin;
+    }
     delete [] buf;
+    delete [] pbase;
     delete [] fbase;
 }
 
@@ -78,7 +91,11 @@ void levelset::choose_dt(double dt_pad,double adv_dt,bool verbose) {
     }
 }
 
-/** Initializes the simulation fields. */
+/** Initializes the simulation fields.
+ * \param[in] type the type of velocity field to use. (0: solid body
+ *                 rotation, 1: radially varying swirl)
+ * \param[in] oscillate_vel_ whether to oscillate the applied velocity field
+ *                           or not. */
 void levelset::init_fields(int type,bool oscillate_vel_) {
     oscillate_vel=oscillate_vel_;
 
@@ -87,7 +104,8 @@ void levelset::init_fields(int type,bool oscillate_vel_) {
     for(int j=0;j<n;j++) {
         double y=ay+dy*(j+0.5);
         field *fp=fm+ml*j;
-        for(int i=0;i<m;i++,fp++) {
+        double *pp=phim+ml*j;
+        for(int i=0;i<m;i++,fp++,pp++) {
             double x=ax+dx*(i+0.5);
             switch(type) {
                 case 0:
@@ -101,13 +119,95 @@ void levelset::init_fields(int type,bool oscillate_vel_) {
             }
             double yy=y-0.5;
             if(yy<-1) yy+=2;
-            fp->phi=sqrt(x*x+yy*yy)-0.3;
+            *pp=sqrt(x*x+yy*yy)-0.3;
         }
     }
 
     // Now that the primary grid points are set up, initialize the ghost
     // points according to the boundary conditions
     set_boundaries();
+
+    // If the narrow band mode is in use, then set up the band around the
+    // new zero contour
+    if(tact!=NULL) nb_init();
+}
+
+/** Switches on the narrow band mode, in which the level set function is only
+ * updated on a band of tiles around the zero contour. The band consists of the
+ * tiles that come within a given distance of the zero contour, plus one tile
+ * on each side, and it is rebuilt whenever the zero contour comes within this
+ * distance of a tile on its edge. The level set function is clamped to plus or
+ * minus this distance, so that the tiles outside the band hold constant values
+ * that remain consistent with the advected field when they are reactivated.
+ * \param[in] width the distance from the zero contour, in units of the
+ *                  larger grid spacing. This must exceed the stencil width of
+ *                  the advection scheme, so that the clamping does not affect
+ *                  the zero contour; a value of 8 gives results close to
+ *                  those on the full grid. */
+void levelset::narrow_band(double width) {
+    if(width<=0) fatal_error("Narrow band width must be positive",1);
+    nb_w=width*(dx>dy?dx:dy);
+    if(tact==NULL) {
+        tmin=new double[tx*ty];
+        tact=new unsigned char[tx*ty];
+        tl=new int[tx*ty];
+    }
+    nb_init();
+}
+
+/** Clamps the level set function to the band distance, computes the minimum
+ * absolute value in every tile, and builds the band. */
+void levelset::nb_init() {
+#pragma omp parallel for
+    for(int t=0;t<tx*ty;t++) {
+        int i0,i1,j0,j1;
+        double tm=std::numeric_limits<double>::max();
+        tile_range(t,i0,i1,j0,j1);
+        for(int j=j0;j<j1;j++)
+            for(double *pp=phim+ml*j+i0,*pe=phim+ml*j+i1;pp<pe;pp++) {
+                nb_clamp(*pp);
+                if(fabs(*pp)<tm) tm=fabs(*pp);
+            }
+        tmin[t]=tm;
+    }
+    set_boundaries();
+
+    // Since the inactive tiles are not updated during a step, they must hold
+    // the same values in both planes
+    memcpy(phin-3*ml-3,phim-3*ml-3,ml*(n+6)*sizeof(double));
+    nb_rebuild();
+}
+
+/** Rebuilds the band, activating all tiles that are within the band distance
+ * of the zero contour, plus their neighbors, and assembling the list of
+ * active tiles. The tiles that are deactivated are copied into the other
+ * plane of the level set function, so that both planes hold the same values
+ * on the inactive tiles. */
+void levelset::nb_rebuild() {
+    int t,i,j,di,dj,k,i0,i1,j0,j1;
+    memset(tact,0,tx*ty);
+    for(t=0;t<tx*ty;t++) if(tmin[t]<nb_w) {
+        i=t%tx;j=t/tx;
+        for(dj=-1;dj<=1;dj++) for(di=-1;di<=1;di++)
+            if((k=tile_index(i+di,j+dj))!=-1) tact[k]=1;
+    }
+    for(k=0;k<ntl;k++) if(!tact[t=tl[k]]) {
+        tile_range(t,i0,i1,j0,j1);
+        for(j=j0;j<j1;j++)
+            memcpy(phin+ml*j+i0,phim+ml*j+i0,(i1-i0)*sizeof(double));
+    }
+    for(ntl=t=0;t<tx*ty;t++) if(tact[t]) tl[ntl++]=t;
+    nb_rebuilds++;
+}
+
+/** Checks whether a tile has any inactive neighbors.
+ * \param[in] t the index of the tile.
+ * \return True if an inactive neighbor exists, false otherwise. */
+bool levelset::nb_edge(int t) {
+    int i=t%tx,j=t/tx,k;
+    for(int dj=-1;dj<=1;dj++) for(int di=-1;di<=1;di++)
+        if((k=tile_index(i+di,j+dj))!=-1&&!tact[k]) return true;
+    return false;
 }
 
 /** Carries out the simulation for a specified time interval using the direct
@@ -127,8 +227,12 @@ void levelset::solve(double duration,int frames) {
     // Loop over the output frames
     for(int k=1;k<=frames;k++) {
 
-        // Perform the simulation steps
-        for(int j=0;j<l;j++) step_forward(adt);
+        // Perform the simulation steps, reinitializing the level set
+        // function at the requested interval
+        for(int j=0;j<l;j++) {
+            step_forward(adt);
+            if(reinit_k>0&&++reinit_steps%reinit_k==0) reinitialize();
+        }
 
         // Output the fields
         t1=wtime();
@@ -136,7 +240,16 @@ void levelset::solve(double duration,int frames) {
 
         // Print diagnostic information
         t2=wtime();
-        printf("# Output frame %d [%d, %.8g s, %.8g s]\n",k,l,t1-t0,t2-t1);
+        printf("# Output frame %d [%d, %.8g s, %.8g s]",k,l,t1-t0,t2-t1);
+        if(tact!=NULL) {
+            printf(" {band %d/%d tiles, %d rebuilds}",ntl,tx*ty,nb_rebuilds);
+            nb_rebuilds=0;
+        }
+        if(reinit_k>0) {
+            printf(" {reinit %d, %.4g ms}",reinits,reinits>0?1e3*reinit_time/reinits:0);
+            reinits=0;reinit_time=0;
+        }
+        puts("");
         t0=t2;
     }
     f_num+=frames;
@@ -147,42 +260,244 @@ void levelset::solve(double duration,int frames) {
 void levelset::step_forward(double dt) {
     int j;
     double hx=0.5*dt*xsp,hy=0.5*dt*ysp,
-           ft=oscillate_vel?1:0.4*sin(time);
+           ft=oscillate_vel?0.4*sin(time):1;
+
+    if(tact!=NULL) nb_step(hx,hy,ft);
+    else {
+
+        // Compute the updated level set function in the other plane, and set
+        // its ghost points according to the boundary conditions as each row
+        // is completed
+#pragma omp parallel for
+        for(j=0;j<n;j++) {
+            field *fp=fm+ml*j;
+            double *pp=phim+ml*j,*pn=phin+ml*j,*pe=pn+m;
+            while(pn<pe) *(pn++)=phi_change(fp++,pp++,hx,hy,ft);
+            bc_row(phin,j);
+        }
+        swap_planes();
+    }
+    time+=dt;
+}
 
+/** Sets the level set function to be reinitialized to a signed distance
+ * function at a regular interval during the solve routine.
+ * \param[in] k the number of steps between reinitializations.
+ * \param[in] width the distance from the zero contour over which the signed
+ *                  distance is computed, in units of the larger grid spacing.
+ *                  In the narrow band mode, the band distance is used
+ *                  instead. */
+void levelset::reinitialization(int k,double width) {
+    if(k<1||width<=0) fatal_error("Invalid reinitialization parameters",1);
+    reinit_k=k;
+    reinit_w=width;
+}
+
+/** Reinitializes the level set function to a signed distance function, using
+ * the fast marching method. The grid cells next to the zero contour are given
+ * sub-cell accurate distances, and the front is marched outward from them on
+ * both sides at once, up to the reinitialization distance. The distances are
+ * written back with the sign of the level set function, and the cells beyond
+ * the reinitialization distance are set to plus or minus this distance. In
+ * the narrow band mode, only the active tiles are considered. */
+void levelset::reinitialize() {
+    double t0=wtime(),lim=tact!=NULL?nb_w:reinit_w*(dx>dy?dx:dy);
+    int q,nt=tact!=NULL?ntl:tx*ty;
+    if(lim<=0) fatal_error("Reinitialization distance not set",1);
+    rf_setup(lim);
+
+    // Compute the distances of the seed points next to the zero contour,
+    // marking the other points with a negative value, including the periodic
+    // images in the padding
+    double *rp=rf->phibase;
 #pragma omp parallel for
-    for(j=0;j<n;j++) for(int i=0;i<m;i++) {
-        field *fp=fm+(ml*j+i),&f=*fp;
-
-        // Compute advective terms using the second-order ENO scheme
-        double phix,phiy,uc=ft*f.u,vc=ft*f.v;
-        uc>0?vel_eno2(phix,hx,fp[1],f,fp[-1],fp[-2])
-            :vel_eno2(phix,-hx,fp[-1],f,fp[1],fp[2]);
-        vc>0?vel_eno2(phiy,hy,fp[ml],f,fp[-ml],fp[-2*ml])
-            :vel_eno2(phiy,-hy,fp[-ml],f,fp[ml],fp[2*ml]);
-
-        // Store the update to the level set field
-        f.cphi=-uc*phix-vc*phiy;
+    for(q=0;q<nt;q++) {
+        int i0,i1,j0,j1,k,ni,im[9];
+        tile_range(tact!=NULL?tl[q]:q,i0,i1,j0,j1);
+        for(int j=j0;j<j1;j++) for(int i=i0;i<i1;i++) {
+            double d=seed_dist(phim+(ml*j+i));
+            ni=rf_images(i,j,im);
+            for(k=0;k<ni;k++) rp[im[k]]=d;
+        }
     }
 
-    // Apply the update
+    // Mark the seed points as set and the other points as empty. Since the
+    // fast marching status plane packs several grid points into each word,
+    // this is done serially.
+    rf_status(nt,-1);
+
+    // Set up the front from the neighbors of the seed points, and march it
+    // outward
+    rf->clear_heap();
+    for(q=0;q<nt;q++) {
+        int i0,i1,j0,j1,k,ni,im[9];
+        tile_range(tact!=NULL?tl[q]:q,i0,i1,j0,j1);
+        for(int j=j0;j<j1;j++) for(int i=i0;i<i1;i++) {
+            ni=rf_images(i,j,im);
+            if(rf->status(*im)==2) for(k=0;k<ni;k++) rf->add_neighbors(im[k]);
+        }
+    }
+    rf->march(lim);
+
+    // Copy the distances back with the sign of the level set function
 #pragma omp parallel for
-    for(j=0;j<n;j++) {
-        field *fp=fm+j*ml,*fe=fp+m;
-        while(fp<fe) (fp++)->update();
+    for(q=0;q<nt;q++) {
+        int i0,i1,j0,j1,im[9];
+        tile_range(tact!=NULL?tl[q]:q,i0,i1,j0,j1);
+        for(int j=j0;j<j1;j++) for(int i=i0;i<i1;i++) {
+            double &p=phim[ml*j+i];
+            rf_images(i,j,im);
+            double d=rf->status(*im)==2?rp[*im]:lim;
+            p=p<0?-d:d;
+        }
     }
 
-    // Reset the ghost points according to the boundary conditions
+    // Mark the fast marching grid points as boundary points again
+    rf_status(nt,3);
     set_boundaries();
-    time+=dt;
+
+    // In the narrow band mode, update the minimum values in the active tiles
+    // and rebuild the band
+    if(tact!=NULL) {
+#pragma omp parallel for
+        for(q=0;q<ntl;q++) {
+            int i0,i1,j0,j1,t=tl[q];
+            double tm=std::numeric_limits<double>::max();
+            tile_range(t,i0,i1,j0,j1);
+            for(int j=j0;j<j1;j++)
+                for(double *pp=phim+ml*j+i0,*pe=phim+ml*j+i1;pp<pe;pp++)
+                    if(fabs(*pp)<tm) tm=fabs(*pp);
+            tmin[t]=tm;
+        }
+        nb_rebuild();
+    }
+    reinits++;
+    reinit_time+=wtime()-t0;
+}
+
+/** Allocates the fast marching grid for reinitialization if needed, with
+ * enough padding in the periodic directions to hold the periodic images
+ * within a given distance of the domain.
+ * \param[in] lim the distance. */
+void levelset::rf_setup(double lim) {
+    int px=x_prd?static_cast<int>(lim*xsp)+2:0,
+        py=y_prd?static_cast<int>(lim*ysp)+2:0;
+    if(px>m) px=m;
+    if(py>n) py=n;
+    if(rf!=NULL) {
+        if(px<=rpx&&py<=rpy) return;
+        delete rf;
+    }
+    rpx=px;rpy=py;
+    rf=new fmm(m+2*px,n+2*py,ax-px*dx,bx+px*dx,ay-py*dy,by+py*dy);
+    for(int l=0;l<rf->mlt;l++) rf->set_status(l,3);
+}
+
+/** Sets the status of the fast marching grid points that correspond to the
+ * grid cells considered during reinitialization, and their periodic images.
+ * \param[in] nt the number of tiles to consider.
+ * \param[in] c the status to set, or -1 to mark the points with a
+ *              non-negative phi value as set, and the others as empty. */
+void levelset::rf_status(int nt,int c) {
+    int i0,i1,j0,j1,k,ni,im[9];
+    for(int q=0;q<nt;q++) {
+        tile_range(tact!=NULL?tl[q]:q,i0,i1,j0,j1);
+        for(int j=j0;j<j1;j++) for(int i=i0;i<i1;i++) {
+            ni=rf_images(i,j,im);
+            for(k=0;k<ni;k++)
+                rf->set_status(im[k],c>=0?c:(rf->phibase[im[k]]<0?0:2));
+        }
+    }
+}
+
+/** Computes the distance from a grid cell to the zero contour if the contour
+ * passes within one grid spacing, using linear interpolation along the grid
+ * lines to find the crossings, and treating the contour as locally straight.
+ * \param[in] pp a pointer to the level set function at the grid cell.
+ * \return The distance, or -1 if the contour is not nearby. */
+double levelset::seed_dist(double *pp) {
+    double p=*pp;
+    if(p==0) return 0;
+    double thx=crossing(p,pp[-1],pp[1]),thy=crossing(p,pp[-ml],pp[ml]);
+    if(thx>1) return thy>1?-1:thy*dy;
+    if(thy>1) return thx*dx;
+    thx*=dx;thy*=dy;
+    return thx*thy/sqrt(thx*thx+thy*thy);
+}
+
+/** Steps the level set field forward on the active tiles of the narrow band.
+ * The updated values are written to the other plane and clamped to the band
+ * distance, and the minimum absolute value in each tile is computed in the
+ * same pass. After the planes are swapped, the band is rebuilt if the zero
+ * contour comes close to a tile on its edge.
+ * \param[in] (hx,hy) multipliers to apply to the computed derivatives.
+ * \param[in] ft the scale factor to apply to the velocity. */
+void levelset::nb_step(double hx,double hy,double ft) {
+    int q;
+    bool reb=false;
+#pragma omp parallel for reduction(||:reb)
+    for(q=0;q<ntl;q++) {
+        int i0,i1,j0,j1,t=tl[q];
+        double tm=std::numeric_limits<double>::max();
+        tile_range(t,i0,i1,j0,j1);
+        for(int j=j0;j<j1;j++) {
+            field *fp=fm+ml*j+i0;
+            double *pp=phim+ml*j+i0,*pn=phin+ml*j+i0,*pe=phin+ml*j+i1;
+            for(;pn<pe;pn++) {
+                *pn=phi_change(fp++,pp++,hx,hy,ft);
+                nb_clamp(*pn);
+                if(fabs(*pn)<tm) tm=fabs(*pn);
+            }
+        }
+        tmin[t]=tm;
+        if(tm<nb_w&&nb_edge(t)) reb=true;
+    }
+    swap_planes();
+    set_boundaries();
+    if(reb) nb_rebuild();
+}
+
+/** Computes the updated level set function at a grid point due to advection.
+ * \param[in] fp a pointer to the velocity at the grid point.
+ * \param[in] pp a pointer to the level set function at the grid point.
+ * \param[in] (hx,hy) multipliers to apply to the computed derivatives.
+ * \param[in] ft the scale factor to apply to the velocity.
+ * \return The updated value. */
+inline double levelset::phi_change(field *fp,double *pp,double hx,double hy,double ft) {
+
+    // Compute advective terms using the fifth-order WENO scheme or the
+    // second-order ENO scheme
+    double phix,phiy,uc=ft*fp->u,vc=ft*fp->v;
+    if(use_weno) {
+        phi_weno5(phix,2*hx,uc,pp,1);
+        phi_weno5(phiy,2*hy,vc,pp,ml);
+    } else {
+        uc>0?vel_eno2(phix,hx,pp[1],*pp,pp[-1],pp[-2])
+            :vel_eno2(phix,-hx,pp[-1],*pp,pp[1],pp[2]);
+        vc>0?vel_eno2(phiy,hy,pp[ml],*pp,pp[-ml],pp[-2*ml])
+            :vel_eno2(phiy,-hy,pp[-ml],*pp,pp[ml],pp[2*ml]);
+    }
+    return *pp+(-uc*phix-vc*phiy);
 }
 
 /** Calculates one-sided derivatives of the level set field using the
  * second-order ENO2 scheme.
  * \param[out] phid the computed ENO2 derivative.
  * \param[in] hs a multiplier to apply to the computed fields.
- * \param[in] (f0,f1,f2,f3) the fields to compute the derivative with. */
-inline void levelset::vel_eno2(double &phid,double hs,field &f0,field &f1,field &f2,field &f3) {
-    phid=hs*eno2(f0.phi,f1.phi,f2.phi,f3.phi);
+ * \param[in] (p0,p1,p2,p3) the values to compute the derivative with. */
+inline void levelset::vel_eno2(double &phid,double hs,double p0,double p1,double p2,double p3) {
+    phid=hs*eno2(p0,p1,p2,p3);
+}
+
+/** Calculates an upwinded derivative of the level set field using the
+ * fifth-order WENO scheme.
+ * \param[out] phid the computed WENO derivative.
+ * \param[in] hs a multiplier to apply to the computed fields.
+ * \param[in] c the velocity component in the direction of the derivative.
+ * \param[in] pp a pointer to the level set function at the grid point.
+ * \param[in] d the memory step in the direction of the derivative. */
+inline void levelset::phi_weno5(double &phid,double hs,double c,double *pp,int d) {
+    phid=hs*weno5_upwind(c,pp[-3*d],pp[-2*d],pp[-d],*pp,pp[d],pp[2*d],pp[3*d]);
 }
 
 /** Calculates the ENO derivative using a sequence of values at four
@@ -193,44 +508,40 @@ inline double levelset::eno2(double p0,double p1,double p2,double p3) {
     return fabs(p0-2*p1+p2)>fabs(p1-2*p2+p3)?3*p1-4*p2+p3:p0-p2;
 }
 
-/** Sets the fields in the ghost regions according to the boundary conditions.
- */
+/** Sets the ghost points of the current plane of the level set function
+ * according to the boundary conditions. */
 void levelset::set_boundaries() {
+#pragma omp parallel for
+    for(int j=0;j<n;j++) bc_row(phim,j);
+}
+
+/** Sets the ghost points of a row of a plane of the level set function
+ * according to the boundary conditions, and copies the row, including its
+ * ghost points, to any ghost row that depends on it. Each ghost point depends
+ * on exactly one row, so that the rows can be processed concurrently.
+ * \param[in] pr a pointer to the (0,0) grid cell in the plane.
+ * \param[in] j the index of the row. */
+void levelset::bc_row(double *pr,int j) {
+    double *pp=pr+ml*j;
 
     // Set left and right ghost values
     if(x_prd) {
-        for(field *fp=fm,*fe=fm+n*ml;fp<fe;fp+=ml) {
-            fp[-2].prd_bc(fp[m-2]);
-            fp[-1].prd_bc(fp[m-1]);
-            fp[m].prd_bc(*fp);
-            fp[m+1].prd_bc(fp[1]);
-        }
+        pp[-3]=pp[m-3];pp[-2]=pp[m-2];pp[-1]=pp[m-1];
+        pp[m]=*pp;pp[m+1]=pp[1];pp[m+2]=pp[2];
     } else {
-        for(field *fp=fm,*fe=fm+n*ml;fp<fe;fp+=ml) {
-            fp[-2].neu_bc(fp[1]);
-            fp[-1].neu_bc(*fp);
-            fp[m].neu_bc(fp[m-1]);
-            fp[m+1].neu_bc(fp[m-2]);
-        }
+        pp[-3]=pp[2];pp[-2]=pp[1];pp[-1]=*pp;
+        pp[m]=pp[m-1];pp[m+1]=pp[m-2];pp[m+2]=pp[m-3];
     }
 
-    // Set top and bottom ghost values
-    const int tl=2*ml,g=n*ml;
-    if(y_prd) {
-        for(field *fp=fm-2,*fe=fm+m+2;fp<fe;fp++) {
-            fp[-tl].prd_bc(fp[g-tl]);
-            fp[-ml].prd_bc(fp[g-ml]);
-            fp[g].prd_bc(*fp);
-            fp[g+ml].prd_bc(fp[ml]);
-        }
-    } else {
-        for(field *fp=fm-2,*fe=fm+m+2;fp<fe;fp++) {
-            fp[-tl].neu_bc(fp[ml]);
-            fp[-ml].neu_bc(*fp);
-            fp[g].neu_bc(fp[g-ml]);
-            fp[g+ml].neu_bc(fp[g-tl]);
-        }
-    }
+    // Copy the row to the top and bottom ghost rows that depend on it
+    if(j<3) memcpy(pr+ml*(y_prd?j+n:-1-j)-3,pp-3,ml*sizeof(double));
+    if(j>=n-3) memcpy(pr+ml*(y_prd?j-n:2*n-1-j)-3,pp-3,ml*sizeof(double));
+}
+
+/** Writes the level set field to the output directory.
+ * \param[in] k the frame number to append to the output. */
+void levelset::write_files(int k) {
+    output("phi",k);
 }
 
 /** Saves the header file.
@@ -246,15 +557,16 @@ void levelset::save_header(double duration, int frames) {
 
 /** Outputs the level set field to a file in a format that can be read by
  * Gnuplot.
+ * \param[in] prefix the field name to use as the filename prefix.
  * \param[in] sn the current frame number to append to the filename.
  * \param[in] ghost whether to output the ghost regions or not. */
-void levelset::output(const int sn,const bool ghost) {
+void levelset::output(const char *prefix,const int sn,const bool ghost) {
     int l=ghost?ml:m;
-    double disp=0.5-(ghost?2:0);
+    double disp=0.5-(ghost?3:0);
 
     // Assemble the output filename and open the output file
     char *bufc=((char*) buf);
-    sprintf(bufc,"%s/phi.%d",filename,prefix,sn);
+    sprintf(bufc,"%s/%s.%d",filename,prefix,sn);
     FILE *outf=safe_fopen(bufc,"wb");
 
     // Output the first line of the file
@@ -265,11 +577,11 @@ void levelset::output(const int sn,const bool ghost) {
     fwrite(buf,sizeof(float),l+1,outf);
 
     // Output the field values to the file
-    field *fr=ghost?fbase:fm;
-    for(j=0;j<l;j++,fr+=ml) {
-        field *fp=fr;
+    double *pr=ghost?phim-3*ml-3:phim;
+    for(j=0;j<l;j++,pr+=ml) {
+        double *pp=pr;
         *buf=ay+(j+disp)*dy;bp=buf+1;
-        while(bp<be) *(bp++)=(fp++)->phi;
+        while(bp<be) *(bp++)=*(pp++);
         fwrite(buf,sizeof(float),l+1,outf);
     }
 
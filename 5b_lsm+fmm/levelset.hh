@@ -8,6 +8,11 @@
 #include "omp.h"
 
 #include "fields.hh"
+#include "fmm.hh"
+
+/** The side length of the square tiles that are used to track the narrow
+ * band, in grid cells. */
+const int ls_tile=8;
 
 /** A class to carry out a simple level set simulation. */
 class levelset {
@@ -46,10 +51,19 @@ class levelset {
         const double yysp;
         /** The filename of the output directory. */
         const char *filename;
-        /** An array containing the simulation fields. */
+        /** An array containing the velocity fields. */
         field* const fbase;
         /** A pointer to the (0,0) grid cell in the field array. */
         field* const fm;
+        /** The memory for the two planes of the level set function. */
+        double* const pbase;
+        /** A pointer to the (0,0) grid cell in the current plane of the level
+         * set function. */
+        double *phim;
+        /** A pointer to the (0,0) grid cell in the other plane of the level
+         * set function, into which the updated values are written during a
+         * step before the planes are swapped. */
+        double *phin;
         /** The regular timestep to be used. */
         double dt_reg;
         /** The current simulation time. */
@@ -58,19 +72,38 @@ class levelset {
         int f_num;
 	/** Whether to oscillate the applied velocity field or not. */
 	bool oscillate_vel;
+        /** Whether to use the fifth-order WENO scheme for the advective
+         * terms, instead of the second-order ENO scheme. */
+        bool use_weno;
+        /** The number of tiles in the horizontal direction. */
+        const int tx;
+        /** The number of tiles in the vertical direction. */
+        const int ty;
+        /** The number of active tiles in the narrow band mode. */
+        int ntl;
+        /** The number of steps between reinitializations during the solve
+         * routine, or zero if the level set is not reinitialized. */
+        int reinit_k;
+        /** The distance from the zero contour over which the signed distance
+         * is computed during reinitialization, in units of the larger grid
+         * spacing. */
+        double reinit_w;
         levelset(const int m_,const int n_,const bool x_prd_,const bool y_prd_,
                  const double ax_,const double bx_,const double ay_,const double by_,
                  const char *filename_);
         ~levelset();
         void solve(double duration,int frames);
         void step_forward(double dt);
-        void init_fields(int type);
+        void init_fields(int type,bool oscillate_vel_=false);
         void write_files(int k);
         void initialize(int type,double dt_pad,double max_vel=-1);
         double advection_dt();
         void choose_dt(double dt_pad,double adv_dt,bool verbose=true);
         void output(const char *prefix,const int sn,const bool ghost=false);
         void save_header(double duration,int frames);
+        void narrow_band(double width);
+        void reinitialization(int k,double width);
+        void reinitialize();
         /** Chooses a timestep size that is the largest value smaller than dt_reg,
         * such that a given interval length is a perfect multiple of this timestep.
         * \param[in] interval the interval length to consider.
@@ -82,9 +115,114 @@ class levelset {
             return l;
         }
     private:
+        /** The distance from the zero contour within which a tile must be
+         * contained in the band, or zero if the narrow band mode is not
+         * used. */
+        double nb_w;
+        /** The number of times the band has been rebuilt in the current
+         * frame. */
+        int nb_rebuilds;
+        /** The minimum absolute value of the level set function in each
+         * tile. Since the inactive tiles are not updated, their entries
+         * remain valid. */
+        double *tmin;
+        /** The status of each tile, which is nonzero for active tiles. */
+        unsigned char *tact;
+        /** The list of active tiles. */
+        int *tl;
+        /** The fast marching class used for reinitialization, whose grid is
+         * padded with periodic images in the periodic directions. Outside
+         * of the reinitialization routine, all of its points are marked as
+         * boundary points. */
+        fmm *rf;
+        /** The number of padding cells in the fast marching grid in the
+         * horizontal and vertical directions. */
+        int rpx,rpy;
+        /** The number of steps taken since the start of the solve
+         * routine. */
+        int reinit_steps;
+        /** The number of reinitializations carried out in the current
+         * frame. */
+        int reinits;
+        /** The wall clock time spent on reinitializations in the current
+         * frame. */
+        double reinit_time;
+        void rf_setup(double lim);
+        void rf_status(int nt,int c);
+        double seed_dist(double *pp);
+        /** Finds the fast marching grid point of a grid cell, and of its
+         * periodic images in the padding.
+         * \param[in] (i,j) the indices of the grid cell.
+         * \param[out] im the indices of the grid points, starting with the
+         *                one for the cell itself.
+         * \return The number of grid points. */
+        inline int rf_images(int i,int j,int *im) {
+            int ii[3],jj[3],ni=1,nj=1,k=0;
+            *ii=i;*jj=j;
+            if(i<rpx) ii[ni++]=i+m;
+            if(i>=m-rpx) ii[ni++]=i-m;
+            if(j<rpy) jj[nj++]=j+n;
+            if(j>=n-rpy) jj[nj++]=j-n;
+            for(int b=0;b<nj;b++) for(int a=0;a<ni;a++)
+                im[k++]=rf->index(ii[a]+rpx,jj[b]+rpy);
+            return k;
+        }
+        /** Computes the fraction of a grid spacing to the nearest crossing of
+         * the zero contour along a line of three grid cells, using linear
+         * interpolation.
+         * \param[in] p the value at the central grid cell, which must be
+         *              nonzero.
+         * \param[in] (q0,q1) the values at the two neighboring cells.
+         * \return The fraction, or 2 if there is no crossing. */
+        inline double crossing(double p,double q0,double q1) {
+            double th=2;
+            if(p*q0<=0) th=p/(p-q0);
+            if(p*q1<=0&&p/(p-q1)<th) th=p/(p-q1);
+            return th;
+        }
+        void nb_init();
+        void nb_rebuild();
+        bool nb_edge(int t);
+        void nb_step(double hx,double hy,double ft);
+        /** Computes the range of grid cells covered by a tile.
+         * \param[in] t the index of the tile.
+         * \param[out] (i0,i1) the horizontal range of cells.
+         * \param[out] (j0,j1) the vertical range of cells. */
+        inline void tile_range(int t,int &i0,int &i1,int &j0,int &j1) {
+            i0=(t%tx)*ls_tile;i1=i0+ls_tile;if(i1>m) i1=m;
+            j0=(t/tx)*ls_tile;j1=j0+ls_tile;if(j1>n) j1=n;
+        }
+        /** Computes the index of a tile from its coordinates, taking into
+         * account periodicity.
+         * \param[in] (i,j) the tile coordinates.
+         * \return The index, or -1 if the tile is outside the domain. */
+        inline int tile_index(int i,int j) {
+            if(i<0||i>=tx) {
+                if(!x_prd) return -1;
+                i+=i<0?tx:-tx;
+            }
+            if(j<0||j>=ty) {
+                if(!y_prd) return -1;
+                j+=j<0?ty:-ty;
+            }
+            return i+tx*j;
+        }
+        /** Clamps a value of the level set function to the band distance.
+         * \param[in,out] phi the value to clamp. */
+        inline void nb_clamp(double &phi) {
+            if(phi>nb_w) phi=nb_w;
+            else if(phi<-nb_w) phi=-nb_w;
+        }
+        /** Swaps the two planes of the level set function. */
+        inline void swap_planes() {
+            double *t=phim;phim=phin;phin=t;
+        }
+        inline double phi_change(field *fp,double *pp,double hx,double hy,double ft);
         void set_boundaries();
-        inline void vel_eno2(double &phid,double hs,field &f0,field &f1,field &f2,field &f3);
+        void bc_row(double *pr,int j);
+        inline void vel_eno2(double &phid,double hs,double p0,double p1,double p2,double p3);
         inline double eno2(double p0,double p1,double p2,double p3);
+        inline void phi_weno5(double &phid,double hs,double c,double *pp,int d);
         inline double min(double a,double b) {return a<b?a:b;}
         inline double max(double a,double b) {return a>b?a:b;}
         /** Temporary storage for used during the output routine. */
@@ -0,0 +1,572 @@
+#include <cstring>
+#include <limits>
+
+#include "common.hh"
+#include "levelset_amr.hh"
+
+/** The class constructor sets up constants the control the geometry and the
+ * simulation, and creates the root blocks.
+ * \param[in] (nbx_,nby_) the number of root blocks to use in the horizontal
+ *                        and vertical directions.
+ * \param[in] lmax_ the finest refinement level.
+ * \param[in] (x_prd_,y_prd_) the periodicity in the x and y directions.
+ * \param[in] (ax_,bx_) the lower and upper x-coordinate simulation bounds.
+ * \param[in] (ay_,by_) the lower and upper y-coordinate simulation bounds.
+ * \param[in] filename_ the filename of the output directory. */
+levelset_amr::levelset_amr(const int nbx_,const int nby_,const int lmax_,
+        const bool x_prd_,const bool y_prd_,const double ax_,const double bx_,
+        const double ay_,const double by_,const char *filename_)
+    : nbx(nbx_), nby(nby_), lmax(lmax_), m((nbx_*lsa_bs)<<lmax_),
+    n((nby_*lsa_bs)<<lmax_), x_prd(x_prd_), y_prd(y_prd_), ax(ax_), ay(ay_),
+    bx(bx_), by(by_), dx((bx_-ax_)/m), dy((by_-ay_)/n), filename(filename_),
+    dt_reg(0.), time(0.), f_num(0), regrid_k(4), regrid_w(8.), nlf(0),
+    vtype(0), cur(0), nbk(0), bmem(nbx_*nby_>16?nbx_*nby_<<1:32),
+    bk(new lsa_block[bmem]), nfr(0), fr(new int[bmem]), lf(new int[bmem]),
+    regrid_steps(0), regrids(0), regrid_time(0.),
+    buf(new float[m>123?m+5:128]) {
+    if(nbx<1||nby<1||lmax<0||lmax>20)
+        fatal_error("Invalid adaptive grid dimensions",1);
+
+    // Create the root blocks, which are numbered in the same order as their
+    // positions
+    for(int j=0;j<nby;j++) for(int i=0;i<nbx;i++) new_block(0,i,j);
+    build_leaves();
+}
+
+/** The class destructor frees the dynamically allocated memory. */
+levelset_amr::~levelset_amr() {
+    for(int b=0;b<nbk;b++) {
+        delete [] bk[b].vel;
+        delete [] bk[b].phi;
+    }
+    delete [] buf;
+    delete [] lf;
+    delete [] fr;
+    delete [] bk;
+}
+
+/** Initializes the simulation, setting the velocity field, refining the grid
+ * around the initial zero contour, and choosing the timestep.
+ * \param[in] type the type of velocity field to use. (0: solid body
+ *                 rotation, 1: radially varying swirl)
+ * \param[in] dt_pad the padding factor for the timestep, which should be
+ *                   smaller than 1. */
+void levelset_amr::initialize(int type,double dt_pad) {
+    int b,q;
+    if(type<0||type>1) fatal_error("Invalid velocity field type",1);
+    vtype=type;
+    for(b=0;b<nbk;b++) if(bk[b].lev>=0) set_velocity(b);
+
+    // Refine the grid one level at a time, setting the level set function
+    // on the leaves before each regrid so that the refinement criterion is
+    // evaluated exactly
+    for(int l=0;l<=lmax;l++) {
+        for(q=0;q<nlf;q++) set_initial(lf[q]);
+        if(l<lmax) regrid();
+    }
+    regrids=0;regrid_time=0;
+
+    // Compute the advection timestep restriction on the finest level,
+    // sampling the velocity at the cell centers of the equivalent uniform
+    // grid so that it matches the levelset class
+    double adv_dt=0;
+#pragma omp parallel for reduction(max:adv_dt)
+    for(int j=0;j<n;j++) {
+        double u,v,t,y=ay+dy*(j+0.5);
+        for(int i=0;i<m;i++) {
+            velocity(ax+dx*(i+0.5),y,u,v);
+            t=fabs(u)/dx;if(t>adv_dt) adv_dt=t;
+            t=fabs(v)/dy;if(t>adv_dt) adv_dt=t;
+        }
+    }
+    adv_dt=adv_dt==0?std::numeric_limits<double>::max():1./adv_dt;
+    dt_reg=dt_pad*adv_dt;
+    printf("# Advection dt       : %g\n"
+           "# Padding factor     : %g\n"
+           "# Minimum dt         : %g\n"
+           "# Leaves             : %d (%.3g%% of finest cells)\n",
+           adv_dt,dt_pad,dt_reg,nlf,100.*cell_fraction());
+}
+
+/** Sets the interval and the band width for regridding during the solve
+ * routine. The band must be wide enough that the zero contour does not leave
+ * the finest level between regrids.
+ * \param[in] k the number of steps between regrids.
+ * \param[in] width the distance from the zero contour within which blocks
+ *                  are refined to the finest level, in units of the larger
+ *                  finest grid spacing. Blocks are coarsened when they are
+ *                  more than twice this distance away. */
+void levelset_amr::regridding(int k,double width) {
+    if(k<1||width<=0) fatal_error("Invalid regridding parameters",1);
+    regrid_k=k;
+    regrid_w=width;
+}
+
+/** Computes the velocity field at a position.
+ * \param[in] (x,y) the position.
+ * \param[out] (u,v) the velocity. */
+void levelset_amr::velocity(double x,double y,double &u,double &v) {
+    if(vtype==0) {u=y;v=-x;}
+    else {
+        double r=sqrt(x*x+y*y),fr=sin(4*M_PI*r);
+        u=fr*y;
+        v=-fr*x;
+    }
+}
+
+/** Computes the initial level set function at a position, which is the
+ * signed distance to a circle that is periodically wrapped in the y
+ * direction.
+ * \param[in] (x,y) the position.
+ * \return The level set function. */
+double levelset_amr::initial_phi(double x,double y) {
+    double yy=y-0.5;
+    if(yy<-1) yy+=2;
+    return sqrt(x*x+yy*yy)-0.3;
+}
+
+/** Sets the velocity at the cells of a block.
+ * \param[in] b the index of the block. */
+void levelset_amr::set_velocity(int b) {
+    lsa_block &k=bk[b];
+    double h=hx(k.lev),g=hy(k.lev),*up=k.vel,*vp=up+lsa_bs*lsa_bs;
+    for(int j=0;j<lsa_bs;j++) {
+        double y=ay+g*(k.bj*lsa_bs+j+0.5);
+        for(int i=0;i<lsa_bs;i++)
+            velocity(ax+h*(k.bi*lsa_bs+i+0.5),y,*(up++),*(vp++));
+    }
+}
+
+/** Sets the current plane of a block to the initial level set function.
+ * \param[in] b the index of the block. */
+void levelset_amr::set_initial(int b) {
+    lsa_block &k=bk[b];
+    double h=hx(k.lev),g=hy(k.lev),*p=plane(b,cur);
+    for(int j=0;j<lsa_bs;j++) {
+        double y=ay+g*(k.bj*lsa_bs+j+0.5);
+        for(int i=0;i<lsa_bs;i++)
+            p[i+lsa_bl*j]=initial_phi(ax+h*(k.bi*lsa_bs+i+0.5),y);
+    }
+}
+
+/** Creates a block, reusing one from the free list if possible.
+ * \param[in] lev the refinement level.
+ * \param[in] (bi,bj) the block coordinates at this level.
+ * \return The index of the block. */
+int levelset_amr::new_block(int lev,int bi,int bj) {
+    int b;
+    if(nfr>0) b=fr[--nfr];
+    else {
+        if(nbk==bmem) add_block_memory();
+        b=nbk++;
+        bk[b].phi=new double[2*lsa_bm];
+        bk[b].vel=new double[2*lsa_bs*lsa_bs];
+    }
+    lsa_block &k=bk[b];
+    k.lev=lev;k.bi=bi;k.bj=bj;
+    k.ch[0]=-1;k.pmin=0;
+    set_velocity(b);
+    return b;
+}
+
+/** Doubles the memory allocation for the blocks, the free list, and the
+ * leaf list. */
+void levelset_amr::add_block_memory() {
+    if(bmem>=1<<26) fatal_error("Block memory allocation exceeded",1);
+    lsa_block *nbk_=new lsa_block[bmem<<1];
+    memcpy(nbk_,bk,bmem*sizeof(lsa_block));
+    delete [] bk;
+    bk=nbk_;
+    int *nl=new int[bmem<<1];
+    memcpy(nl,fr,nfr*sizeof(int));
+    delete [] fr;
+    fr=nl;
+    nl=new int[bmem<<1];
+    memcpy(nl,lf,nlf*sizeof(int));
+    delete [] lf;
+    lf=nl;
+    bmem<<=1;
+}
+
+/** Marks a block as unused and adds it to the free list, keeping its memory
+ * for reuse.
+ * \param[in] b the index of the block. */
+void levelset_amr::free_block(int b) {
+    bk[b].lev=-1;
+    fr[nfr++]=b;
+}
+
+/** Assembles the list of leaves. */
+void levelset_amr::build_leaves() {
+    nlf=0;
+    for(int b=0;b<nbk;b++) if(bk[b].lev>=0&&bk[b].ch[0]==-1) lf[nlf++]=b;
+}
+
+/** Finds the block at a given level and position, or the leaf that covers it
+ * if the tree is not refined that far.
+ * \param[in] lev the level.
+ * \param[in] (bi,bj) the block coordinates at this level, which must be
+ *                    within the domain.
+ * \return The index of the block. */
+int levelset_amr::find(int lev,int bi,int bj) {
+    int b=(bi>>lev)+nbx*(bj>>lev);
+    for(int l=lev-1;l>=0&&bk[b].ch[0]!=-1;l--)
+        b=bk[b].ch[((bi>>l)&1)|(((bj>>l)&1)<<1)];
+    return b;
+}
+
+/** Maps the coordinates of a cell outside the domain back inside, by
+ * wrapping them in a periodic direction and reflecting them across the
+ * boundary otherwise.
+ * \param[in] lev the level.
+ * \param[in,out] (ci,cj) the cell coordinates at this level. */
+void levelset_amr::normalize(int lev,int &ci,int &cj) {
+    int nx=m>>(lmax-lev),ny=n>>(lmax-lev);
+    if(ci<0) ci=x_prd?ci+nx:-1-ci;
+    else if(ci>=nx) ci=x_prd?ci-nx:2*nx-1-ci;
+    if(cj<0) cj=y_prd?cj+ny:-1-cj;
+    else if(cj>=ny) cj=y_prd?cj-ny:2*ny-1-cj;
+}
+
+/** Evaluates the current level set function on a cell at a given level. If
+ * the cell is covered by finer leaves then their values are averaged, and if
+ * it is covered by a coarser leaf then the coarser values are bilinearly
+ * interpolated.
+ * \param[in] lev the level.
+ * \param[in] (ci,cj) the cell coordinates at this level, which may lie up to
+ *                    one domain width outside the domain.
+ * \return The value. */
+double levelset_amr::sample(int lev,int ci,int cj) {
+    normalize(lev,ci,cj);
+    int b=find(lev,ci/lsa_bs,cj/lsa_bs);
+    lsa_block &k=bk[b];
+    if(k.lev==lev) {
+        if(k.ch[0]==-1)
+            return plane(b,cur)[ci-k.bi*lsa_bs+lsa_bl*(cj-k.bj*lsa_bs)];
+        ci<<=1;cj<<=1;lev++;
+
+        // Average the four finer cells, which all lie in the same child
+        int c=k.ch[((ci/lsa_bs)&1)|(((cj/lsa_bs)&1)<<1)];
+        if(bk[c].ch[0]==-1) {
+            double *p=plane(c,cur)+ci-bk[c].bi*lsa_bs
+                     +lsa_bl*(cj-bk[c].bj*lsa_bs);
+            return 0.25*(*p+p[1]+p[lsa_bl]+p[lsa_bl+1]);
+        }
+        return 0.25*(sample(lev,ci,cj)+sample(lev,ci+1,cj)
+                    +sample(lev,ci,cj+1)+sample(lev,ci+1,cj+1));
+    }
+
+    // Interpolate from the four nearest cell centers on the next coarser
+    // level, reading them directly if they all lie in the covering leaf
+    int pi=ci>>1,pj=cj>>1,oi=ci&1?1:-1,oj=cj&1?1:-1;
+    lev--;
+    if(k.lev==lev) {
+        int li=pi-k.bi*lsa_bs,lj=pj-k.bj*lsa_bs;
+        if(li+oi>=0&&li+oi<lsa_bs&&lj+oj>=0&&lj+oj<lsa_bs) {
+            double *p=plane(b,cur)+li+lsa_bl*lj;
+            oj*=lsa_bl;
+            return 0.5625*(*p)+0.1875*(p[oi]+p[oj])+0.0625*p[oi+oj];
+        }
+    }
+    return 0.5625*sample(lev,pi,pj)
+          +0.1875*(sample(lev,pi+oi,pj)+sample(lev,pi,pj+oj))
+          +0.0625*sample(lev,pi+oi,pj+oj);
+}
+
+/** Sets the ghost cells of the current plane of a leaf. Each side is copied
+ * directly if the neighbor is a leaf at the same level, and is sampled
+ * otherwise. Since the ENO scheme works along rows and columns, the corner
+ * ghost cells are not needed.
+ * \param[in] b the index of the leaf. */
+void levelset_amr::fill_ghosts(int b) {
+    const int r[4][4]={{-lsa_g,0,0,lsa_bs},{lsa_bs,lsa_bs+lsa_g,0,lsa_bs},
+                       {0,lsa_bs,-lsa_g,0},{0,lsa_bs,lsa_bs,lsa_bs+lsa_g}};
+    const int d[4][2]={{-1,0},{1,0},{0,-1},{0,1}};
+    lsa_block &k=bk[b];
+    int L=k.lev,nxb=nbx<<L,nyb=nby<<L,i0=k.bi*lsa_bs,j0=k.bj*lsa_bs;
+    double *p=plane(b,cur);
+    for(int s=0;s<4;s++) {
+        int i,j,ni=k.bi+d[s][0],nj=k.bj+d[s][1];
+        if(x_prd) ni=ni<0?ni+nxb:(ni>=nxb?ni-nxb:ni);
+        if(y_prd) nj=nj<0?nj+nyb:(nj>=nyb?nj-nyb:nj);
+
+        // Copy the strip of cells from a neighbor at the same level
+        if(ni>=0&&ni<nxb&&nj>=0&&nj<nyb) {
+            int q=find(L,ni,nj);
+            if(bk[q].lev==L&&bk[q].ch[0]==-1) {
+                double *pq=plane(q,cur)-lsa_bs*(d[s][0]+lsa_bl*d[s][1]);
+                for(j=r[s][2];j<r[s][3];j++) for(i=r[s][0];i<r[s][1];i++)
+                    p[i+lsa_bl*j]=pq[i+lsa_bl*j];
+                continue;
+            }
+        }
+
+        // Otherwise, sample each ghost cell, which handles the finer and
+        // coarser neighbors and the non-periodic boundaries
+        for(j=r[s][2];j<r[s][3];j++) for(i=r[s][0];i<r[s][1];i++)
+            p[i+lsa_bl*j]=sample(L,i0+i,j0+j);
+    }
+}
+
+/** Computes the updated level set function on a leaf due to advection, using
+ * the second-order ENO scheme, and stores it in the other plane.
+ * \param[in] b the index of the leaf.
+ * \param[in] dt the timestep. */
+void levelset_amr::advance(int b,double dt) {
+    lsa_block &k=bk[b];
+    double hxl=0.5*dt/hx(k.lev),hyl=0.5*dt/hy(k.lev),phix,phiy,
+           *up=k.vel,*vp=up+lsa_bs*lsa_bs;
+    for(int j=0;j<lsa_bs;j++) {
+        double *pp=plane(b,cur)+lsa_bl*j,*pn=plane(b,cur^1)+lsa_bl*j,
+               *pe=pn+lsa_bs;
+        for(;pn<pe;pp++,up++,vp++) {
+            *up>0?phix=hxl*eno2(pp[1],*pp,pp[-1],pp[-2])
+                 :phix=-hxl*eno2(pp[-1],*pp,pp[1],pp[2]);
+            *vp>0?phiy=hyl*eno2(pp[lsa_bl],*pp,pp[-lsa_bl],pp[-2*lsa_bl])
+                 :phiy=-hyl*eno2(pp[-lsa_bl],*pp,pp[lsa_bl],pp[2*lsa_bl]);
+            *(pn++)=*pp+(-*up*phix-*vp*phiy);
+        }
+    }
+}
+
+/** Carries out the simulation for a specified time interval, periodically
+ * saving the output.
+ * \param[in] duration the simulation duration.
+ * \param[in] frames the number of frames to save. */
+void levelset_amr::solve(double duration,int frames) {
+    double t0,t1,t2,adt;
+    int l=timestep_select(duration/frames,adt);
+
+    // Save header file, output the initial fields and record the initial wall
+    // clock time
+    save_header(duration,frames);
+    if(f_num==0) write_files(0), puts("# Output frame 0");
+    t0=wtime();
+
+    // Loop over the output frames
+    for(int k=1;k<=frames;k++) {
+
+        // Perform the simulation steps, regridding at the requested interval
+        for(int j=0;j<l;j++) {
+            step_forward(adt);
+            if(++regrid_steps%regrid_k==0) regrid();
+        }
+
+        // Output the fields
+        t1=wtime();
+        write_files(k+f_num);
+
+        // Print diagnostic information
+        t2=wtime();
+        printf("# Output frame %d [%d, %.8g s, %.8g s] {%d leaves, "
+               "%.3g%% of cells, regrid %d, %.4g ms}\n",k,l,t1-t0,t2-t1,nlf,
+               100.*cell_fraction(),regrids,
+               regrids>0?1e3*regrid_time/regrids:0);
+        regrids=0;regrid_time=0;
+        t0=t2;
+    }
+    f_num+=frames;
+}
+
+/** Steps the level set field forward on all of the leaves.
+ * \param[in] dt the time step to use. */
+void levelset_amr::step_forward(double dt) {
+    int q;
+#pragma omp parallel for
+    for(q=0;q<nlf;q++) fill_ghosts(lf[q]);
+#pragma omp parallel for
+    for(q=0;q<nlf;q++) advance(lf[q],dt);
+    cur^=1;
+    time+=dt;
+}
+
+/** Adapts the grid to the current zero contour. Leaves that come within the
+ * band distance, as estimated by the min_dist routine, are refined by one
+ * level, and the tree is then refined further to keep neighboring leaves
+ * within one level of each other, including diagonally. Groups of four
+ * sibling leaves that are all more than twice the band distance away are
+ * merged into their parent, as long as this does not break the balance. */
+void levelset_amr::regrid() {
+    double t0=wtime(),thr=regrid_w*(dx>dy?dx:dy);
+    int b,q;
+
+    // Estimate the minimum distance to the zero contour on each leaf
+#pragma omp parallel for
+    for(q=0;q<nlf;q++) bk[lf[q]].pmin=min_dist(lf[q]);
+
+    // Refine the leaves near the zero contour and restore the balance
+    for(q=0;q<nlf;q++) {
+        b=lf[q];
+        if(bk[b].lev<lmax&&bk[b].pmin<thr) refine(b);
+    }
+    while(balance());
+
+    // Merge groups of leaves that are far from the zero contour. Newly
+    // created leaves have a distance of zero, so they are never merged.
+    for(b=0;b<nbk;b++) {
+        lsa_block &k=bk[b];
+        if(k.lev<0||k.ch[0]==-1) continue;
+        for(q=0;q<4;q++) {
+            lsa_block &c=bk[k.ch[q]];
+            if(c.ch[0]!=-1||c.pmin<2*thr) break;
+        }
+        if(q==4&&can_coarsen(b)) coarsen(b);
+    }
+    build_leaves();
+    regrids++;
+    regrid_time+=wtime()-t0;
+}
+
+/** Estimates the minimum distance to the zero contour over the cells of a
+ * leaf, by dividing the level set function by its gradient. This remains
+ * valid where the advection has stretched or compressed the level set
+ * function, so that it is no longer a signed distance function. The gradient
+ * is computed with centered differences, switching to one-sided differences
+ * at the block edges so that the ghost cells are not needed.
+ * \param[in] b the index of the leaf.
+ * \return The minimum distance. */
+double levelset_amr::min_dist(int b) {
+    const int e=lsa_bs-1;
+    double xs=1/hx(bk[b].lev),ys=1/hy(bk[b].lev),*p=plane(b,cur),
+           tm=std::numeric_limits<double>::max();
+    for(int j=0;j<lsa_bs;j++) for(int i=0;i<lsa_bs;i++) {
+        double *pp=p+i+lsa_bl*j,
+               gx=xs*(i==0?pp[1]-*pp:(i==e?*pp-pp[-1]:0.5*(pp[1]-pp[-1]))),
+               gy=ys*(j==0?pp[lsa_bl]-*pp:(j==e?*pp-pp[-lsa_bl]
+                                                :0.5*(pp[lsa_bl]-pp[-lsa_bl]))),
+               gg=gx*gx+gy*gy;
+        if(fabs(*pp)<tm*sqrt(gg)) tm=fabs(*pp)/sqrt(gg);
+    }
+    return tm;
+}
+
+/** Refines a leaf into four children, whose values are interpolated from
+ * the current level set function.
+ * \param[in] b the index of the leaf. */
+void levelset_amr::refine(int b) {
+    int c[4],L=bk[b].lev+1,bi=bk[b].bi<<1,bj=bk[b].bj<<1,s;
+
+    // Create the children while the leaf is still in the tree, so that the
+    // sampling routine interpolates from it
+    for(s=0;s<4;s++) {
+        int ci=(bi+(s&1))*lsa_bs,cj=(bj+(s>>1))*lsa_bs;
+        c[s]=new_block(L,bi+(s&1),bj+(s>>1));
+        double *p=plane(c[s],cur);
+        for(int j=0;j<lsa_bs;j++) for(int i=0;i<lsa_bs;i++)
+            p[i+lsa_bl*j]=sample(L,ci+i,cj+j);
+    }
+    for(s=0;s<4;s++) bk[b].ch[s]=c[s];
+}
+
+/** Merges the four children of a block, which must all be leaves, by
+ * averaging their values into the block.
+ * \param[in] b the index of the block. */
+void levelset_amr::coarsen(int b) {
+    const int h=lsa_bs>>1;
+    double *p=plane(b,cur),pm=std::numeric_limits<double>::max();
+    for(int s=0;s<4;s++) {
+        int c=bk[b].ch[s];
+        double *pc=plane(c,cur),*pp=p+(s&1)*h+lsa_bl*(s>>1)*h;
+        for(int j=0;j<h;j++) for(int i=0;i<h;i++) {
+            double *q=pc+2*(i+lsa_bl*j);
+            pp[i+lsa_bl*j]=0.25*(*q+q[1]+q[lsa_bl]+q[lsa_bl+1]);
+        }
+        if(bk[c].pmin<pm) pm=bk[c].pmin;
+        free_block(c);
+    }
+    bk[b].ch[0]=-1;
+    bk[b].pmin=pm;
+}
+
+/** Checks whether merging the children of a block into a leaf would keep
+ * the neighboring leaves within one level of it.
+ * \param[in] b the index of the block.
+ * \return True if the block can be coarsened, false otherwise. */
+bool levelset_amr::can_coarsen(int b) {
+    int L=bk[b].lev,nxb=nbx<<L,nyb=nby<<L;
+    for(int dj=-1;dj<=1;dj++) for(int di=-1;di<=1;di++) {
+        int ni=bk[b].bi+di,nj=bk[b].bj+dj;
+        if(x_prd) ni=(ni+nxb)%nxb;
+        if(y_prd) nj=(nj+nyb)%nyb;
+        if(ni<0||ni>=nxb||nj<0||nj>=nyb||(ni==bk[b].bi&&nj==bk[b].bj)) continue;
+        int q=find(L,ni,nj);
+        if(bk[q].lev==L&&bk[q].ch[0]!=-1)
+            for(int s=0;s<4;s++) if(bk[bk[q].ch[s]].ch[0]!=-1) return false;
+    }
+    return true;
+}
+
+/** Refines any leaf that is more than one level coarser than a neighbor of
+ * another leaf, including diagonal neighbors.
+ * \return True if any leaves were refined, false otherwise. */
+bool levelset_amr::balance() {
+    bool ch=false;
+    for(int b=0;b<nbk;b++) {
+        int L=bk[b].lev;
+        if(L<2||bk[b].ch[0]!=-1) continue;
+        int nxb=nbx<<L,nyb=nby<<L,bi=bk[b].bi,bj=bk[b].bj;
+        for(int dj=-1;dj<=1;dj++) for(int di=-1;di<=1;di++) {
+            int ni=bi+di,nj=bj+dj;
+            if(x_prd) ni=(ni+nxb)%nxb;
+            if(y_prd) nj=(nj+nyb)%nyb;
+            if(ni<0||ni>=nxb||nj<0||nj>=nyb) continue;
+            int q=find(L,ni,nj);
+            if(bk[q].lev<L-1) {refine(q);ch=true;}
+        }
+    }
+    return ch;
+}
+
+/** Computes the fraction of the cells on the equivalent uniform grid at the
+ * finest level that are stored in the leaves.
+ * \return The fraction. */
+double levelset_amr::cell_fraction() {
+    return double(nlf)*lsa_bs*lsa_bs/(double(m)*n);
+}
+
+/** Writes the level set field to the output directory.
+ * \param[in] k the frame number to append to the output. */
+void levelset_amr::write_files(int k) {
+    output("phi",k);
+}
+
+/** Saves the header file.
+ * \param[in] duration the simulation duration.
+ * \param[in] frames the number of frames to save. */
+void levelset_amr::save_header(double duration, int frames) {
+    char *bufc=reinterpret_cast<char*>(buf);
+    sprintf(bufc,"%s/header",filename);
+    FILE *outf=safe_fopen(bufc,f_num==0?"w":"a");
+    fprintf(outf,"%g %g %d\n",time,time+duration,frames);
+    fclose(outf);
+}
+
+/** Outputs the level set field to a file in a format that can be read by
+ * Gnuplot, resampled on to the uniform grid at the finest level. The file
+ * has the same layout as the output from the levelset class.
+ * \param[in] prefix the field name to use as the filename prefix.
+ * \param[in] sn the current frame number to append to the filename. */
+void levelset_amr::output(const char *prefix,const int sn) {
+
+    // Assemble the output filename and open the output file
+    char *bufc=((char*) buf);
+    sprintf(bufc,"%s/%s.%d",filename,prefix,sn);
+    FILE *outf=safe_fopen(bufc,"wb");
+
+    // Output the first line of the file
+    int i,j;
+    float *bp=buf+1;
+    *buf=m;
+    for(i=0;i<m;i++) *(bp++)=ax+(i+0.5)*dx;
+    fwrite(buf,sizeof(float),m+1,outf);
+
+    // Output the field values to the file
+    for(j=0;j<n;j++) {
+        *buf=ay+(j+0.5)*dy;bp=buf+1;
+        for(i=0;i<m;i++) *(bp++)=sample(lmax,i,j);
+        fwrite(buf,sizeof(float),m+1,outf);
+    }
+
+    // Close the file
+    fclose(outf);
+}
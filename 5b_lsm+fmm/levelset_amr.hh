@@ -0,0 +1,207 @@
+#ifndef LEVELSET_AMR_HH
+#define LEVELSET_AMR_HH
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <ctime>
+
+#include "omp.h"
+
+/** The number of grid cells along each side of a block. */
+const int lsa_bs=8;
+
+/** The number of ghost cells on each side of a block, which is enough for the
+ * second-order ENO scheme. */
+const int lsa_g=2;
+
+/** The memory step length of a block, including the ghost cells. */
+const int lsa_bl=lsa_bs+2*lsa_g;
+
+/** The number of values in one plane of a block, including the ghost
+ * cells. */
+const int lsa_bm=lsa_bl*lsa_bl;
+
+/** A square block of grid cells in the quadtree. */
+struct lsa_block {
+    /** The refinement level, which is zero for the root blocks, or -1 if the
+     * block is unused. */
+    int lev;
+    /** The horizontal block coordinate at this level. */
+    int bi;
+    /** The vertical block coordinate at this level. */
+    int bj;
+    /** The indices of the four children, ordered with the horizontal
+     * position varying fastest. The first is -1 if the block is a leaf. */
+    int ch[4];
+    /** The estimated minimum distance from the block to the zero contour,
+     * computed during regridding. */
+    double pmin;
+    /** The two planes of the level set function, including the ghost
+     * cells. */
+    double *phi;
+    /** The horizontal velocity at the cells, followed by the vertical
+     * velocity. */
+    double *vel;
+};
+
+/** A class to carry out a level set simulation on an adaptive grid. The domain
+ * is covered by a forest of quadtrees whose nodes are square blocks of
+ * lsa_bs by lsa_bs cells, so that each child covers a quarter of its parent
+ * at twice the resolution. The leaves are refined to the finest level in a
+ * band around the zero contour, and are coarsened away from it, with
+ * neighboring leaves differing by at most one level. Each leaf is advanced
+ * with the second-order ENO scheme, using ghost cells that are copied from
+ * neighbors at the same level, averaged from finer neighbors, or
+ * interpolated from coarser neighbors. All the leaves take the same
+ * timestep, set by the finest level. */
+class levelset_amr {
+    public:
+        /** The number of root blocks in the horizontal direction. */
+        const int nbx;
+        /** The number of root blocks in the vertical direction. */
+        const int nby;
+        /** The finest refinement level. */
+        const int lmax;
+        /** The number of grid cells in the horizontal direction at the
+         * finest level. */
+        const int m;
+        /** The number of grid cells in the vertical direction at the finest
+         * level. */
+        const int n;
+        /** The periodicity in the x direction. */
+        const bool x_prd;
+        /** The periodicity in the y direction. */
+        const bool y_prd;
+        /** The lower bound in the x direction. */
+        const double ax;
+        /** The lower bound in the y direction. */
+        const double ay;
+        /** The upper bound in the x direction. */
+        const double bx;
+        /** The upper bound in the y direction. */
+        const double by;
+        /** The grid spacing in the x direction at the finest level. */
+        const double dx;
+        /** The grid spacing in the y direction at the finest level. */
+        const double dy;
+        /** The filename of the output directory. */
+        const char *filename;
+        /** The regular timestep to be used. */
+        double dt_reg;
+        /** The current simulation time. */
+        double time;
+        /** The current frame number. */
+        int f_num;
+        /** The number of steps between regrids during the solve routine. */
+        int regrid_k;
+        /** The distance from the zero contour within which the finest level
+         * is used, in units of the larger finest grid spacing. */
+        double regrid_w;
+        /** The number of leaves. */
+        int nlf;
+        levelset_amr(const int nbx_,const int nby_,const int lmax_,
+                     const bool x_prd_,const bool y_prd_,const double ax_,
+                     const double bx_,const double ay_,const double by_,
+                     const char *filename_);
+        ~levelset_amr();
+        void initialize(int type,double dt_pad);
+        void regridding(int k,double width);
+        void solve(double duration,int frames);
+        void step_forward(double dt);
+        void regrid();
+        double sample(int lev,int ci,int cj);
+        double cell_fraction();
+        void write_files(int k);
+        void output(const char *prefix,const int sn);
+        void save_header(double duration,int frames);
+        /** Chooses a timestep size that is the largest value smaller than dt_reg,
+        * such that a given interval length is a perfect multiple of this timestep.
+        * \param[in] interval the interval length to consider.
+        * \param[out] adt the timestep size.
+        * \return The number of timesteps the fit into the interval. */
+        inline int timestep_select(double interval, double &adt) {
+            int l=static_cast<int>(interval/dt_reg)+1;
+            adt=interval/l;
+            return l;
+        }
+    private:
+        /** The type of velocity field. */
+        int vtype;
+        /** The plane of the level set function that holds the current
+         * values. */
+        int cur;
+        /** The number of blocks that have been used, including those on the
+         * free list. */
+        int nbk;
+        /** The number of blocks that have been allocated. */
+        int bmem;
+        /** The blocks. */
+        lsa_block *bk;
+        /** The number of blocks on the free list. */
+        int nfr;
+        /** The free list of unused blocks, whose memory is kept for
+         * reuse. */
+        int *fr;
+        /** The list of leaves. */
+        int *lf;
+        /** The number of steps since the start of the solve routine, used to
+         * schedule the regrids. */
+        int regrid_steps;
+        /** The number of regrids carried out in the current frame. */
+        int regrids;
+        /** The wall clock time spent regridding in the current frame. */
+        double regrid_time;
+        /** Temporary storage used during the output routine. */
+        float *buf;
+        int new_block(int lev,int bi,int bj);
+        void add_block_memory();
+        void free_block(int b);
+        void set_velocity(int b);
+        void set_initial(int b);
+        void build_leaves();
+        int find(int lev,int bi,int bj);
+        void normalize(int lev,int &ci,int &cj);
+        void fill_ghosts(int b);
+        void advance(int b,double dt);
+        double min_dist(int b);
+        void refine(int b);
+        void coarsen(int b);
+        bool can_coarsen(int b);
+        bool balance();
+        void velocity(double x,double y,double &u,double &v);
+        double initial_phi(double x,double y);
+        /** Returns the cell spacing in the x direction at a level.
+         * \param[in] lev the level.
+         * \return The spacing. */
+        inline double hx(int lev) {
+            return dx*(1<<(lmax-lev));
+        }
+        /** Returns the cell spacing in the y direction at a level.
+         * \param[in] lev the level.
+         * \return The spacing. */
+        inline double hy(int lev) {
+            return dy*(1<<(lmax-lev));
+        }
+        /** Returns a pointer to the (0,0) cell of a plane of a block.
+         * \param[in] b the index of the block.
+         * \param[in] p the plane.
+         * \return The pointer. */
+        inline double* plane(int b,int p) {
+            return bk[b].phi+p*lsa_bm+lsa_g*lsa_bl+lsa_g;
+        }
+        /** Calculates the ENO derivative using a sequence of values at four
+         * gridpoints.
+         * \param[in] (p0,p1,p2,p3) the sequence of values to use.
+         * \return The computed derivative. */
+        inline double eno2(double p0,double p1,double p2,double p3) {
+            return fabs(p0-2*p1+p2)>fabs(p1-2*p2+p3)?3*p1-4*p2+p3:p0-p2;
+        }
+#ifdef _OPENMP
+        inline double wtime() {return omp_get_wtime();}
+#else
+        inline double wtime() {return double(clock())*(1./CLOCKS_PER_SEC);}
+#endif
+};
+
+#endif
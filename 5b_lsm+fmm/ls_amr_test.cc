@@ -0,0 +1,88 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <ctime>
+
+#include "common.hh"
+#include "levelset.hh"
+#include "levelset_amr.hh"
+
+// Set up timing routine. If code was compiled with OpenMP, then use the
+// accurate wtime function. Otherwise use the clock function in the ctime
+// library.
+#ifdef _OPENMP
+#include "omp.h"
+inline double wtime() {return omp_get_wtime();}
+#else
+inline double wtime() {return double(clock())*(1./CLOCKS_PER_SEC);}
+#endif
+
+const char fn[]="lsm_amr.out";
+
+int main(int argc,char **argv) {
+
+    // Check for command-line arguments
+    if(argc>4) {
+        fputs("Syntax: ./ls_amr_test [levels] [type] [compare]\n\n"
+              "Simulates a circle advected for one period on an adaptive grid\n"
+              "of 4 by 4 root blocks with the given number of refinement\n"
+              "levels, defaulting to 3 for a finest grid of 256 by 256. The\n"
+              "velocity type is 0 for solid body rotation (default) or 1 for\n"
+              "a radially varying swirl. The frames are saved to the\n"
+              "lsm_amr.out directory, resampled to the finest grid. If the\n"
+              "compare flag is 1, then no frames are saved, and the run is\n"
+              "instead timed and compared to the uniform levelset class at the\n"
+              "finest resolution using the same timestep.\n",stderr);
+        return 1;
+    }
+    int lev=argc>=2?atoi(argv[1]):3,type=argc>=3?atoi(argv[2]):0;
+    bool cmp=argc==4&&atoi(argv[3])==1;
+    if(lev<0||lev>10||type<0||type>1) fatal_error("Invalid test parameters",1);
+
+    // Construct the adaptive simulation class and refine around the initial
+    // zero contour
+    levelset_amr la(4,4,lev,true,true,-1,1,-1,1,fn);
+    la.initialize(type,0.2);
+    if(!cmp) {
+        mkdir(fn,S_IRWXU|S_IRWXG|S_IROTH|S_IXOTH);
+        la.solve(2*M_PI,180);
+        return 0;
+    }
+
+    // Advance the adaptive and uniform simulations over the same steps
+    double adt,t0,t1;
+    int i,j,k,l=la.timestep_select(2*M_PI,adt);
+    levelset ls(la.m,la.n,true,true,-1,1,-1,1,fn);
+    ls.initialize(type,0.2);
+    t0=wtime();
+    for(k=1;k<=l;k++) {
+        la.step_forward(adt);
+        if(k%la.regrid_k==0) la.regrid();
+    }
+    t0=wtime()-t0;
+    t1=wtime();
+    for(k=0;k<l;k++) ls.step_forward(adt);
+    t1=wtime()-t1;
+
+    // Compare the two fields in the band where the finest level is used, and
+    // compare the areas inside the zero contour
+    double e,e_max=0,band=la.regrid_w*la.dx,ar=0,al=0,da=la.dx*la.dy;
+    for(j=0;j<la.n;j++) for(i=0;i<la.m;i++) {
+        double pa=la.sample(la.lmax,i,j),pu=ls.phim[ls.ml*j+i];
+        if(pa<0) ar+=da;
+        if(pu<0) al+=da;
+        if(fabs(pu)<band) {
+            e=fabs(pa-pu);
+            if(e>e_max) e_max=e;
+        }
+    }
+    printf("# Steps              : %d\n"
+           "# Leaves             : %d (%.3g%% of finest cells)\n"
+           "# Adaptive time      : %g s\n"
+           "# Uniform time       : %g s\n"
+           "# Maximum difference : %g within the band\n"
+           "# Area               : %g adaptive, %g uniform, %g exact\n",
+           l,la.nlf,100.*la.cell_fraction(),t0,t1,e_max,ar,al,M_PI*0.09);
+}
@@ -19,6 +19,9 @@ int main() {
     // maximum allowable by a padding factor
     ls.initialize(0,0.2);
 
+    // Save the initial level set function including the ghost regions
+    ls.output("phi_ghost",0,true);
+
     // Run the simulation for a specified duration, outputting snapshots at
     // regular intervals
     ls.solve(2*M_PI,180);
@@ -0,0 +1 @@
+config/config.mk.linux
\ No newline at end of file
@@ -0,0 +1,54 @@
+#ifndef WENO_HH
+#define WENO_HH
+
+/** Computes the fifth-order WENO approximation to a one-sided derivative,
+ * using the weights and smoothness indicators of Jiang and Shu. The function
+ * contains no branches, so that it can be vectorized over the row loops of the
+ * simulation codes.
+ * \param[in] (p0,p1,p2,p3,p4,p5) six consecutive values, running from three
+ *                                gridpoints upwind to two gridpoints downwind
+ *                                of the point where the derivative is
+ *                                evaluated.
+ * \return The derivative, multiplied by the grid spacing. */
+inline double weno5(double p0,double p1,double p2,double p3,double p4,double p5) {
+
+    // Compute the differences between consecutive values, and the
+    // regularization parameter, which is scaled by their maximum magnitude so
+    // that the scheme is independent of the scale of the field
+    double v1=p1-p0,v2=p2-p1,v3=p3-p2,v4=p4-p3,v5=p5-p4,
+           e=v1*v1,t=v2*v2;
+    e=e>t?e:t;t=v3*v3;e=e>t?e:t;
+    t=v4*v4;e=e>t?e:t;t=v5*v5;e=e>t?e:t;
+    e=1e-6*e+1e-99;
+
+    // Compute the smoothness indicators of the three candidate stencils, and
+    // the corresponding nonlinear weights
+    double a=v1-2*v2+v3,b=v1-4*v2+3*v3,
+           s1=13/12.*a*a+0.25*b*b;
+    a=v2-2*v3+v4;b=v2-v4;
+    double s2=13/12.*a*a+0.25*b*b;
+    a=v3-2*v4+v5;b=3*v3-4*v4+v5;
+    double s3=13/12.*a*a+0.25*b*b;
+    s1+=e;s2+=e;s3+=e;
+    s1=0.1/(s1*s1);s2=0.6/(s2*s2);s3=0.3/(s3*s3);
+
+    // Combine the third-order approximations from the candidate stencils
+    return (s1*(2*v1-7*v2+11*v3)+s2*(-v2+5*v3+2*v4)+s3*(2*v3+5*v4-v5))
+          /(6*(s1+s2+s3));
+}
+
+/** Computes the upwinded fifth-order WENO derivative at a gridpoint, choosing
+ * the stencil according to the sign of the velocity. The stencil values are
+ * selected without branching.
+ * \param[in] c the velocity component in the direction of the derivative.
+ * \param[in] (q0,q1,q2,q3,q4,q5,q6) seven consecutive values, centered on the
+ *                                   gridpoint.
+ * \return The derivative, multiplied by the grid spacing. */
+inline double weno5_upwind(double c,double q0,double q1,double q2,double q3,
+                           double q4,double q5,double q6) {
+    bool l=c>0;
+    double d=weno5(l?q0:q6,l?q1:q5,l?q2:q4,q3,l?q4:q2,l?q5:q1);
+    return l?d:-d;
+}
+
+#endif
@@ -21,18 +21,24 @@ void wpng_abort(const char* err_msg) {
  * \param[in] (amin,amax) the values to scale to zero color and maximum color,
  *                        respectively. */
 void write_png(const char *filename,int m,int n,double *co,double amin,double amax) {
-    int j;
 
-    // Convert
+    // Convert the color channels into bytes
+    png_byte *rgb=new png_byte[3*m*n];
+    for(png_byte *bp=rgb,*be=bp+3*m*n;bp<be;) *(bp++)=wpng_truncate(*(co++),amin,amax);
+    write_png(filename,m,n,rgb);
+    delete [] rgb;
+}
+
+/** Writes a PNG image to a file, using color channels that have already been
+ * converted into bytes.
+ * \param[in] filename the name of the file to write to.
+ * \param[in] (m,n) the dimensions of the image.
+ * \param[in] rgb a 2D array of (R,G,B) color channels, stored as bytes. */
+void write_png(const char *filename,int m,int n,unsigned char *rgb) {
+
+    // Set up pointers to the rows of the image
     png_bytep *rowp=new png_bytep[n];
-    for(j=0;j<n;j++) {
-        rowp[j]=new png_byte[3*m];
-        for(png_byte* bp=rowp[j],*be=bp+3*m;bp<be;) {
-            *(bp++)=wpng_truncate(*(co++),amin,amax);
-            *(bp++)=wpng_truncate(*(co++),amin,amax);
-            *(bp++)=wpng_truncate(*(co++),amin,amax);
-        }
-    }
+    for(int j=0;j<n;j++) rowp[j]=rgb+3*m*j;
 
     FILE *fp=fopen(filename,"wb");
     if(fp==NULL) wpng_abort("can't open output file");
@@ -54,7 +60,6 @@ void write_png(const char *filename,int m,int n,double *co,double amin,double am
     fclose(fp);
 
     // Free dynamically allocated memory and structures
-    for(j=n-1;j>=0;j--) delete [] rowp[j];
     delete [] rowp;
     png_destroy_write_struct(&p,&info);
 }
@@ -3,5 +3,6 @@
 
 void wpng_abort(const char* err_msg);
 void write_png(const char *filename,int m,int n,double *co,double amin,double amax);
+void write_png(const char *filename,int m,int n,unsigned char *rgb);
 
 #endif